@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "crc.h"
+
+/* Bytes to checksum per buffer size and implementation */
+#define BENCH_BYTES (256UL << 20)
+
+static const size_t sizes[] = {
+    8, 64, 256, 1500, 4096, 9000, 65536
+};
+
+static const int impls[] = {
+    CRC32_IMPL_TABLE, CRC32_IMPL_SLICE8,
+    CRC32_IMPL_SLICE16, CRC32_IMPL_HW
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static size_t total = BENCH_BYTES;
+
+static void
+help(char **argv)
+{
+    printf(
+        "usage: %s [-h] [-m <MiB>]\n"
+        "[-h]   Show this message\n"
+        "[-m]   MiB to checksum per size and implementation\n",
+        argv[0]
+    );
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Time one implementation over one buffer size
+ *
+ * @buf: Buffer to checksum
+ * @size: Size of the buffer
+ * @res: Last CRC is written here
+ *
+ * Returns the throughput in MiB/s
+ */
+static double
+bench_one(const uint8_t *buf, size_t size, uint32_t *res)
+{
+    volatile uint32_t sink = 0;
+    size_t i, iters;
+    double start, end;
+
+    iters = total / size;
+    if (iters == 0) {
+        iters = 1;
+    }
+
+    start = now();
+    for (i = 0; i < iters; ++i) {
+        sink ^= crc32(buf, size);
+    }
+    end = now();
+
+    *res = crc32(buf, size);
+    (void)sink;
+    return (iters * size) / (end - start) / (1 << 20);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t ref, crc;
+    const char *name;
+    uint8_t *buf;
+    size_t i, j;
+    double mbps;
+    int opt, error = 0;
+
+    while ((opt = getopt(argc, argv, "hm:")) != -1) {
+        switch (opt) {
+        case 'h':
+            help(argv);
+            return -1;
+        case 'm':
+            total = strtoul(optarg, NULL, 10) << 20;
+            break;
+        }
+    }
+
+    buf = malloc(sizes[NSIZES - 1]);
+    if (buf == NULL) {
+        printf("error: out of memory\n");
+        return -1;
+    }
+
+    srand(0);
+    for (i = 0; i < sizes[NSIZES - 1]; ++i) {
+        buf[i] = rand();
+    }
+
+    printf("default: %s\n", crc32_impl_name(CRC32_IMPL_AUTO));
+    printf("%8s", "size");
+    for (j = 0; j < NIMPLS; ++j) {
+        name = crc32_impl_name(impls[j]);
+        printf(" %12s", (name != NULL) ? name : "-");
+    }
+    printf("   (MiB/s)\n");
+
+    for (i = 0; i < NSIZES; ++i) {
+        printf("%8zu", sizes[i]);
+        crc32_select(CRC32_IMPL_TABLE);
+        ref = crc32(buf, sizes[i]);
+
+        for (j = 0; j < NIMPLS; ++j) {
+            if (crc32_select(impls[j]) < 0) {
+                printf(" %12s", "n/a");
+                continue;
+            }
+
+            mbps = bench_one(buf, sizes[i], &crc);
+            printf(" %12.1f", mbps);
+            if (crc != ref) {
+                printf("\nerror: %s: CRC mismatch (%08x != %08x)\n",
+                       crc32_impl_name(impls[j]), crc, ref);
+                error = -1;
+            }
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return error;
+}
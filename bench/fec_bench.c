@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "fec.h"
+
+/* Bytes to run through gf_mul_add() per size and implementation */
+#define BENCH_BYTES (256UL << 20)
+
+static const size_t sizes[] = {
+    8, 64, 256, 1500, 4096, 9000, 65536
+};
+
+static const int impls[] = {
+    FEC_IMPL_SCALAR, FEC_IMPL_SSSE3, FEC_IMPL_AVX2
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static size_t total = BENCH_BYTES;
+
+static void
+help(char **argv)
+{
+    printf(
+        "usage: %s [-h] [-m <MiB>]\n"
+        "[-h]   Show this message\n"
+        "[-m]   MiB to multiply per size and implementation\n",
+        argv[0]
+    );
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Time one implementation over one buffer size
+ *
+ * @dst: Buffer to accumulate into
+ * @src: Buffer to multiply
+ * @size: Size of the buffers
+ *
+ * Returns the throughput in MiB/s
+ */
+static double
+bench_one(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t i, iters;
+    double start, end;
+
+    iters = total / size;
+    if (iters == 0) {
+        iters = 1;
+    }
+
+    start = now();
+    for (i = 0; i < iters; ++i) {
+        gf_mul_add(dst, src, (i % 255) + 1, size);
+    }
+    end = now();
+
+    return (iters * size) / (end - start) / (1 << 20);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint8_t *src, *ref, *dst;
+    const char *name;
+    size_t i, j, max;
+    double mbps;
+    int opt, error = 0;
+
+    while ((opt = getopt(argc, argv, "hm:")) != -1) {
+        switch (opt) {
+        case 'h':
+            help(argv);
+            return -1;
+        case 'm':
+            total = strtoul(optarg, NULL, 10) << 20;
+            break;
+        }
+    }
+
+    max = sizes[NSIZES - 1];
+    src = malloc(max);
+    ref = malloc(max);
+    dst = malloc(max);
+    if (src == NULL || ref == NULL || dst == NULL) {
+        printf("error: out of memory\n");
+        return -1;
+    }
+
+    srand(0);
+    for (i = 0; i < max; ++i) {
+        src[i] = rand();
+    }
+
+    printf("default: %s\n", fec_impl_name(FEC_IMPL_AUTO));
+    printf("%8s", "size");
+    for (j = 0; j < NIMPLS; ++j) {
+        name = fec_impl_name(impls[j]);
+        printf(" %12s", (name != NULL) ? name : "-");
+    }
+    printf("   (MiB/s)\n");
+
+    for (i = 0; i < NSIZES; ++i) {
+        printf("%8zu", sizes[i]);
+        fec_select(FEC_IMPL_SCALAR);
+        memset(ref, 0, sizes[i]);
+        gf_mul_add(ref, src, 0x8E, sizes[i]);
+
+        for (j = 0; j < NIMPLS; ++j) {
+            if (fec_select(impls[j]) < 0) {
+                printf(" %12s", "n/a");
+                continue;
+            }
+
+            mbps = bench_one(dst, src, sizes[i]);
+            printf(" %12.1f", mbps);
+
+            memset(dst, 0, sizes[i]);
+            gf_mul_add(dst, src, 0x8E, sizes[i]);
+            if (memcmp(dst, ref, sizes[i]) != 0) {
+                printf("\nerror: %s: product mismatch\n",
+                       fec_impl_name(impls[j]));
+                error = -1;
+            }
+        }
+        printf("\n");
+    }
+
+    free(src);
+    free(ref);
+    free(dst);
+    return error;
+}
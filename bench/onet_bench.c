@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "link.h"
+#include "lo.h"
+
+#define MAX_LIST 16             /* Most sizes or batches to run */
+#define MAX_BATCH 64            /* Largest batch size */
+#define MAX_SIZE 9000           /* Largest payload size */
+#define IDLE_MS 200             /* Receiver gives up after this long */
+
+/*
+ * Latency histogram, HDR style: values below 2 * HIST_SUB
+ * get a bucket each, and every power of two above that is
+ * split in HIST_SUB buckets, which keeps the error under
+ * 1 / HIST_SUB for any value.
+ */
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/*
+ * State shared with the receiving thread
+ *
+ * @rx: Link to receive on
+ * @echo: Where to echo datagrams back to (ping-pong)
+ * @size: Payload size
+ * @stop: Set once the sender is done
+ * @count: Datagrams received
+ * @last: When the last datagram came in
+ */
+struct bench_rx {
+    struct onet_link *rx;
+    mac_addr_t echo;
+    uint32_t size;
+    volatile bool stop;
+    uint64_t count;
+    double last;
+};
+
+static uint32_t sizes[MAX_LIST] = { 16, 64, 256, 1024, 1400 };
+static uint32_t nsizes = 5;
+static uint32_t batches[MAX_LIST] = { 1, 8, 32 };
+static uint32_t nbatches = 3;
+static uint64_t tput_count = 200000;
+static uint64_t ping_count = 20000;
+static uint64_t hist[HIST_BUCKETS];
+
+static void
+help(char **argv)
+{
+    printf(
+        "usage: %s [-h] [-i <iface> -I <iface>] [-s <sizes>] [-b <batches>]\n"
+        "        [-n <count>] [-l <count>]\n"
+        "[-h]   Show this message\n"
+        "[-i]   Interface to send from (default: loopback wire)\n"
+        "[-I]   Interface to receive on, e.g. the other end of a veth\n"
+        "[-s]   Payload sizes, comma separated\n"
+        "[-b]   Batch sizes, comma separated (1 is dgram_send())\n"
+        "[-n]   Datagrams per throughput run (0 to skip)\n"
+        "[-l]   Round trips per latency run (0 to skip)\n",
+        argv[0]
+    );
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+cpu_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Parse a comma separated list of numbers
+ *
+ * Returns the number of entries.
+ */
+static uint32_t
+parse_list(const char *s, uint32_t *res, uint32_t max)
+{
+    uint32_t n = 0;
+    char *end;
+
+    while (*s != '\0' && n < max) {
+        res[n] = strtoul(s, &end, 10);
+        if (end == s || res[n] == 0) {
+            break;
+        }
+
+        ++n;
+        s = (*end == ',') ? end + 1 : end;
+    }
+
+    return n;
+}
+
+static uint32_t
+hist_index(uint64_t v)
+{
+    uint32_t shift;
+
+    if (v < 2 * HIST_SUB) {
+        return v;
+    }
+
+    shift = (63 - __builtin_clzll(v)) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (uint32_t)(v >> shift) - HIST_SUB;
+}
+
+/*
+ * Get the middle of the range of values a bucket holds
+ */
+static uint64_t
+hist_value(uint32_t idx)
+{
+    uint32_t shift;
+
+    if (idx < 2 * HIST_SUB) {
+        return idx;
+    }
+
+    shift = idx / HIST_SUB - 1;
+    return ((uint64_t)(idx % HIST_SUB + HIST_SUB) << shift) +
+        ((1ULL << shift) >> 1);
+}
+
+/*
+ * Get a percentile out of the histogram
+ *
+ * @total: Number of values recorded
+ * @max: Largest value recorded
+ * @pct: Percentile wanted
+ */
+static uint64_t
+hist_pct(uint64_t total, uint64_t max, double pct)
+{
+    uint64_t want, seen = 0;
+
+    want = (uint64_t)(total * pct / 100.0 + 0.5);
+    if (want == 0) {
+        want = 1;
+    }
+
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += hist[i];
+        if (seen >= want) {
+            return (hist_value(i) < max) ? hist_value(i) : max;
+        }
+    }
+
+    return max;
+}
+
+/*
+ * Count datagrams until the sender stops and the link
+ * goes quiet
+ */
+static void *
+sink(void *arg)
+{
+    struct bench_rx *brx = arg;
+    char buf[MAX_SIZE];
+    rx_len_t len;
+
+    for (;;) {
+        len = dgram_recv_timed(brx->rx, buf, brx->size, IDLE_MS);
+        if (len == -EAGAIN) {
+            if (brx->stop) {
+                break;
+            }
+            continue;
+        }
+
+        if (len >= 0) {
+            ++brx->count;
+            brx->last = now();
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Send every datagram back where it came from until
+ * the sender stops
+ */
+static void *
+echo(void *arg)
+{
+    struct bench_rx *brx = arg;
+    char buf[MAX_SIZE];
+    rx_len_t len;
+
+    while (!brx->stop) {
+        len = dgram_recv_timed(brx->rx, buf, brx->size, IDLE_MS);
+        if (len >= 0) {
+            dgram_send(brx->rx, brx->echo, buf, brx->size);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Push datagrams from one link to the other as fast as
+ * we can and print what made it through
+ */
+static void
+bench_tput(struct onet_link *tx, struct onet_link *rx, uint32_t size,
+           uint32_t batch)
+{
+    struct dgram_vec vec[MAX_BATCH];
+    struct bench_rx brx;
+    pthread_t thread;
+    double start, end, cpu, tx_end;
+    uint64_t sent = 0;
+    int error = 0;
+    char *buf;
+
+    buf = calloc(1, size);
+    if (buf == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < batch; ++i) {
+        vec[i].addr = rx->hwaddr;
+        vec[i].buf = buf;
+        vec[i].len = size;
+    }
+
+    memset(&brx, 0, sizeof(brx));
+    brx.rx = rx;
+    brx.size = size;
+    pthread_create(&thread, NULL, sink, &brx);
+
+    cpu = cpu_now();
+    start = now();
+    while (sent < tput_count && error >= 0) {
+        if (batch == 1) {
+            error = dgram_send(tx, rx->hwaddr, buf, size);
+            sent += (error >= 0);
+            continue;
+        }
+
+        /* Nothing went out at all, something is wrong */
+        error = dgram_send_batch(tx, vec, batch);
+        if (error == 0) {
+            error = (vec[0].status < 0) ? vec[0].status : -EIO;
+        }
+        sent += (error > 0) ? error : 0;
+    }
+    tx_end = now();
+
+    brx.stop = true;
+    pthread_join(thread, NULL);
+    end = (brx.count > 0) ? brx.last : tx_end;
+    cpu = cpu_now() - cpu;
+
+    if (error < 0) {
+        printf("%6u %5u  send failed (%d)\n", size, batch, error);
+        free(buf);
+        return;
+    }
+
+    printf("%6u %5u %10.0f %10.0f %8.3f %8.1f %6.2f\n",
+           size, batch, sent / (tx_end - start),
+           brx.count / (end - start),
+           brx.count * size * 8.0 / (end - start) / 1e9,
+           (brx.count > 0) ? cpu / brx.count * 1e9 : 0.0,
+           100.0 - 100.0 * brx.count / sent);
+    free(buf);
+}
+
+/*
+ * Bounce datagrams off the other link one at a time
+ * and print round trip time percentiles
+ */
+static void
+bench_ping(struct onet_link *tx, struct onet_link *rx, uint32_t size)
+{
+    struct bench_rx brx;
+    pthread_t thread;
+    uint64_t seq, rtt, lost = 0, done = 0, min = UINT64_MAX, max = 0;
+    double start;
+    char *buf, *rbuf;
+    rx_len_t len;
+
+    if (size < sizeof(seq)) {
+        size = sizeof(seq);
+    }
+
+    buf = calloc(1, size);
+    rbuf = calloc(1, size);
+    if (buf == NULL || rbuf == NULL) {
+        free(buf);
+        free(rbuf);
+        return;
+    }
+
+    memset(&brx, 0, sizeof(brx));
+    brx.rx = rx;
+    brx.echo = tx->hwaddr;
+    brx.size = size;
+    pthread_create(&thread, NULL, echo, &brx);
+    memset(hist, 0, sizeof(hist));
+
+    for (seq = 0; seq < ping_count; ++seq) {
+        memcpy(buf, &seq, sizeof(seq));
+        start = now();
+        dgram_send(tx, rx->hwaddr, buf, size);
+
+        /* Skip echoes of pings we already gave up on */
+        do {
+            len = dgram_recv_timed(tx, rbuf, size, 1000);
+        } while (len >= 0 && memcmp(rbuf, &seq, sizeof(seq)) != 0);
+
+        if (len < 0) {
+            ++lost;
+            continue;
+        }
+
+        rtt = (now() - start) * 1e9;
+        min = (rtt < min) ? rtt : min;
+        max = (rtt > max) ? rtt : max;
+        ++hist[hist_index(rtt)];
+        ++done;
+    }
+
+    brx.stop = true;
+    pthread_join(thread, NULL);
+
+    if (done == 0) {
+        printf("%6u  all %lu lost\n", size, (unsigned long)lost);
+    } else {
+        printf("%6u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %6lu\n",
+               size, min / 1e3,
+               hist_pct(done, max, 50) / 1e3,
+               hist_pct(done, max, 90) / 1e3,
+               hist_pct(done, max, 99) / 1e3,
+               hist_pct(done, max, 99.9) / 1e3,
+               hist_pct(done, max, 99.99) / 1e3,
+               max / 1e3, (unsigned long)lost);
+    }
+
+    free(buf);
+    free(rbuf);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct onet_link tx, rx;
+    struct onet_lo *lo = NULL;
+    const char *tx_iface = NULL, *rx_iface = NULL;
+    int opt, error;
+
+    while ((opt = getopt(argc, argv, "hi:I:s:b:n:l:")) != -1) {
+        switch (opt) {
+        case 'h':
+            help(argv);
+            return -1;
+        case 'i':
+            tx_iface = optarg;
+            break;
+        case 'I':
+            rx_iface = optarg;
+            break;
+        case 's':
+            nsizes = parse_list(optarg, sizes, MAX_LIST);
+            break;
+        case 'b':
+            nbatches = parse_list(optarg, batches, MAX_LIST);
+            break;
+        case 'n':
+            tput_count = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            ping_count = strtoull(optarg, NULL, 10);
+            break;
+        }
+    }
+
+    if ((tx_iface == NULL) != (rx_iface == NULL)) {
+        printf("error: -i and -I go together\n");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < nsizes; ++i) {
+        if (sizes[i] > MAX_SIZE) {
+            printf("error: payload size %u is too large\n", sizes[i]);
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < nbatches; ++i) {
+        if (batches[i] > MAX_BATCH) {
+            printf("error: batch size %u is too large\n", batches[i]);
+            return -1;
+        }
+    }
+
+    if (tx_iface != NULL) {
+        if ((error = onet_open(tx_iface, &tx)) < 0) {
+            printf("error: could not open %s (%d)\n", tx_iface, error);
+            return -1;
+        }
+        if ((error = onet_open(rx_iface, &rx)) < 0) {
+            printf("error: could not open %s (%d)\n", rx_iface, error);
+            onet_close(&tx);
+            return -1;
+        }
+    } else {
+        if (onet_lo_create(0, &lo) < 0 || onet_lo_open(lo, &tx) < 0 ||
+            onet_lo_open(lo, &rx) < 0) {
+            printf("error: could not set up a loopback wire\n");
+            return -1;
+        }
+    }
+
+    printf("link: %s -> %s\n", (tx_iface != NULL) ? tx_iface : "lo",
+           (rx_iface != NULL) ? rx_iface : "lo");
+
+    if (tput_count > 0) {
+        printf("\n%6s %5s %10s %10s %8s %8s %6s\n", "size", "batch",
+               "tx pps", "rx pps", "Gbit/s", "ns/pkt", "loss%");
+        for (uint32_t i = 0; i < nsizes; ++i) {
+            for (uint32_t j = 0; j < nbatches; ++j) {
+                bench_tput(&tx, &rx, sizes[i], batches[j]);
+            }
+        }
+    }
+
+    if (ping_count > 0) {
+        printf("\n%6s %8s %8s %8s %8s %8s %8s %8s %6s   (RTT, us)\n",
+               "size", "min", "p50", "p90", "p99", "p99.9", "p99.99",
+               "max", "lost");
+        for (uint32_t i = 0; i < nsizes; ++i) {
+            bench_ping(&tx, &rx, sizes[i]);
+        }
+    }
+
+    onet_close(&tx);
+    onet_close(&rx);
+    if (lo != NULL) {
+        onet_lo_destroy(lo);
+    }
+
+    return 0;
+}
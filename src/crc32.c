@@ -27,10 +27,34 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/errno.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#endif
 #include "crc.h"
 
+/*
+ * Buffers shorter than this are not worth setting
+ * up the folding for.
+ */
+#define CRC32_FOLD_MIN 64
+
+/*
+ * Bytes copied per step of crc32_copy(), small enough
+ * for the copy to still be in L1 when it is checksummed.
+ */
+#define CRC32_COPY_CHUNK 2048
+
+/* Bit reflected CRC32 polynomial */
+#define CRC32_POLY 0xEDB88320
+
 uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
 	0xE963A535, 0x9E6495A3,	0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
@@ -77,15 +101,448 @@ uint32_t crc32_tab[] = {
 	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
+/*
+ * Tables for slicing-by-N, crc32_slice_tab[0] is
+ * crc32_tab and crc32_slice_tab[n][i] is the CRC of
+ * byte `i' followed by `n' zero bytes.
+ */
+static uint32_t crc32_slice_tab[16][256];
+
+/*
+ * crc32_x2n_tab[k] is x^(2^k) modulo the CRC32
+ * polynomial, used to shift a CRC over zero bytes
+ * in O(log n) for crc32_combine().
+ */
+static uint32_t crc32_x2n_tab[32];
+
+/*
+ * Describes a CRC32 implementation. Every implementation
+ * updates a raw CRC register (no final inversion).
+ *
+ * @name: Name to report
+ * @update: Update `crc' with `len' bytes at `p'
+ * @avail: Returns true if the CPU can run it (NULL if always)
+ */
+struct crc32_impl {
+    const char *name;
+    uint32_t (*update)(uint32_t crc, const uint8_t *p, size_t len);
+    int (*avail)(void);
+};
+
+static uint32_t crc32_update_table(uint32_t crc, const uint8_t *p, size_t len);
+static uint32_t (*crc32_update_fn)(uint32_t, const uint8_t *, size_t) =
+    crc32_update_table;
+static int crc32_cur_impl = CRC32_IMPL_TABLE;
+
+/*
+ * Load a little endian 32-bit word
+ */
+static inline uint32_t
+crc32_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Classic byte at a time table loop
+ */
+static uint32_t
+crc32_update_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len--) {
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/*
+ * Slicing-by-8, 8 bytes per iteration
+ */
+static uint32_t
+crc32_update_slice8(uint32_t crc, const uint8_t *p, size_t len)
+{
+    const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32_slice_tab;
+    uint32_t one, two;
+
+    while (len >= 8) {
+        one = crc32_le32(p) ^ crc;
+        two = crc32_le32(p + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+            t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+            t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+            t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    return crc32_update_table(crc, p, len);
+}
+
+/*
+ * Slicing-by-16, 16 bytes per iteration
+ */
+static uint32_t
+crc32_update_slice16(uint32_t crc, const uint8_t *p, size_t len)
+{
+    const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32_slice_tab;
+    uint32_t w0, w1, w2, w3;
+
+    while (len >= 16) {
+        w0 = crc32_le32(p) ^ crc;
+        w1 = crc32_le32(p + 4);
+        w2 = crc32_le32(p + 8);
+        w3 = crc32_le32(p + 12);
+        crc = t[15][w0 & 0xFF] ^ t[14][(w0 >> 8) & 0xFF] ^
+            t[13][(w0 >> 16) & 0xFF] ^ t[12][w0 >> 24] ^
+            t[11][w1 & 0xFF] ^ t[10][(w1 >> 8) & 0xFF] ^
+            t[9][(w1 >> 16) & 0xFF] ^ t[8][w1 >> 24] ^
+            t[7][w2 & 0xFF] ^ t[6][(w2 >> 8) & 0xFF] ^
+            t[5][(w2 >> 16) & 0xFF] ^ t[4][w2 >> 24] ^
+            t[3][w3 & 0xFF] ^ t[2][(w3 >> 8) & 0xFF] ^
+            t[1][(w3 >> 16) & 0xFF] ^ t[0][w3 >> 24];
+        p += 16;
+        len -= 16;
+    }
+
+    return crc32_update_slice8(crc, p, len);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Fold 64 bytes at a time with carry-less multiplies, then
+ * Barrett reduce down to 32 bits. See "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction"
+ * (Intel, 2009), the constants are those of the bit
+ * reflected CRC32 polynomial.
+ *
+ * `len' must be a multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+crc32_fold_pclmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = k1k2;
+    p += 64;
+    len -= 64;
+
+    /* Fold four lanes in parallel */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        p += 64;
+        len -= 64;
+    }
+
+    /* Fold the four lanes into one */
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold in whatever 16 byte blocks are left */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)p);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        p += 16;
+        len -= 16;
+    }
+
+    /* 128 bits down to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = k5k0;
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction down to 32 bits */
+    x0 = poly;
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t
+crc32_update_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    size_t n;
+
+    if (len >= CRC32_FOLD_MIN) {
+        n = len & ~(size_t)15;
+        crc = crc32_fold_pclmul(crc, p, n);
+        p += n;
+        len -= n;
+    }
+
+    return crc32_update_slice8(crc, p, len);
+}
+
+static int
+crc32_hw_avail(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1");
+}
+
+#define CRC32_HW_NAME "pclmulqdq"
+#elif defined(__aarch64__)
+/*
+ * ARMv8 CRC32 instructions, these use the same (bit
+ * reflected) polynomial and take a raw CRC register.
+ */
+__attribute__((target("+crc")))
+static uint32_t
+crc32_update_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t v;
+
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = __crc32b(crc, *p++);
+        --len;
+    }
+
+    while (len >= 8) {
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32d(crc, v);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+
+    return crc;
+}
+
+static int
+crc32_hw_avail(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#define CRC32_HW_NAME "armv8-crc32"
+#endif  /* __x86_64__ || __i386__ */
+
+static const struct crc32_impl crc32_impls[] = {
+    [CRC32_IMPL_TABLE] = { "table", crc32_update_table, NULL },
+    [CRC32_IMPL_SLICE8] = { "slice8", crc32_update_slice8, NULL },
+    [CRC32_IMPL_SLICE16] = { "slice16", crc32_update_slice16, NULL },
+#ifdef CRC32_HW_NAME
+    [CRC32_IMPL_HW] = { CRC32_HW_NAME, crc32_update_hw, crc32_hw_avail },
+#endif
+};
+
+#define CRC32_NIMPL (sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+
+/*
+ * Multiply two polynomials modulo the CRC32
+ * polynomial (bit reflected).
+ */
+static uint32_t
+crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31, p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+/*
+ * Get x^(n * 2^k) modulo the CRC32 polynomial
+ */
+static uint32_t
+crc32_x2nmodp(size_t n, unsigned int k)
+{
+    uint32_t p = (uint32_t)1 << 31;
+
+    while (n) {
+        if (n & 1) {
+            p = crc32_multmodp(crc32_x2n_tab[k & 31], p);
+        }
+
+        n >>= 1;
+        ++k;
+    }
+
+    return p;
+}
+
+/*
+ * Build the slicing tables and pick the fastest
+ * implementation the CPU supports.
+ */
+__attribute__((constructor))
+static void
+crc32_init(void)
+{
+    uint32_t v;
+    size_t i, n;
+
+    for (i = 0; i < 256; ++i) {
+        crc32_slice_tab[0][i] = crc32_tab[i];
+    }
+
+    for (n = 1; n < 16; ++n) {
+        for (i = 0; i < 256; ++i) {
+            v = crc32_slice_tab[n - 1][i];
+            crc32_slice_tab[n][i] = crc32_tab[v & 0xFF] ^ (v >> 8);
+        }
+    }
+
+    /* x^1, then keep squaring */
+    v = (uint32_t)1 << 30;
+    crc32_x2n_tab[0] = v;
+    for (n = 1; n < 32; ++n) {
+        crc32_x2n_tab[n] = v = crc32_multmodp(v, v);
+    }
+
+    if (crc32_select(CRC32_IMPL_HW) < 0) {
+        crc32_select(CRC32_IMPL_SLICE16);
+    }
+}
+
+int
+crc32_select(int impl)
+{
+    const struct crc32_impl *ip;
+
+    if (impl == CRC32_IMPL_AUTO) {
+        if (crc32_select(CRC32_IMPL_HW) == 0) {
+            return 0;
+        }
+        return crc32_select(CRC32_IMPL_SLICE16);
+    }
+
+    if (impl < 0 || (size_t)impl >= CRC32_NIMPL) {
+        return -ENOTSUP;
+    }
+
+    ip = &crc32_impls[impl];
+    if (ip->update == NULL) {
+        return -ENOTSUP;
+    }
+    if (ip->avail != NULL && !ip->avail()) {
+        return -ENOTSUP;
+    }
+
+    crc32_update_fn = ip->update;
+    crc32_cur_impl = impl;
+    return 0;
+}
+
+const char *
+crc32_impl_name(int impl)
+{
+    if (impl == CRC32_IMPL_AUTO) {
+        impl = crc32_cur_impl;
+    }
+
+    if (impl < 0 || (size_t)impl >= CRC32_NIMPL) {
+        return NULL;
+    }
+
+    return crc32_impls[impl].name;
+}
+
 uint32_t
 crc32(const void *buf, size_t size)
 {
-    const uint8_t *p = buf;
-    uint32_t v = ~0U;
+    return crc32_update_fn(~0U, buf, size);
+}
 
-    while (size--) {
-        v = crc32_tab[(v ^ *p++) & 0xFF] ^ (v >> 8);
+uint32_t
+crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    return crc32_update_fn(crc, buf, size);
+}
+
+uint32_t
+crc32_copy(uint32_t crc, void *dst, const void *src, size_t size)
+{
+    uint8_t *dp = dst;
+    const uint8_t *sp = src;
+    size_t n;
+
+    while (size > 0) {
+        n = (size < CRC32_COPY_CHUNK) ? size : CRC32_COPY_CHUNK;
+        memcpy(dp, sp, n);
+        crc = crc32_update_fn(crc, dp, n);
+        dp += n;
+        sp += n;
+        size -= n;
     }
 
-    return v;
+    return crc;
+}
+
+uint32_t
+crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    /*
+     * The CRC of A followed by B is the CRC of A shifted
+     * over len(B) zero bytes, XORed with the CRC of B.
+     * Our CRCs start at ~0 with no final inversion, which
+     * is what the ~crc1 accounts for.
+     */
+    return crc32_multmodp(crc32_x2nmodp(len2, 3), ~crc1) ^ crc2;
 }
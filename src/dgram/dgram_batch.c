@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "dgram_var.h"
+
+/*
+ * Max number of datagrams moved per
+ * sendmmsg() / recvmmsg() call
+ */
+#define DGRAM_BATCH_MAX 64
+
+/*
+ * Headers of a single datagram in a batch, the data
+ * is always scattered straight from / to the caller's
+ * buffer.
+ */
+struct dgram_batch_hdr {
+    char buf[DGRAM_LEN(0)];
+};
+
+/*
+ * Send a batch through the TX ring, every datagram is
+ * built in its own slot and one kick sends them all.
+ */
+static int
+dgram_ring_send_batch(struct onet_link *link, struct dgram_vec *vec,
+                      unsigned int count)
+{
+    struct dgram_params params;
+    unsigned int i, sent = 0;
+    char *data;
+
+    pthread_mutex_lock(&link->tx_lock);
+    for (i = 0; i < count; ++i) {
+        params.dst = vec[i].addr;
+        params.buf = vec[i].buf;
+        params.len = vec[i].len;
+        params.type = OTYPE_DATA;
+        params.port = DGRAM_PORT_DEFAULT;
+        params.frag = 0;
+
+        data = dgram_tx_slot(link, &params);
+        if (data == NULL) {
+            vec[i].status = -errno;
+            continue;
+        }
+
+        dgram_fill(data - DGRAM_LEN(0), vec[i].buf, vec[i].len);
+        dgram_tx_push(link);
+        vec[i].status = vec[i].len;
+        ++sent;
+    }
+
+    pthread_mutex_unlock(&link->tx_lock);
+    dgram_tx_kick(link, MSG_DONTWAIT);
+    return sent;
+}
+
+/*
+ * Receive a batch out of the RX ring. Only the first
+ * datagram is waited for.
+ */
+static int
+dgram_ring_recv_batch(struct onet_link *link, struct dgram_vec *vec,
+                      unsigned int count)
+{
+    const struct ether_hdr *eth;
+    unsigned int i, filled = 0;
+    size_t frame_len;
+    char *p;
+
+    while (filled < count) {
+        p = dgram_rx_next(
+            link, &frame_len,
+            (filled == 0) ? dgram_rx_timeout(link) : 0
+        );
+        if (p == NULL) {
+            if (filled == 0) {
+                return -errno;
+            }
+            break;
+        }
+
+        if (!dgram_accept(link, p, DGRAM_DATA(p), frame_len)) {
+            continue;
+        }
+
+        frame_len = dgram_frame_len(p);
+
+        /* Fragments do not fit a vector slot, see dgram_recv() */
+        if (DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+            continue;
+        }
+
+        eth = (const void *)p;
+        frame_len -= DGRAM_LEN(0);
+        if (frame_len > vec[filled].len) {
+            frame_len = vec[filled].len;
+        }
+
+        memcpy(vec[filled].buf, DGRAM_DATA(p), frame_len);
+        vec[filled].addr = mac_swap((void *)eth->source);
+        vec[filled].status = frame_len;
+        ++filled;
+    }
+
+    for (i = filled; i < count; ++i) {
+        vec[i].status = -EAGAIN;
+    }
+
+    return filled;
+}
+
+int
+dgram_send_batch(struct onet_link *link, struct dgram_vec *vec,
+                 unsigned int count)
+{
+    struct dgram_batch_hdr hdrs[DGRAM_BATCH_MAX];
+    struct mmsghdr msgs[DGRAM_BATCH_MAX];
+    struct iovec iov[DGRAM_BATCH_MAX][2];
+    struct dgram_params params;
+    struct sockaddr_ll saddr;
+    unsigned int i, n, off = 0, sent = 0;
+    int ret;
+
+    if (link == NULL || vec == NULL) {
+        return -EINVAL;
+    }
+
+    if (link->tx_ring.base != NULL) {
+        return dgram_ring_send_batch(link, vec, count);
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        for (i = 0; i < count; ++i) {
+            params.dst = vec[i].addr;
+            params.buf = vec[i].buf;
+            params.len = vec[i].len;
+            params.type = OTYPE_DATA;
+            params.port = DGRAM_PORT_DEFAULT;
+            params.frag = 0;
+            vec[i].status = dgram_do_send(link, &params);
+            if (vec[i].status >= 0) {
+                ++sent;
+            }
+        }
+        return sent;
+    }
+
+    dgram_sockaddr(link, &saddr);
+    while (off < count) {
+        n = count - off;
+        if (n > DGRAM_BATCH_MAX) {
+            n = DGRAM_BATCH_MAX;
+        }
+
+        /* Headers go in our buffers, data is sent in place */
+        for (i = 0; i < n; ++i) {
+            params.dst = vec[off + i].addr;
+            params.buf = vec[off + i].buf;
+            params.len = vec[off + i].len;
+            params.type = OTYPE_DATA;
+            params.port = DGRAM_PORT_DEFAULT;
+            params.frag = 0;
+            dgram_build(link, &params, hdrs[i].buf);
+            dgram_seal(
+                DGRAM_HDR(hdrs[i].buf),
+                vec[off + i].buf, vec[off + i].len
+            );
+
+            iov[i][0].iov_base = hdrs[i].buf;
+            iov[i][0].iov_len = sizeof(hdrs[i].buf);
+            iov[i][1].iov_base = vec[off + i].buf;
+            iov[i][1].iov_len = vec[off + i].len;
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &saddr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(saddr);
+            msgs[i].msg_hdr.msg_iov = iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        ret = sendmmsg(link->sockfd, msgs, n, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* The first datagram failed, skip past it */
+            vec[off].status = -errno;
+            dgram_stat(link, ONET_STAT_DROP_SEND, 1);
+            ++off;
+            continue;
+        }
+
+        for (i = 0; i < (unsigned int)ret; ++i) {
+            vec[off + i].status = vec[off + i].len;
+            dgram_stat_tx(
+                link, msgs[i].msg_len,
+                DGRAM_LEN(vec[off + i].len)
+            );
+        }
+
+        off += ret;
+        sent += ret;
+    }
+
+    return sent;
+}
+
+int
+dgram_recv_batch(struct onet_link *link, struct dgram_vec *vec,
+                 unsigned int count)
+{
+    struct dgram_batch_hdr hdrs[DGRAM_BATCH_MAX];
+    struct mmsghdr msgs[DGRAM_BATCH_MAX];
+    struct iovec iov[DGRAM_BATCH_MAX][2];
+    const struct ether_hdr *eth;
+    const struct onet_dgram *hdr;
+    unsigned int i, filled = 0;
+    size_t len;
+    int ret, flags = MSG_WAITFORONE;
+
+    if (link == NULL || vec == NULL || count == 0) {
+        return -EINVAL;
+    }
+
+    if (count > DGRAM_BATCH_MAX) {
+        count = DGRAM_BATCH_MAX;
+    }
+
+    /* The wire belongs to the port demultiplexer */
+    if (__atomic_load_n(&link->nports, __ATOMIC_ACQUIRE) > 0) {
+        return -EBUSY;
+    }
+
+    if (dgram_rx_mapped(link)) {
+        return dgram_ring_recv_batch(link, vec, count);
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /*
+     * Data is scattered straight into the caller's buffers.
+     * Entries whose frame we reject are simply left empty.
+     */
+    for (i = 0; i < count; ++i) {
+        iov[i][0].iov_base = hdrs[i].buf;
+        iov[i][0].iov_len = sizeof(hdrs[i].buf);
+        iov[i][1].iov_base = vec[i].buf;
+        iov[i][1].iov_len = vec[i].len;
+
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+        vec[i].status = -EAGAIN;
+    }
+
+    if (link->flags & ONET_F_NONBLOCK) {
+        flags |= MSG_DONTWAIT;
+    }
+
+    while (filled == 0) {
+        ret = recvmmsg(link->sockfd, msgs, count, flags, NULL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        for (i = 0; i < (unsigned int)ret; ++i) {
+            if (!dgram_accept(link, hdrs[i].buf, vec[i].buf,
+                              msgs[i].msg_len)) {
+                continue;
+            }
+
+            hdr = DGRAM_HDR(hdrs[i].buf);
+            if (DGRAM_IS_FRAG(hdr)) {
+                continue;
+            }
+
+            eth = (const void *)hdrs[i].buf;
+            len = ntohs(hdr->length);
+            vec[i].addr = mac_swap((void *)eth->source);
+            vec[i].status = (len < vec[i].len) ? len : vec[i].len;
+            ++filled;
+        }
+    }
+
+    return filled;
+}
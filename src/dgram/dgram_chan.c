@@ -0,0 +1,760 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "chan.h"
+#include "dgram_var.h"
+
+#define CHAN_MASK (ONET_CHAN_WND - 1)
+
+/* Retransmission timeout bounds (us) */
+#define CHAN_RTO_INIT   100000
+#define CHAN_RTO_MIN    2000
+#define CHAN_RTO_MAX    1000000
+
+/* Timeouts in a row before the peer is given up on */
+#define CHAN_RETRIES 12
+
+/* Segments received before an ACK goes out on its own */
+#define CHAN_ACK_EVERY 4
+
+/* Duplicate ACKs (or SACKed segments past a hole) that mean loss */
+#define CHAN_DUPTHRESH 3
+
+/* Max frames handled per wakeup */
+#define CHAN_DRAIN 64
+
+/* Segments sent between looks at what the peer has to say */
+#define CHAN_PUMP_EVERY 32
+
+/*
+ * Segment slot states
+ *
+ * @SEG_SACKED: The peer has this one (send side)
+ * @SEG_REXMIT: Retransmitted during this recovery (send side)
+ * @SEG_HAVE: The slot holds a segment (receive side)
+ */
+#define SEG_SACKED  (1 << 0)
+#define SEG_REXMIT  (1 << 1)
+#define SEG_HAVE    (1 << 2)
+
+/*
+ * State of a send window or receive buffer slot
+ *
+ * @len: Data length of the segment
+ * @state: Slot state (see SEG_*)
+ * @flags: Header flags of the segment (see CHAN_F_*)
+ */
+struct chan_seg {
+    uint16_t len;
+    uint16_t state;
+    uint16_t flags;
+};
+
+static inline uint64_t
+chan_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static inline struct onet_chan_hdr *
+chan_tx_hdr(struct onet_chan *ch, uint32_t seq)
+{
+    return (void *)(ch->tx_arena + (size_t)(seq & CHAN_MASK) * ch->seg_size);
+}
+
+static inline char *
+chan_rx_data(struct onet_chan *ch, uint32_t seq)
+{
+    return ch->rx_arena + (size_t)(seq & CHAN_MASK) * ch->mss;
+}
+
+/*
+ * Get the number of segments we can take past `rcv_nxt'
+ */
+static inline uint32_t
+chan_rx_wnd(struct onet_chan *ch)
+{
+    return ch->rx_read + ONET_CHAN_WND - ch->rcv_nxt;
+}
+
+/*
+ * Returns true if the send window has room for another
+ * segment
+ */
+static inline bool
+chan_tx_room(struct onet_chan *ch)
+{
+    return ch->snd_nxt - ch->snd_una < ONET_CHAN_WND &&
+        SEQ_LT(ch->snd_nxt, ch->snd_una + ch->snd_wnd);
+}
+
+/*
+ * Fill in the acknowledgement part of a header on its
+ * way out, this is where ACKs get piggybacked on data.
+ */
+static void
+chan_hdr_ack(struct onet_chan *ch, struct onet_chan_hdr *h, uint16_t flags)
+{
+    uint64_t sack = 0;
+    uint32_t wnd, i, tsval;
+
+    wnd = chan_rx_wnd(ch);
+    for (i = 0; i < 64 && i + 1 < wnd; ++i) {
+        if (ch->rx_segs[(ch->rcv_nxt + 1 + i) & CHAN_MASK].state & SEG_HAVE) {
+            sack |= 1ULL << i;
+        }
+    }
+
+    if (ch->rx_synced) {
+        flags |= CHAN_F_ACK;
+    }
+
+    tsval = chan_now();
+    h->ack = htonl(ch->rcv_nxt);
+    h->sack = htobe64(sack);
+    h->tsval = htonl(tsval ? tsval : 1);
+    h->tsecr = htonl(ch->ts_recent);
+    h->wnd = htons(wnd);
+    h->flags = htons(flags);
+
+    ch->rx_adv = wnd;
+    ch->ack_pending = 0;
+}
+
+static int
+chan_output(struct onet_chan *ch, uint8_t type, void *buf, uint32_t len)
+{
+    struct dgram_params params;
+
+    params.dst = ch->peer;
+    params.buf = buf;
+    params.len = len;
+    params.type = type;
+    params.port = ch->port;
+    params.frag = 0;
+    return dgram_do_send(ch->link, &params);
+}
+
+/*
+ * (Re)transmit a segment of the send window
+ */
+static void
+chan_xmit(struct onet_chan *ch, uint32_t seq)
+{
+    struct chan_seg *seg = &ch->tx_segs[seq & CHAN_MASK];
+    struct onet_chan_hdr *h = chan_tx_hdr(ch, seq);
+
+    h->seq = htonl(seq);
+    chan_hdr_ack(ch, h, seg->flags);
+    chan_output(ch, OTYPE_RDATA, h, sizeof(*h) + seg->len);
+}
+
+/*
+ * Send an ACK on its own
+ */
+static void
+chan_ack(struct onet_chan *ch, uint16_t flags)
+{
+    struct onet_chan_hdr h;
+
+    memset(&h, 0, sizeof(h));
+    h.seq = htonl(ch->snd_nxt);
+    chan_hdr_ack(ch, &h, flags);
+    chan_output(ch, OTYPE_RACK, &h, sizeof(h));
+}
+
+/*
+ * Take an RTT sample (Jacobson/Karels)
+ */
+static void
+chan_rtt(struct onet_chan *ch, uint32_t rtt)
+{
+    uint32_t delta;
+
+    if (ch->srtt == 0) {
+        ch->srtt = rtt;
+        ch->rttvar = rtt / 2;
+    } else {
+        delta = (rtt > ch->srtt) ? rtt - ch->srtt : ch->srtt - rtt;
+        ch->rttvar = (3 * ch->rttvar + delta) / 4;
+        ch->srtt = (7 * ch->srtt + rtt) / 8;
+    }
+
+    ch->rto = ch->srtt + 4 * ch->rttvar;
+    if (ch->rto < CHAN_RTO_MIN) {
+        ch->rto = CHAN_RTO_MIN;
+    }
+    if (ch->rto > CHAN_RTO_MAX) {
+        ch->rto = CHAN_RTO_MAX;
+    }
+}
+
+/*
+ * Retransmit whatever looks lost while recovering. A
+ * segment is lost once the peer has CHAN_DUPTHRESH
+ * segments past it (or it holds up the window), and is
+ * only sent again once per recovery.
+ */
+static void
+chan_repair(struct onet_chan *ch)
+{
+    struct chan_seg *seg;
+    uint32_t seq;
+
+    for (seq = ch->snd_una; SEQ_LT(seq, ch->snd_fack); ++seq) {
+        seg = &ch->tx_segs[seq & CHAN_MASK];
+        if (seg->state & (SEG_SACKED | SEG_REXMIT)) {
+            continue;
+        }
+
+        if (seq != ch->snd_una && ch->snd_fack - seq <= CHAN_DUPTHRESH) {
+            break;
+        }
+
+        seg->state |= SEG_REXMIT;
+        chan_xmit(ch, seq);
+    }
+}
+
+/*
+ * Start loss recovery, up to everything sent so far
+ */
+static void
+chan_recover(struct onet_chan *ch)
+{
+    uint32_t seq;
+
+    for (seq = ch->snd_una; SEQ_LT(seq, ch->snd_nxt); ++seq) {
+        ch->tx_segs[seq & CHAN_MASK].state &= ~SEG_REXMIT;
+    }
+
+    ch->in_recovery = true;
+    ch->recover = ch->snd_nxt;
+}
+
+/*
+ * Handle the acknowledgement part of a header from
+ * the peer
+ *
+ * @ch: Channel the header came in on
+ * @h: Header to handle
+ * @data: The header came with data
+ */
+static void
+chan_input_ack(struct onet_chan *ch, const struct onet_chan_hdr *h,
+               bool data)
+{
+    uint32_t ack, wnd, seq, tsecr, i;
+    uint64_t sack;
+
+    if (!(ntohs(h->flags) & CHAN_F_ACK)) {
+        return;
+    }
+
+    ack = ntohl(h->ack);
+    wnd = ntohs(h->wnd);
+    if (SEQ_LT(ack, ch->snd_una) || SEQ_LT(ch->snd_nxt, ack)) {
+        return;
+    }
+
+    if (ack != ch->snd_una) {
+        for (seq = ch->snd_una; seq != ack; ++seq) {
+            ch->tx_segs[seq & CHAN_MASK].state = 0;
+        }
+
+        ch->snd_una = ack;
+        ch->dupacks = 0;
+        ch->backoff = 0;
+
+        tsecr = ntohl(h->tsecr);
+        if (tsecr != 0) {
+            chan_rtt(ch, (uint32_t)chan_now() - tsecr);
+        }
+
+        if (ch->in_recovery && SEQ_LEQ(ch->recover, ack)) {
+            ch->in_recovery = false;
+        }
+
+        ch->rto_at = (ack != ch->snd_nxt) ? chan_now() + ch->rto : 0;
+    } else if (!data && ack != ch->snd_nxt && wnd == ch->snd_wnd) {
+        ++ch->dupacks;
+    }
+
+    ch->snd_wnd = wnd;
+    if (SEQ_LT(ch->snd_fack, ack)) {
+        ch->snd_fack = ack;
+    }
+
+    sack = be64toh(h->sack);
+    for (i = 0; sack != 0; ++i, sack >>= 1) {
+        seq = ack + 1 + i;
+        if (!(sack & 1) || !SEQ_LT(seq, ch->snd_nxt)) {
+            continue;
+        }
+
+        ch->tx_segs[seq & CHAN_MASK].state |= SEG_SACKED;
+        if (SEQ_LT(ch->snd_fack, seq + 1)) {
+            ch->snd_fack = seq + 1;
+        }
+    }
+
+    if (!ch->in_recovery && ack != ch->snd_nxt &&
+        (ch->dupacks >= CHAN_DUPTHRESH ||
+         ch->snd_fack - ack > CHAN_DUPTHRESH)) {
+        chan_recover(ch);
+    }
+
+    if (ch->in_recovery) {
+        chan_repair(ch);
+    }
+}
+
+/*
+ * Handle a data segment from the peer
+ */
+static void
+chan_input_data(struct onet_chan *ch, const struct onet_chan_hdr *h,
+                const char *data, uint32_t len)
+{
+    struct chan_seg *seg;
+    uint32_t seq = ntohl(h->seq);
+    uint16_t flags = ntohs(h->flags);
+
+    /* The peer (re)started, so do we */
+    if ((flags & CHAN_F_SYN) && (!ch->rx_synced || seq != ch->rx_isn)) {
+        memset(ch->rx_segs, 0, ONET_CHAN_WND * sizeof(*ch->rx_segs));
+        ch->rx_isn = seq;
+        ch->rcv_nxt = seq;
+        ch->rx_read = seq;
+        ch->rx_off = 0;
+        ch->rx_synced = true;
+    }
+
+    if (!ch->rx_synced) {
+        return;
+    }
+
+    /* Old or past the window, the peer needs an update */
+    if (SEQ_LT(seq, ch->rcv_nxt) ||
+        !SEQ_LT(seq, ch->rx_read + ONET_CHAN_WND)) {
+        chan_ack(ch, 0);
+        return;
+    }
+
+    seg = &ch->rx_segs[seq & CHAN_MASK];
+    if (seg->state & SEG_HAVE) {
+        chan_ack(ch, 0);
+        return;
+    }
+
+    memcpy(chan_rx_data(ch, seq), data, len);
+    seg->len = len;
+    seg->flags = flags;
+    seg->state = SEG_HAVE;
+
+    /* Out of order, tell the peer about the hole right away */
+    if (seq != ch->rcv_nxt) {
+        chan_ack(ch, 0);
+        return;
+    }
+
+    ch->ts_recent = ntohl(h->tsval);
+    do {
+        ++ch->rcv_nxt;
+    } while (chan_rx_wnd(ch) > 0 &&
+             (ch->rx_segs[ch->rcv_nxt & CHAN_MASK].state & SEG_HAVE));
+
+    /* Filled a hole, let the peer move on */
+    if (ch->rcv_nxt - seq > 1 || ++ch->ack_pending >= CHAN_ACK_EVERY) {
+        chan_ack(ch, 0);
+    }
+}
+
+/*
+ * Handle a frame from the channel port
+ */
+static void
+chan_input(struct onet_chan *ch, const struct dgram_slot *slot)
+{
+    const struct ether_hdr *eth = (const void *)slot->p;
+    const struct onet_dgram *hdr = DGRAM_HDR(slot->p);
+    const struct onet_chan_hdr *h = (const void *)DGRAM_DATA(slot->p);
+    uint32_t len;
+
+    if (slot->len < DGRAM_LEN(sizeof(*h))) {
+        return;
+    }
+
+    if (mac_swap((void *)eth->source) != ch->peer) {
+        return;
+    }
+
+    len = slot->len - DGRAM_LEN(sizeof(*h));
+    switch (hdr->type) {
+    case OTYPE_RDATA:
+        if (len > ch->mss) {
+            break;
+        }
+
+        chan_input_ack(ch, h, true);
+        chan_input_data(ch, h, (const char *)(h + 1), len);
+        break;
+    case OTYPE_RACK:
+        chan_input_ack(ch, h, false);
+        if (ntohs(h->flags) & CHAN_F_PROBE) {
+            chan_ack(ch, 0);
+        }
+        break;
+    }
+}
+
+/*
+ * Run the retransmission timer
+ */
+static void
+chan_timer(struct onet_chan *ch, uint64_t now)
+{
+    uint32_t seq;
+
+    if (ch->rto_at == 0 || now < ch->rto_at) {
+        return;
+    }
+
+    if (++ch->backoff > CHAN_RETRIES) {
+        ch->error = -ETIMEDOUT;
+        ch->rto_at = 0;
+        return;
+    }
+
+    ch->rto *= 2;
+    if (ch->rto > CHAN_RTO_MAX) {
+        ch->rto = CHAN_RTO_MAX;
+    }
+    ch->rto_at = now + ch->rto;
+
+    /* Nothing in flight, the window is shut. Poke the peer */
+    if (ch->snd_una == ch->snd_nxt) {
+        chan_ack(ch, CHAN_F_PROBE);
+        return;
+    }
+
+    /* Everything the peer does not have is lost */
+    chan_recover(ch);
+    ch->dupacks = 0;
+    for (seq = ch->snd_una; SEQ_LT(seq, ch->snd_nxt); ++seq) {
+        if (!(ch->tx_segs[seq & CHAN_MASK].state & SEG_SACKED)) {
+            ch->tx_segs[seq & CHAN_MASK].state |= SEG_REXMIT;
+            chan_xmit(ch, seq);
+        }
+    }
+}
+
+/*
+ * Wait for frames from the peer and handle them, as well
+ * as any timer that runs out meanwhile.
+ *
+ * @ch: Channel to drive
+ * @timeout: Max time to wait in ms (-1 to wait forever)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+static int
+chan_pump(struct onet_chan *ch, int timeout)
+{
+    struct dgram_slot slot;
+    uint64_t now;
+    int error, n, wait = timeout;
+
+    /* Do not sleep through the retransmission timer */
+    if (ch->rto_at != 0) {
+        now = chan_now();
+        n = (ch->rto_at > now) ? (ch->rto_at - now + 999) / 1000 : 0;
+        if (wait < 0 || n < wait) {
+            wait = n;
+        }
+    }
+
+    /* About to sleep, do not keep the peer waiting on us */
+    if (wait != 0 && ch->ack_pending > 0) {
+        chan_ack(ch, 0);
+    }
+
+    error = dgram_port_wait(ch->link, ch->rxq, &slot, wait);
+    for (n = 0; error == 0; ) {
+        chan_input(ch, &slot);
+        dgram_frame_put(ch->link, slot.p);
+        if (++n == CHAN_DRAIN) {
+            break;
+        }
+
+        error = dgram_port_wait(ch->link, ch->rxq, &slot, 0);
+    }
+
+    if (error < 0 && error != -EAGAIN) {
+        return error;
+    }
+
+    chan_timer(ch, chan_now());
+    return ch->error;
+}
+
+int
+onet_chan_open(struct onet_link *link, mac_addr_t peer, uint8_t port,
+               struct onet_chan *res)
+{
+    int error;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->link = link;
+    res->peer = peer;
+    res->port = port;
+    res->mss = link->mtu - sizeof(struct onet_dgram) -
+        sizeof(struct onet_chan_hdr);
+    res->seg_size = sizeof(struct onet_chan_hdr) + res->mss;
+
+    res->tx_arena = malloc((size_t)ONET_CHAN_WND * res->seg_size);
+    res->rx_arena = malloc((size_t)ONET_CHAN_WND * res->mss);
+    res->tx_segs = calloc(ONET_CHAN_WND, sizeof(*res->tx_segs));
+    res->rx_segs = calloc(ONET_CHAN_WND, sizeof(*res->rx_segs));
+    if (res->tx_arena == NULL || res->rx_arena == NULL ||
+        res->tx_segs == NULL || res->rx_segs == NULL) {
+        error = -ENOMEM;
+        goto fail;
+    }
+
+    /* Room for a whole window from the peer, and then some */
+    if ((error = dgram_bind(link, port, 2 * ONET_CHAN_WND)) < 0) {
+        goto fail;
+    }
+
+    res->rxq = link->ports[port];
+    res->isn = (uint32_t)chan_now() ^ ((uint32_t)getpid() << 16);
+    res->snd_una = res->isn;
+    res->snd_nxt = res->isn;
+    res->snd_fack = res->isn;
+    res->snd_wnd = ONET_CHAN_WND;
+    res->rto = CHAN_RTO_INIT;
+    return 0;
+fail:
+    free(res->tx_arena);
+    free(res->rx_arena);
+    free(res->tx_segs);
+    free(res->rx_segs);
+    memset(res, 0, sizeof(*res));
+    return error;
+}
+
+void
+onet_chan_close(struct onet_chan *ch)
+{
+    if (ch == NULL || ch->link == NULL) {
+        return;
+    }
+
+    dgram_unbind(ch->link, ch->port);
+    free(ch->tx_arena);
+    free(ch->rx_arena);
+    free(ch->tx_segs);
+    free(ch->rx_segs);
+    memset(ch, 0, sizeof(*ch));
+}
+
+tx_len_t
+onet_chan_send(struct onet_chan *ch, const void *buf, uint32_t len)
+{
+    struct chan_seg *seg;
+    uint32_t off = 0, n, seq;
+    int error;
+
+    if (ch == NULL || (buf == NULL && len > 0)) {
+        return -EINVAL;
+    }
+
+    if (len > INT32_MAX) {
+        return -EMSGSIZE;
+    }
+
+    do {
+        if (ch->error < 0) {
+            return ch->error;
+        }
+
+        while (!chan_tx_room(ch)) {
+            /* The window is shut, probe it until it opens */
+            if (ch->snd_una == ch->snd_nxt && ch->rto_at == 0) {
+                ch->rto_at = chan_now() + ch->rto;
+            }
+
+            if ((error = chan_pump(ch, -1)) < 0) {
+                return error;
+            }
+        }
+
+        n = len - off;
+        if (n > ch->mss) {
+            n = ch->mss;
+        }
+
+        seq = ch->snd_nxt++;
+        seg = &ch->tx_segs[seq & CHAN_MASK];
+        seg->len = n;
+        seg->state = 0;
+        seg->flags = 0;
+        if (seq == ch->isn) {
+            seg->flags |= CHAN_F_SYN;
+        }
+        if (off + n == len) {
+            seg->flags |= CHAN_F_END;
+        }
+
+        memcpy(chan_tx_hdr(ch, seq) + 1, (const char *)buf + off, n);
+        chan_xmit(ch, seq);
+        off += n;
+
+        if (ch->rto_at == 0 || ch->snd_una + 1 == ch->snd_nxt) {
+            ch->rto_at = chan_now() + ch->rto;
+        }
+
+        /* See what the peer has to say now and then */
+        if ((seq & (CHAN_PUMP_EVERY - 1)) == 0 &&
+            (error = chan_pump(ch, 0)) < 0) {
+            return error;
+        }
+    } while (off < len);
+
+    return len;
+}
+
+rx_len_t
+onet_chan_recv(struct onet_chan *ch, void *buf, uint32_t len, int timeout)
+{
+    struct chan_seg *seg;
+    int64_t deadline;
+    uint32_t copied = 0, n;
+    bool end;
+    int error, left;
+
+    if (ch == NULL || (buf == NULL && len > 0)) {
+        return -EINVAL;
+    }
+
+    deadline = dgram_deadline(timeout);
+    for (;;) {
+        end = false;
+        while (SEQ_LT(ch->rx_read, ch->rcv_nxt) && !end && copied < len) {
+            seg = &ch->rx_segs[ch->rx_read & CHAN_MASK];
+            n = seg->len - ch->rx_off;
+            if (n > len - copied) {
+                n = len - copied;
+            }
+
+            memcpy(
+                (char *)buf + copied,
+                chan_rx_data(ch, ch->rx_read) + ch->rx_off, n
+            );
+            copied += n;
+            ch->rx_off += n;
+            if (ch->rx_off < seg->len) {
+                break;
+            }
+
+            end = (seg->flags & CHAN_F_END) != 0;
+            seg->state = 0;
+            ch->rx_off = 0;
+            ++ch->rx_read;
+        }
+
+        /* Reading opened the window up a good deal, say so */
+        if (chan_rx_wnd(ch) >= ch->rx_adv + ONET_CHAN_WND / 4) {
+            chan_ack(ch, 0);
+        }
+
+        if (end || copied == len) {
+            /* Nothing else is on its way, do not sit on the ACK */
+            if (ch->ack_pending > 0 &&
+                __atomic_load_n(&ch->rxq->tail, __ATOMIC_ACQUIRE) ==
+                ch->rxq->head) {
+                chan_ack(ch, 0);
+            }
+
+            return copied;
+        }
+
+        if (ch->error < 0) {
+            return ch->error;
+        }
+
+        if ((left = dgram_remaining(deadline)) == 0) {
+            return (copied > 0) ? (rx_len_t)copied : -EAGAIN;
+        }
+
+        if ((error = chan_pump(ch, left)) < 0) {
+            return error;
+        }
+    }
+}
+
+int
+onet_chan_flush(struct onet_chan *ch, int timeout)
+{
+    int64_t deadline;
+    int error, left;
+
+    if (ch == NULL) {
+        return -EINVAL;
+    }
+
+    deadline = dgram_deadline(timeout);
+    while (ch->snd_una != ch->snd_nxt) {
+        if ((left = dgram_remaining(deadline)) == 0) {
+            return -EAGAIN;
+        }
+
+        if ((error = chan_pump(ch, left)) < 0) {
+            return error;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "crc.h"
+#include "dgram_var.h"
+
+/* Header bytes covered by the header CRC */
+#define CONN_CRC_LEN (sizeof(struct onet_dgram) - sizeof(uint32_t))
+
+/*
+ * The CRC32 is linear over messages of the same length,
+ * so setting the length bytes of a header only XORs its
+ * CRC with what those bytes alone contribute. The tables
+ * hold that for each value of the high and low byte.
+ */
+static uint32_t conn_len_crc[2][256];
+static pthread_once_t conn_once = PTHREAD_ONCE_INIT;
+
+static void
+conn_init(void)
+{
+    uint8_t msg[CONN_CRC_LEN];
+    uint32_t zero;
+    int i, v;
+
+    memset(msg, 0, sizeof(msg));
+    zero = crc32(msg, sizeof(msg));
+    for (i = 0; i < 2; ++i) {
+        for (v = 0; v < 256; ++v) {
+            msg[i] = v;
+            conn_len_crc[i][v] = crc32(msg, sizeof(msg)) ^ zero;
+        }
+        msg[i] = 0;
+    }
+}
+
+/*
+ * Copy the headers of a connected destination in place
+ * and set them up for `len' bytes of data
+ */
+static inline void
+conn_stamp(const struct dgram_conn *conn, char *p, uint16_t len)
+{
+    struct onet_dgram *hdr = DGRAM_HDR(p);
+
+    memcpy(p, conn->hdr, sizeof(conn->hdr));
+    hdr->length = htons(len);
+    hdr->crc32 = conn->crc ^ conn_len_crc[0][len >> 8] ^
+        conn_len_crc[1][len & 0xFF];
+}
+
+int
+dgram_connect(struct onet_link *link, mac_addr_t dst, uint8_t port,
+              struct dgram_conn *res)
+{
+    struct dgram_params params;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_once(&conn_once, conn_init);
+    memset(res, 0, sizeof(*res));
+    res->link = link;
+    res->dst = dst;
+    res->port = port;
+
+    params.dst = dst;
+    params.buf = NULL;
+    params.len = 0;
+    params.type = OTYPE_DATA;
+    params.port = port;
+    params.frag = 0;
+    dgram_build(link, &params, res->hdr);
+    res->crc = ((struct onet_dgram *)DGRAM_HDR(res->hdr))->crc32;
+    return 0;
+}
+
+tx_len_t
+dgram_conn_send(struct dgram_conn *conn, const void *buf, uint32_t len)
+{
+    struct onet_link *link;
+    struct onet_shm_peer *peer;
+    struct dgram_params params;
+    ssize_t ret;
+    char *p;
+
+    if (conn == NULL || buf == NULL) {
+        return -EINVAL;
+    }
+
+    /* Fragments and AF_XDP sends take the long way */
+    link = conn->link;
+    if (link->xsk != NULL || len > link->mtu - sizeof(struct onet_dgram)) {
+        params.dst = conn->dst;
+        params.buf = (void *)buf;
+        params.len = len;
+        params.type = OTYPE_DATA;
+        params.port = conn->port;
+        params.frag = 0;
+        return dgram_do_send(link, &params);
+    }
+
+    if ((peer = onet_shm_peer(link, conn->dst)) != NULL) {
+        if ((p = onet_shm_slot(peer, conn->dst, DGRAM_LEN(len))) != NULL) {
+            conn_stamp(conn, p, len);
+            dgram_fill(p, buf, len);
+            onet_shm_push(peer);
+            dgram_stat_tx(link, DGRAM_LEN(len), DGRAM_LEN(len));
+            return len;
+        }
+        if (errno != ENOTCONN) {
+            return -errno;
+        }
+    }
+
+    if (link->tx_ring.base != NULL) {
+        pthread_mutex_lock(&link->tx_lock);
+        if ((p = dgram_tx_frame(link, DGRAM_LEN(len))) == NULL) {
+            ret = -errno;
+            pthread_mutex_unlock(&link->tx_lock);
+            dgram_stat_tx(link, ret, DGRAM_LEN(len));
+            return ret;
+        }
+
+        conn_stamp(conn, p, len);
+        dgram_fill(p, buf, len);
+        dgram_tx_push(link);
+        pthread_mutex_unlock(&link->tx_lock);
+        dgram_tx_kick(link, MSG_DONTWAIT);
+        return len;
+    }
+
+    if ((p = dgram_frame_get(link, DGRAM_LEN(len))) == NULL) {
+        return -ENOMEM;
+    }
+
+    conn_stamp(conn, p, len);
+    dgram_fill(p, buf, len);
+    ret = link->tp->send(link, p, DGRAM_LEN(len));
+    dgram_stat_tx(link, ret, DGRAM_LEN(len));
+
+    dgram_frame_put(link, p);
+    return (ret < 0) ? ret : len;
+}
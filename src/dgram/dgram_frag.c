@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "dgram_var.h"
+
+/* Datagrams being put back together per link, a power of two */
+#define REASM_SLOTS 64
+
+/* Slots looked at for a given datagram */
+#define REASM_PROBE 8
+
+/* Max number of bytes held in incomplete datagrams per link */
+#define REASM_BUDGET (4 << 20)
+
+/* Time (in ms) a datagram has to be completed */
+#define REASM_TIMEOUT 1000
+
+/* Room for the headers in front of the data */
+#define REASM_HDR DGRAM_LEN(0)
+
+/*
+ * Represents a datagram being put back together. Every
+ * fragment but the last is the same size, so each one
+ * goes straight to `index * fsize' within the buffer.
+ *
+ * @src: Sender address
+ * @id: Fragment ID
+ * @used: Slot is in use
+ * @expire: Time the datagram is dropped if still incomplete
+ * @buf: Headers followed by the data
+ * @cap: Bytes of data `buf' has room for
+ * @fsize: Size of every fragment but the last (0 until known)
+ * @nfrags: Number of fragments (0 until the last one is seen)
+ * @count: Number of fragments received
+ * @last_len: Length of the last fragment
+ * @stash: Last fragment, if it came in before `fsize' was known
+ * @stash_len: Length of `stash'
+ * @seen: Fragments received (by index)
+ */
+struct reasm_ctx {
+    mac_addr_t src;
+    uint16_t id;
+    bool used;
+    int64_t expire;
+    char *buf;
+    size_t cap;
+    uint32_t fsize;
+    uint32_t nfrags;
+    uint32_t count;
+    uint32_t last_len;
+    char *stash;
+    uint32_t stash_len;
+    uint64_t seen[DGRAM_FRAG_MAX / 64];
+};
+
+/*
+ * Represents the reassembly state of a link
+ *
+ * @held: Bytes held by every slot
+ * @ctx: Reassembly slots
+ */
+struct onet_reasm {
+    size_t held;
+    struct reasm_ctx ctx[REASM_SLOTS];
+};
+
+static inline int64_t
+reasm_now(void)
+{
+    return dgram_deadline(0);
+}
+
+/*
+ * Drop whatever a slot holds and free it up
+ */
+static void
+reasm_drop(struct onet_reasm *ra, struct reasm_ctx *ctx)
+{
+    ra->held -= ctx->cap + ctx->stash_len;
+    free(ctx->buf);
+    free(ctx->stash);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/*
+ * Make room for `need' more bytes, dropping expired
+ * datagrams first and then the oldest ones (other
+ * than `keep').
+ *
+ * Returns true if there is room.
+ */
+static bool
+reasm_reserve(struct onet_reasm *ra, struct reasm_ctx *keep, size_t need)
+{
+    struct reasm_ctx *ctx, *oldest;
+    int64_t now = reasm_now();
+    size_t i;
+
+    for (i = 0; i < REASM_SLOTS; ++i) {
+        ctx = &ra->ctx[i];
+        if (ctx->used && ctx != keep && ctx->expire <= now) {
+            reasm_drop(ra, ctx);
+        }
+    }
+
+    while (ra->held + need > REASM_BUDGET) {
+        oldest = NULL;
+        for (i = 0; i < REASM_SLOTS; ++i) {
+            ctx = &ra->ctx[i];
+            if (!ctx->used || ctx == keep) {
+                continue;
+            }
+            if (oldest == NULL || ctx->expire < oldest->expire) {
+                oldest = ctx;
+            }
+        }
+
+        if (oldest == NULL) {
+            return false;
+        }
+
+        reasm_drop(ra, oldest);
+    }
+
+    return true;
+}
+
+/*
+ * Find the slot of a datagram, taking a free (or
+ * expired, or else the oldest) one if it has none.
+ */
+static struct reasm_ctx *
+reasm_lookup(struct onet_reasm *ra, mac_addr_t src, uint16_t id)
+{
+    struct reasm_ctx *ctx, *victim = NULL;
+    int64_t now = reasm_now();
+    uint32_t h, i;
+
+    h = (src ^ (src >> 24) ^ ((uint32_t)id * 0x9E3779B1U)) >> 4;
+    for (i = 0; i < REASM_PROBE; ++i) {
+        ctx = &ra->ctx[(h + i) & (REASM_SLOTS - 1)];
+        if (ctx->used && ctx->src == src && ctx->id == id) {
+            return ctx;
+        }
+
+        if (ctx->used && ctx->expire <= now) {
+            reasm_drop(ra, ctx);
+        }
+
+        if (!ctx->used) {
+            if (victim == NULL || victim->used) {
+                victim = ctx;
+            }
+        } else if (victim == NULL ||
+                   (victim->used && ctx->expire < victim->expire)) {
+            victim = ctx;
+        }
+    }
+
+    if (victim->used) {
+        reasm_drop(ra, victim);
+    }
+
+    victim->used = true;
+    victim->src = src;
+    victim->id = id;
+    victim->expire = now + REASM_TIMEOUT;
+    return victim;
+}
+
+/*
+ * Make sure a slot has room for `len' bytes of data
+ */
+static bool
+reasm_grow(struct onet_reasm *ra, struct reasm_ctx *ctx, size_t len)
+{
+    size_t cap = ctx->cap;
+    char *buf;
+
+    if (len <= cap) {
+        return true;
+    }
+
+    if (cap == 0) {
+        cap = len;
+    }
+    while (cap < len) {
+        cap *= 2;
+    }
+    if (cap > DGRAM_MSG_MAX) {
+        cap = DGRAM_MSG_MAX;
+    }
+
+    if (!reasm_reserve(ra, ctx, cap - ctx->cap)) {
+        return false;
+    }
+
+    if ((buf = realloc(ctx->buf, REASM_HDR + cap)) == NULL) {
+        return false;
+    }
+
+    ra->held += cap - ctx->cap;
+    ctx->buf = buf;
+    ctx->cap = cap;
+    return true;
+}
+
+/*
+ * Copy a fragment in place, `fsize' must be known
+ */
+static bool
+reasm_place(struct onet_reasm *ra, struct reasm_ctx *ctx, uint32_t idx,
+            const char *data, uint32_t len)
+{
+    size_t off = (size_t)idx * ctx->fsize;
+
+    if (off + len > DGRAM_MSG_MAX) {
+        return false;
+    }
+
+    if (!reasm_grow(ra, ctx, off + len)) {
+        return false;
+    }
+
+    memcpy(ctx->buf + REASM_HDR + off, data, len);
+    return true;
+}
+
+char *
+dgram_reasm(struct onet_link *link, const char *p, const char *data,
+            size_t len, size_t *res_len)
+{
+    const struct ether_hdr *eth = (const void *)p;
+    const struct onet_dgram *hdr = DGRAM_HDR(p);
+    struct onet_reasm *ra = link->reasm;
+    struct onet_dgram *res_hdr;
+    struct reasm_ctx *ctx;
+    uint32_t idx, data_len;
+    mac_addr_t src;
+    size_t total;
+    bool last;
+    char *res;
+
+    if (ra == NULL) {
+        return NULL;
+    }
+
+    idx = DGRAM_FRAG_IDX(hdr->flags);
+    last = (hdr->flags & DGRAM_F_MF) == 0;
+    data_len = len - DGRAM_LEN(0);
+    src = mac_swap((void *)eth->source);
+    ctx = reasm_lookup(ra, src, ntohs(hdr->frag_id));
+
+    /* Already got this one */
+    if (ctx->seen[idx / 64] & (1ULL << (idx % 64))) {
+        return NULL;
+    }
+
+    /*
+     * A second last fragment, one past the last, or one in the
+     * middle that is not the same size as the others. Either way
+     * this datagram is not going to make sense.
+     */
+    if ((last && ctx->nfrags != 0) ||
+        (ctx->nfrags != 0 && idx >= ctx->nfrags) ||
+        (!last && ctx->fsize != 0 && data_len != ctx->fsize) ||
+        (!last && data_len == 0)) {
+        reasm_drop(ra, ctx);
+        return NULL;
+    }
+
+    if (!last && ctx->fsize == 0) {
+        ctx->fsize = data_len;
+
+        /* The last fragment came first, it can be placed now */
+        if (ctx->stash != NULL) {
+            if (!reasm_place(ra, ctx, ctx->nfrags - 1, ctx->stash,
+                             ctx->stash_len)) {
+                reasm_drop(ra, ctx);
+                return NULL;
+            }
+
+            ra->held -= ctx->stash_len;
+            free(ctx->stash);
+            ctx->stash = NULL;
+            ctx->stash_len = 0;
+        }
+    }
+
+    if (ctx->fsize != 0) {
+        if (!reasm_place(ra, ctx, idx, data, data_len)) {
+            reasm_drop(ra, ctx);
+            return NULL;
+        }
+    } else {
+        /* Only the last fragment can get here, hold on to it */
+        if (!reasm_reserve(ra, ctx, data_len) ||
+            (ctx->stash = malloc(data_len + 1)) == NULL) {
+            reasm_drop(ra, ctx);
+            return NULL;
+        }
+
+        memcpy(ctx->stash, data, data_len);
+        ctx->stash_len = data_len;
+        ra->held += data_len;
+    }
+
+    if (last) {
+        ctx->nfrags = idx + 1;
+        ctx->last_len = data_len;
+    }
+
+    ctx->seen[idx / 64] |= 1ULL << (idx % 64);
+    if (++ctx->count != ctx->nfrags) {
+        return NULL;
+    }
+
+    /* All here, the slot hands its buffer over to the caller */
+    total = (size_t)(ctx->nfrags - 1) * ctx->fsize + ctx->last_len;
+    res = ctx->buf;
+    memcpy(res, p, REASM_HDR);
+    res_hdr = DGRAM_HDR(res);
+    res_hdr->flags &= (1 << DGRAM_FRAG_SHIFT) - 1;
+    res_hdr->flags &= ~DGRAM_F_MF;
+    res_hdr->length = htons((total > UINT16_MAX) ? UINT16_MAX : total);
+    *res_len = DGRAM_LEN(total);
+
+    ctx->buf = NULL;
+    reasm_drop(ra, ctx);
+    return res;
+}
+
+int
+onet_reasm_init(struct onet_link *link)
+{
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    if ((link->reasm = calloc(1, sizeof(*link->reasm))) == NULL) {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+void
+onet_reasm_free(struct onet_link *link)
+{
+    struct onet_reasm *ra;
+    size_t i;
+
+    if (link == NULL || (ra = link->reasm) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < REASM_SLOTS; ++i) {
+        if (ra->ctx[i].used) {
+            reasm_drop(ra, &ra->ctx[i]);
+        }
+    }
+
+    free(ra);
+    link->reasm = NULL;
+}
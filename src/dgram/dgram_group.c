@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "group.h"
+#include "dgram_var.h"
+
+/*
+ * State of a group worker, owned by the worker
+ *
+ * @grp: Group the worker belongs to
+ * @link: Link the worker reads
+ * @frame: Frame to receive into (without an RX ring)
+ * @cpu: CPU to pin the worker to (-1 for none)
+ */
+struct group_worker {
+    struct onet_group *grp;
+    struct onet_link *link;
+    char *frame;
+    int cpu;
+};
+
+/*
+ * Kernel hashing only looks into IP and friends, so
+ * ONET frames would all hash the same. Pick the link
+ * by the low 32 bits of the sender address instead,
+ * the kernel takes it modulo the group size.
+ */
+static struct sock_filter group_hash_prog[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_LL_OFF + 8),
+    BPF_STMT(BPF_RET | BPF_A, 0)
+};
+
+/*
+ * Join a link to a fanout group
+ *
+ * @link: Link to join
+ * @id: Fanout group ID
+ * @mode: ONET_FANOUT_* mode
+ */
+static int
+group_join(struct onet_link *link, uint16_t id, int mode)
+{
+    struct sock_fprog fprog;
+    int arg;
+
+    switch (mode) {
+    case ONET_FANOUT_HASH:
+        arg = PACKET_FANOUT_CBPF;
+        break;
+    case ONET_FANOUT_CPU:
+        arg = PACKET_FANOUT_CPU;
+        break;
+    case ONET_FANOUT_LB:
+        arg = PACKET_FANOUT_LB;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    arg = id | (arg << 16);
+    if (setsockopt(link->sockfd, SOL_PACKET, PACKET_FANOUT,
+                   &arg, sizeof(arg)) < 0) {
+        return -errno;
+    }
+
+    if (mode != ONET_FANOUT_HASH) {
+        return 0;
+    }
+
+    fprog.len = sizeof(group_hash_prog) / sizeof(group_hash_prog[0]);
+    fprog.filter = group_hash_prog;
+    if (setsockopt(link->sockfd, SOL_PACKET, PACKET_FANOUT_DATA,
+                   &fprog, sizeof(fprog)) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the n-th CPU (wrapping around) we may run on
+ */
+static int
+group_cpu(uint32_t n)
+{
+    cpu_set_t set;
+    uint32_t count;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        return -1;
+    }
+
+    count = CPU_COUNT(&set);
+    if (count == 0) {
+        return -1;
+    }
+
+    n %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set) && n-- == 0) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+static void
+group_worker_free(void *arg)
+{
+    struct group_worker *wp = arg;
+
+    if (wp->frame != NULL) {
+        dgram_frame_put(wp->link, wp->frame);
+    }
+
+    free(wp);
+}
+
+static void *
+group_worker(void *arg)
+{
+    struct group_worker *wp = arg;
+    struct onet_link *link = wp->link;
+    struct onet_group *grp = wp->grp;
+    cpu_set_t set;
+    size_t frame_len, len;
+    ssize_t recv_len;
+    char *p, *whole;
+
+    if (wp->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(wp->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    /*
+     * onet_group_close() may only stop us while we wait for
+     * a frame. Anywhere else we may hold a lock of the link,
+     * squeaks are answered on the way in and the TX path
+     * can block with tx_lock held.
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    frame_len = sizeof(struct ether_hdr) + link->mtu;
+    wp->frame = dgram_frame_get(link, frame_len);
+    pthread_cleanup_push(group_worker_free, wp);
+    for (;;) {
+        /* Take frames straight out of the RX ring if we have one */
+        if (dgram_rx_mapped(link)) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            p = dgram_rx_next(link, &len, -1);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            if (p == NULL) {
+                continue;
+            }
+        } else {
+            if (wp->frame == NULL) {
+                break;
+            }
+
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            recv_len = recv(link->sockfd, wp->frame, frame_len, 0);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            if (recv_len < 0) {
+                continue;
+            }
+
+            p = wp->frame;
+            len = recv_len;
+        }
+
+        if (!dgram_accept(link, p, DGRAM_DATA(p), len)) {
+            continue;
+        }
+
+        len = dgram_frame_len(p);
+
+        /* Hand fragments over once they make a whole datagram */
+        whole = NULL;
+        if (DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+            whole = dgram_reasm(link, p, DGRAM_DATA(p), len, &len);
+            if ((p = whole) == NULL) {
+                continue;
+            }
+        }
+
+        grp->fn(link, DGRAM_DATA(p), len - DGRAM_LEN(0), grp->arg);
+        if (whole != NULL) {
+            dgram_frame_put(link, whole);
+        }
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+int
+onet_group_open(const char *iface, uint32_t nlinks, int mode,
+                struct onet_group *res)
+{
+    static uint32_t serial;
+    uint16_t id;
+    uint32_t i;
+    int error;
+
+    if (iface == NULL || res == NULL || nlinks == 0) {
+        return -EINVAL;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->links = calloc(nlinks, sizeof(*res->links));
+    if (res->links == NULL) {
+        return -ENOMEM;
+    }
+
+    /* Fanout IDs are per namespace, try not to join someone else */
+    id = (getpid() << 4) ^ __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < nlinks; ++i) {
+        if ((error = onet_open(iface, &res->links[i])) < 0) {
+            break;
+        }
+
+        res->nlinks = i + 1;
+        if ((error = group_join(&res->links[i], id, mode)) < 0) {
+            break;
+        }
+    }
+
+    if (error < 0) {
+        onet_group_close(res);
+        return error;
+    }
+
+    return 0;
+}
+
+int
+onet_group_start(struct onet_group *grp, onet_group_fn fn, void *arg)
+{
+    struct group_worker *wp;
+    uint32_t i;
+    int error;
+
+    if (grp == NULL || fn == NULL || grp->workers != NULL) {
+        return -EINVAL;
+    }
+
+    grp->workers = calloc(grp->nlinks, sizeof(*grp->workers));
+    if (grp->workers == NULL) {
+        return -ENOMEM;
+    }
+
+    grp->fn = fn;
+    grp->arg = arg;
+    for (i = 0; i < grp->nlinks; ++i) {
+        wp = malloc(sizeof(*wp));
+        if (wp == NULL) {
+            onet_group_close(grp);
+            return -ENOMEM;
+        }
+
+        wp->grp = grp;
+        wp->link = &grp->links[i];
+        wp->frame = NULL;
+        wp->cpu = group_cpu(i);
+        error = pthread_create(&grp->workers[i], NULL, group_worker, wp);
+        if (error != 0) {
+            free(wp);
+            onet_group_close(grp);
+            return -error;
+        }
+
+        grp->nworkers = i + 1;
+    }
+
+    return 0;
+}
+
+int
+onet_group_close(struct onet_group *grp)
+{
+    uint32_t i;
+
+    if (grp == NULL) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < grp->nworkers; ++i) {
+        pthread_cancel(grp->workers[i]);
+    }
+
+    for (i = 0; i < grp->nworkers; ++i) {
+        pthread_join(grp->workers[i], NULL);
+    }
+
+    for (i = 0; i < grp->nlinks; ++i) {
+        onet_close(&grp->links[i]);
+    }
+
+    free(grp->workers);
+    free(grp->links);
+    memset(grp, 0, sizeof(*grp));
+    return 0;
+}
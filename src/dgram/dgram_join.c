@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "link.h"
+
+static inline void
+group_lock(struct onet_link *link)
+{
+    while (__atomic_test_and_set(&link->group_lock, __ATOMIC_ACQUIRE)) {
+        continue;
+    }
+}
+
+static inline void
+group_unlock(struct onet_link *link)
+{
+    __atomic_clear(&link->group_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add or drop the NIC membership of a group
+ *
+ * @link: Link the group is on
+ * @group: Multicast address of the group
+ * @add: Add the membership rather than drop it
+ */
+static int
+group_membership(struct onet_link *link, mac_addr_t group, bool add)
+{
+    struct packet_mreq mreq;
+    int i;
+
+    /* Only packet sockets filter on the NIC */
+    if (!ONET_LINK_PACKET(link)) {
+        return 0;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = link->iface_idx;
+    mreq.mr_type = PACKET_MR_MULTICAST;
+    mreq.mr_alen = HW_ADDR_LEN;
+    for (i = 0; i < HW_ADDR_LEN; ++i) {
+        mreq.mr_address[i] = group >> (8 * (HW_ADDR_LEN - 1 - i));
+    }
+
+    if (setsockopt(link->sockfd, SOL_PACKET,
+                   add ? PACKET_ADD_MEMBERSHIP : PACKET_DROP_MEMBERSHIP,
+                   &mreq, sizeof(mreq)) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the index of a joined group, -1 if it is not
+ */
+static int
+group_find(struct onet_link *link, mac_addr_t group)
+{
+    uint32_t i;
+
+    for (i = 0; i < link->ngroups; ++i) {
+        if (link->groups[i] == group) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int
+dgram_join(struct onet_link *link, mac_addr_t group)
+{
+    uint32_t n;
+    int idx, error;
+
+    if (link == NULL || !MAC_IS_MULTICAST(group) ||
+        group == MAC_BROADCAST) {
+        return -EINVAL;
+    }
+
+    group_lock(link);
+    if ((idx = group_find(link, group)) >= 0) {
+        ++link->group_refs[idx];
+        group_unlock(link);
+        return 0;
+    }
+
+    if ((n = link->ngroups) == ONET_GROUP_MAX) {
+        group_unlock(link);
+        return -ENOSPC;
+    }
+
+    if ((error = group_membership(link, group, true)) < 0) {
+        group_unlock(link);
+        return error;
+    }
+
+    link->groups[n] = group;
+    link->group_refs[n] = 1;
+    __atomic_store_n(&link->ngroups, n + 1, __ATOMIC_RELEASE);
+
+    /* Let the group through the filter as well */
+    if ((error = onet_filter_attach(link)) < 0) {
+        __atomic_store_n(&link->ngroups, n, __ATOMIC_RELEASE);
+        group_membership(link, group, false);
+    }
+
+    group_unlock(link);
+    return error;
+}
+
+int
+dgram_leave(struct onet_link *link, mac_addr_t group)
+{
+    uint32_t n;
+    int idx;
+
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    group_lock(link);
+    if ((idx = group_find(link, group)) < 0) {
+        group_unlock(link);
+        return -ENOENT;
+    }
+
+    if (--link->group_refs[idx] > 0) {
+        group_unlock(link);
+        return 0;
+    }
+
+    /* The last group takes its place */
+    n = link->ngroups - 1;
+    link->groups[idx] = link->groups[n];
+    link->group_refs[idx] = link->group_refs[n];
+    __atomic_store_n(&link->ngroups, n, __ATOMIC_RELEASE);
+
+    group_membership(link, group, false);
+    onet_filter_attach(link);
+    group_unlock(link);
+    return 0;
+}
+
+bool
+dgram_joined(struct onet_link *link, mac_addr_t group)
+{
+    uint32_t i, n;
+
+    n = __atomic_load_n(&link->ngroups, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; ++i) {
+        if (__atomic_load_n(&link->groups[i], __ATOMIC_RELAXED) == group) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -29,81 +29,149 @@
 
 #include <sys/errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include "if_ether.h"
 #include "dgram.h"
 #include "crc.h"
+#include "dgram_var.h"
 
 /*
- * Represents datagram parameters to use for
- * dgram_do_send()
- *
- * @dst: Destination MAC address
- * @buf: Buffer to use
- * @len: Length to transmit
- * @type: Packet type to use
- */
-struct dgram_params {
-    mac_addr_t dst;
-    void *buf;
-    uint16_t len;
-    uint8_t type;
-};
-
-/*
- * Send data through a link using specific parameters
+ * Send a single frame through a link using specific
+ * parameters
  *
  * @link: Link to transmit through
  * @params: Parameters to use
  */
 static tx_len_t
-dgram_do_send(struct onet_link *link, struct dgram_params *params)
+dgram_send_frame(struct onet_link *link, struct dgram_params *params)
 {
-    struct sockaddr_ll saddr;
-    struct ether_hdr *eth;
-    struct onet_dgram *dgram;
+    struct onet_shm_peer *peer;
     size_t dgram_len;
+    ssize_t ret;
     char *p, *data;
 
     dgram_len = DGRAM_LEN(params->len);
-    p = malloc(dgram_len);
+    if (link->xsk != NULL) {
+        ret = dgram_xsk_send(link, params);
+        dgram_stat_tx(link, (ret >= 0) ? (ssize_t)dgram_len : ret, dgram_len);
+        return ret;
+    }
+
+    /* Co-located peers get the frame through shared memory */
+    if ((peer = onet_shm_peer(link, params->dst)) != NULL) {
+        if ((p = onet_shm_slot(peer, params->dst, dgram_len)) != NULL) {
+            dgram_build(link, params, p);
+            dgram_fill(p, params->buf, params->len);
+            onet_shm_push(peer);
+            dgram_stat_tx(link, dgram_len, dgram_len);
+            return params->len;
+        }
+        if (errno != ENOTCONN) {
+            return -errno;
+        }
+    }
+
+    /* Build the frame straight into the TX ring if we have one */
+    if (link->tx_ring.base != NULL) {
+        pthread_mutex_lock(&link->tx_lock);
+        data = dgram_tx_slot(link, params);
+        if (data == NULL) {
+            ret = -errno;
+            pthread_mutex_unlock(&link->tx_lock);
+            dgram_stat_tx(link, ret, dgram_len);
+            return ret;
+        }
+
+        dgram_fill(data - DGRAM_LEN(0), params->buf, params->len);
+        dgram_tx_push(link);
+        pthread_mutex_unlock(&link->tx_lock);
+        dgram_tx_kick(link, MSG_DONTWAIT);
+        return params->len;
+    }
+
+    p = dgram_frame_get(link, dgram_len);
     if (p == NULL) {
-        return -1;
+        return -ENOMEM;
+    }
+
+    /* Load up the frame, datagram and send it off */
+    dgram_build(link, params, p);
+    dgram_fill(p, params->buf, params->len);
+    ret = link->tp->send(link, p, dgram_len);
+    dgram_stat_tx(link, ret, dgram_len);
+
+    dgram_frame_put(link, p);
+    return (ret < 0) ? ret : params->len;
+}
+
+tx_len_t
+dgram_do_send(struct onet_link *link, struct dgram_params *params)
+{
+    struct dgram_params frag;
+    uint32_t max, off, idx = 0;
+    uint16_t id;
+    tx_len_t ret;
+
+    max = link->mtu - sizeof(struct onet_dgram);
+    if (params->len <= max) {
+        return dgram_send_frame(link, params);
     }
 
-    eth = (struct ether_hdr *)p;
-    data = DGRAM_DATA(p);
-    dgram = DGRAM_HDR(p);
+    if (params->len > DGRAM_MSG_MAX ||
+        (params->len + max - 1) / max > DGRAM_FRAG_MAX) {
+        return -EMSGSIZE;
+    }
 
-    /* Copy data to send buffer */
-    memset(data, 0, params->len);
-    memcpy(data, params->buf, params->len);
+    id = __atomic_add_fetch(&link->frag_seq, 1, __ATOMIC_RELAXED);
+    frag = *params;
+    for (off = 0; off < params->len; off += max) {
+        frag.buf = (char *)params->buf + off;
+        frag.len = params->len - off;
+        if (frag.len > max) {
+            frag.len = max;
+        }
 
-    /* Hardware address needs to be big endian */
-    params->dst = mac_swap((void *)&params->dst);
+        frag.frag = DGRAM_FRAG(id, idx++, off + frag.len < params->len);
+        if ((ret = dgram_send_frame(link, &frag)) < 0) {
+            return ret;
+        }
+    }
 
-    /*
-     * Set up link layer sockaddr, load up the frame, datagram
-     * and send it off.
-     */
-    saddr.sll_ifindex = link->iface_idx;
-    saddr.sll_halen = HW_ADDR_LEN;
-    ether_load_route(link->hwaddr, params->dst, eth);
-    dgram_load(params->len, 50, params->type, dgram);
-    sendto(
-        link->sockfd, p, dgram_len, 0,
-        (struct sockaddr *)&saddr, sizeof(struct sockaddr_ll)
-    );
-
-    free(p);
     return params->len;
 }
 
+/*
+ * Send a squeak of a given kind
+ *
+ * @link: Link to squeak through
+ * @dst: Destination address to squeak at
+ * @kind: SQUEAK_ASK or SQUEAK_REPLY
+ */
+static tx_len_t
+squeak_send(struct onet_link *link, mac_addr_t dst, uint8_t kind)
+{
+    struct dgram_params params;
+    uint8_t pad[8];
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = kind;
+    params.dst = dst;
+    params.buf = pad;
+    params.len = sizeof(pad);
+    params.type = OTYPE_SQUEAK;
+    params.port = DGRAM_PORT_DEFAULT;
+    params.frag = 0;
+    return dgram_do_send(link, &params);
+}
+
 /*
  * Squeak back at a machine that squeaks at
  * us.
@@ -111,9 +179,11 @@ dgram_do_send(struct onet_link *link, struct dgram_params *params)
  * @link: Link to squeak through
  * @src: Who squeaked first?
  * @dst: Who was intended to be squeaked at?
+ * @kind: What kind of squeak it was
  */
 static int
-squeak_back(struct onet_link *link, mac_addr_t src, mac_addr_t dst)
+squeak_back(struct onet_link *link, mac_addr_t src, mac_addr_t dst,
+            uint8_t kind)
 {
     if (link == NULL) {
         return -EINVAL;
@@ -136,11 +206,27 @@ squeak_back(struct onet_link *link, mac_addr_t src, mac_addr_t dst)
         return -1;
     }
 
-    return dgram_squeak(link, src);
+    /* Our own squeak coming back */
+    if (src == link->hwaddr) {
+        return -1;
+    }
+
+    if (!dgram_neigh_input(link, src, kind == SQUEAK_ASK)) {
+        return (kind == SQUEAK_ASK) ? -EAGAIN : 0;
+    }
+
+    return squeak_send(link, src, SQUEAK_REPLY);
+}
+
+tx_len_t
+dgram_send(struct onet_link *link, mac_addr_t dst, void *buf, uint32_t len)
+{
+    return dgram_sendto(link, dst, DGRAM_PORT_DEFAULT, buf, len);
 }
 
 tx_len_t
-dgram_send(struct onet_link *link, mac_addr_t dst, void *buf, uint16_t len)
+dgram_sendto(struct onet_link *link, mac_addr_t dst, uint8_t port,
+             void *buf, uint32_t len)
 {
     struct dgram_params params;
 
@@ -152,38 +238,289 @@ dgram_send(struct onet_link *link, mac_addr_t dst, void *buf, uint16_t len)
     params.buf = buf;
     params.len = len;
     params.type = OTYPE_DATA;
+    params.port = port;
+    params.frag = 0;
     return dgram_do_send(link, &params);
 }
 
 tx_len_t
-dgram_squeak(struct onet_link *link, mac_addr_t dst)
+dgram_sendv(struct onet_link *link, mac_addr_t dst,
+            const struct iovec *iov, int iovcnt)
 {
+    struct iovec msg_iov[DGRAM_IOV_MAX + 1];
+    char hdr[DGRAM_LEN(0)];
     struct dgram_params params;
-    uint8_t pad[8];
+    struct sockaddr_ll saddr;
+    struct msghdr msg;
+    size_t len = 0;
+    ssize_t ret;
+    char *data;
+    int i;
+
+    if (link == NULL || iov == NULL) {
+        return -EINVAL;
+    }
+
+    if (iovcnt < 0 || iovcnt > DGRAM_IOV_MAX) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    if (len > UINT16_MAX) {
+        return -EMSGSIZE;
+    }
+
+    params.dst = dst;
+    params.buf = NULL;
+    params.len = len;
+    params.type = OTYPE_DATA;
+    params.port = DGRAM_PORT_DEFAULT;
+    params.frag = 0;
+
+    /* The TX ring has its own slots, gather into one of them */
+    if (link->tx_ring.base != NULL) {
+        pthread_mutex_lock(&link->tx_lock);
+        data = dgram_tx_slot(link, &params);
+        if (data == NULL) {
+            ret = -errno;
+            pthread_mutex_unlock(&link->tx_lock);
+            dgram_stat_tx(link, ret, DGRAM_LEN(len));
+            return ret;
+        }
+
+        dgram_fill_iov(data - DGRAM_LEN(0), iov, iovcnt);
+        dgram_tx_push(link);
+        pthread_mutex_unlock(&link->tx_lock);
+        dgram_tx_kick(link, MSG_DONTWAIT);
+        return len;
+    }
+
+    /* Other transports take whole frames, gather into one */
+    if (!ONET_LINK_PACKET(link)) {
+        if ((data = dgram_frame_get(link, DGRAM_LEN(len))) == NULL) {
+            return -ENOMEM;
+        }
+
+        dgram_build(link, &params, data);
+        dgram_fill_iov(data, iov, iovcnt);
+        ret = link->tp->send(link, data, DGRAM_LEN(len));
+        dgram_stat_tx(link, ret, DGRAM_LEN(len));
+        dgram_frame_put(link, data);
+        return (ret < 0) ? ret : (ssize_t)len;
+    }
+
+    /*
+     * Only the headers are ours, the data goes out of the
+     * caller's buffers as is.
+     */
+    dgram_build(link, &params, hdr);
+    msg_iov[0].iov_base = hdr;
+    msg_iov[0].iov_len = sizeof(hdr);
+    for (i = 0; i < iovcnt; ++i) {
+        dgram_seal(DGRAM_HDR(hdr), iov[i].iov_base, iov[i].iov_len);
+        msg_iov[i + 1] = iov[i];
+    }
+
+    dgram_sockaddr(link, &saddr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &saddr;
+    msg.msg_namelen = sizeof(saddr);
+    msg.msg_iov = msg_iov;
+    msg.msg_iovlen = iovcnt + 1;
+    ret = sendmsg(link->sockfd, &msg, 0);
+    if (ret < 0) {
+        ret = -errno;
+    }
+
+    dgram_stat_tx(link, ret, DGRAM_LEN(len));
+    return (ret < 0) ? ret : (ssize_t)len;
+}
 
+char *
+dgram_alloc(struct onet_link *link)
+{
     if (link == NULL) {
+        return NULL;
+    }
+
+    return dgram_frame_get(link, sizeof(struct ether_hdr) + link->mtu);
+}
+
+void
+dgram_free(struct onet_link *link, char *p)
+{
+    if (link == NULL || p == NULL) {
+        return;
+    }
+
+    dgram_frame_put(link, p);
+}
+
+tx_len_t
+dgram_submit(struct onet_link *link, mac_addr_t dst, char *p, uint32_t len)
+{
+    struct dgram_params params;
+    tx_len_t ret;
+
+    if (link == NULL || p == NULL) {
         return -EINVAL;
     }
 
+    /* The frame from dgram_alloc() holds no more than this */
+    if (len > link->mtu - sizeof(struct onet_dgram)) {
+        dgram_frame_put(link, p);
+        return -EMSGSIZE;
+    }
+
     params.dst = dst;
-    params.buf = pad;
-    params.len = sizeof(pad);
-    params.type = OTYPE_SQUEAK;
-    return dgram_do_send(link, &params);
+    params.buf = DGRAM_DATA(p);
+    params.len = len;
+    params.type = OTYPE_DATA;
+    params.port = DGRAM_PORT_DEFAULT;
+    params.frag = 0;
+
+    /* The TX ring has its own slots, copy into one of them */
+    if (link->tx_ring.base != NULL) {
+        ret = dgram_do_send(link, &params);
+        dgram_frame_put(link, p);
+        return ret;
+    }
+
+    /* The data is already in place, only the headers are left */
+    dgram_build(link, &params, p);
+    dgram_seal(DGRAM_HDR(p), DGRAM_DATA(p), len);
+    ret = link->tp->send(link, p, DGRAM_LEN(len));
+    dgram_stat_tx(link, ret, DGRAM_LEN(len));
+
+    dgram_frame_put(link, p);
+    return (ret < 0) ? ret : (tx_len_t)len;
 }
 
-rx_len_t
-dgram_recv(struct onet_link *link, void *buf, uint16_t len)
+tx_len_t
+dgram_squeak(struct onet_link *link, mac_addr_t dst)
 {
-    socklen_t addr_len;
-    struct sockaddr_ll saddr;
-    struct onet_dgram *o1p_hdr;
-    struct ether_hdr *hdr;
-    size_t dgram_len, recv_len;
-    uint32_t crc;
-    uint16_t proto;
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    return squeak_send(link, dst, SQUEAK_ASK);
+}
+
+bool
+dgram_accept(struct onet_link *link, const char *p, const char *data,
+             size_t len)
+{
+    const struct ether_hdr *hdr;
+    const struct onet_dgram *o1p_hdr;
+    uint16_t proto, length;
     mac_addr_t dest_mac, src_mac;
-    char *p;
+
+    if (len < DGRAM_LEN(0)) {
+        dgram_stat(link, ONET_STAT_DROP_PROTO, 1);
+        return false;
+    }
+
+    hdr = (const void *)p;
+    proto = ntohs(hdr->proto);
+    dest_mac = mac_swap((void *)hdr->dest);
+    src_mac = mac_swap((void *)hdr->source);
+
+    if (proto != PROTO_ID) {
+        dgram_stat(link, ONET_STAT_DROP_PROTO, 1);
+        return false;
+    }
+
+    /* Short frames come padded, but never cut short */
+    o1p_hdr = DGRAM_HDR(p);
+    length = ntohs(o1p_hdr->length);
+    if (length > len - DGRAM_LEN(0)) {
+        dgram_stat(link, ONET_STAT_DROP_PROTO, 1);
+        return false;
+    }
+
+    if (!dgram_crc_ok(o1p_hdr, data, length)) {
+        dgram_stat(link, ONET_STAT_DROP_CRC, 1);
+        return false;
+    }
+
+    /* Is this a squeak? */
+    if (o1p_hdr->type == OTYPE_SQUEAK) {
+        dgram_stat(link, ONET_STAT_RX_SQUEAKS, 1);
+        if (length > 0) {
+            squeak_back(link, src_mac, dest_mac, data[0]);
+        }
+        return false;
+    }
+
+    /*
+     * Channel traffic is for whoever has its port bound,
+     * group traffic for members of the group and the rest
+     * for everyone or us.
+     */
+    if (o1p_hdr->type != OTYPE_DATA &&
+        __atomic_load_n(&link->nports, __ATOMIC_RELAXED) == 0) {
+        dgram_stat(link, ONET_STAT_DROP_NOTUS, 1);
+        return false;
+    }
+
+    if (dest_mac != MAC_BROADCAST &&
+        (MAC_IS_MULTICAST(dest_mac) ? !dgram_joined(link, dest_mac) :
+         dest_mac != link->hwaddr)) {
+        dgram_stat(link, ONET_STAT_DROP_NOTUS, 1);
+        return false;
+    }
+
+    dgram_stat(link, ONET_STAT_RX_PACKETS, 1);
+    dgram_stat(link, ONET_STAT_RX_BYTES, DGRAM_LEN(length));
+    return true;
+}
+
+/*
+ * Copy the data of a received frame out to the caller
+ *
+ * @buf: Buffer to copy into
+ * @len: Size of `buf'
+ * @p: Frame to copy from
+ * @frame_len: Length of the frame
+ *
+ * Returns the number of bytes copied, the payload is cut
+ * short if it does not fit in `buf'.
+ */
+static inline size_t
+recv_copy(void *buf, uint32_t len, const char *p, size_t frame_len)
+{
+    frame_len -= DGRAM_LEN(0);
+    if (frame_len > len) {
+        frame_len = len;
+    }
+
+    memcpy(buf, DGRAM_DATA(p), frame_len);
+    return frame_len;
+}
+
+rx_len_t
+dgram_recv(struct onet_link *link, void *buf, uint32_t len)
+{
+    if (link == NULL) {
+        return -1;
+    }
+
+    return dgram_recv_timed(link, buf, len, dgram_rx_timeout(link));
+}
+
+rx_len_t
+dgram_recv_timed(struct onet_link *link, void *buf, uint32_t len,
+                 int timeout)
+{
+    struct dgram_slot slot;
+    size_t data_len, frame_len;
+    ssize_t recv_len;
+    int64_t deadline;
+    int error;
+    char *p, *whole;
 
     if (link == NULL || buf == NULL) {
         return -1;
@@ -193,61 +530,96 @@ dgram_recv(struct onet_link *link, void *buf, uint16_t len)
         return -1;
     }
 
-    /* Allocate an RX buffer */
-    dgram_len = DGRAM_LEN(len);
-    p = malloc(dgram_len);
+    deadline = dgram_deadline(timeout);
+
+    /* Ports are bound, we only get what they do not take */
+    if (__atomic_load_n(&link->nports, __ATOMIC_ACQUIRE) > 0) {
+        error = dgram_port_wait(link, link->port_any, &slot, timeout);
+        if (error < 0) {
+            return (error == -EAGAIN) ? error : -1;
+        }
+
+        data_len = recv_copy(buf, len, slot.p, slot.len);
+        dgram_frame_put(link, slot.p);
+        return data_len;
+    }
+
+    /* Take frames straight out of the RX ring if we have one */
+    if (dgram_rx_mapped(link)) {
+        for (;;) {
+            p = dgram_rx_next(link, &frame_len, dgram_remaining(deadline));
+            if (p == NULL) {
+                return (errno == EAGAIN) ? -EAGAIN : -1;
+            }
+
+            if (!dgram_accept(link, p, DGRAM_DATA(p), frame_len)) {
+                continue;
+            }
+
+            frame_len = dgram_frame_len(p);
+
+            if (!DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+                return recv_copy(buf, len, p, frame_len);
+            }
+
+            whole = dgram_reasm(link, p, DGRAM_DATA(p), frame_len, &frame_len);
+            if (whole != NULL) {
+                data_len = recv_copy(buf, len, whole, frame_len);
+                dgram_frame_put(link, whole);
+                return data_len;
+            }
+        }
+    }
+
+    /* Grab an RX buffer */
+    frame_len = sizeof(struct ether_hdr) + link->mtu;
+    p = dgram_frame_get(link, frame_len);
     if (p == NULL) {
         return -1;
     }
 
-    addr_len = sizeof(struct sockaddr_ll);
-    saddr.sll_ifindex = link->iface_idx;
-    saddr.sll_halen = HW_ADDR_LEN;
-
     /*
      * Wait until we get a packet for us with the right
-     * protocol ID.
+     * protocol ID, putting fragments back together.
      */
     for (;;) {
-        recv_len = recvfrom(
-            link->sockfd, p, dgram_len,
-            0, (struct sockaddr *)&saddr,
-            &addr_len
+        recv_len = link->tp->recv(
+            link, p, frame_len,
+            dgram_remaining(deadline)
         );
 
-        hdr = (void *)p;
-        proto = ntohs(hdr->proto);
-        dest_mac = mac_swap(hdr->dest);
-        src_mac = mac_swap(hdr->source);
-
-        if (proto != PROTO_ID) {
+        if (recv_len == -EAGAIN) {
+            if (deadline >= 0 && dgram_remaining(deadline) == 0) {
+                dgram_frame_put(link, p);
+                return -EAGAIN;
+            }
             continue;
         }
 
-        o1p_hdr = DGRAM_HDR(p);
-        crc = crc32(o1p_hdr, sizeof(*o1p_hdr) - sizeof(crc));
-        if (crc != o1p_hdr->crc32) {
-            continue;
+        if (recv_len < 0) {
+            dgram_frame_put(link, p);
+            return -1;
         }
 
-        /* Is this a squeak? */
-        if (o1p_hdr->type == OTYPE_SQUEAK) {
-            squeak_back(link, src_mac, dest_mac);
+        if (!dgram_accept(link, p, DGRAM_DATA(p), recv_len)) {
             continue;
         }
 
-        /* If this is for everyone, take it */
-        if (dest_mac == MAC_BROADCAST) {
+        recv_len = dgram_frame_len(p);
+
+        if (!DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+            data_len = recv_copy(buf, len, p, recv_len);
             break;
         }
 
-        /* If this is for us, take it */
-        if (dest_mac == link->hwaddr) {
+        whole = dgram_reasm(link, p, DGRAM_DATA(p), recv_len, &frame_len);
+        if (whole != NULL) {
+            data_len = recv_copy(buf, len, whole, frame_len);
+            dgram_frame_put(link, whole);
             break;
         }
     }
 
-    memcpy(buf, DGRAM_DATA(p), len);
-    free(p);
-    return dgram_len;
+    dgram_frame_put(link, p);
+    return data_len;
 }
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "loop.h"
+#include "dgram_var.h"
+
+/*
+ * Max number of datagrams taken off a link before
+ * giving other sources a turn.
+ */
+#define LOOP_BUDGET 64
+
+/*
+ * Max number of events handled per epoll_wait()
+ */
+#define LOOP_EVENTS 32
+
+#define LOOP_SRC_LINK  0
+#define LOOP_SRC_TIMER 1
+
+/*
+ * Represents something a loop waits on
+ *
+ * @type: LOOP_SRC_LINK or LOOP_SRC_TIMER
+ * @fd: File descriptor polled for the source
+ * @dead: Set once removed from the loop
+ * @next: Next source of the loop (or dead source)
+ *
+ * For links:
+ *
+ * @link: Link to read
+ * @frame: Frame to receive into (without an RX ring)
+ * @fns: Callback of each port (NULL if none)
+ * @args: Argument of each port callback
+ * @any: Callback for ports without their own
+ * @any_arg: Argument of `any'
+ *
+ * For timers:
+ *
+ * @timer_fn: Callback to run when the timer fires
+ * @timer_arg: Argument of `timer_fn'
+ * @oneshot: Remove the timer once it fires
+ */
+struct loop_src {
+    int type;
+    int fd;
+    bool dead;
+    struct loop_src *next;
+    struct onet_link *link;
+    char *frame;
+    onet_recv_fn fns[ONET_PORT_MAX];
+    void *args[ONET_PORT_MAX];
+    onet_recv_fn any;
+    void *any_arg;
+    onet_timer_fn timer_fn;
+    void *timer_arg;
+    bool oneshot;
+};
+
+static struct loop_src *
+loop_src_alloc(struct onet_loop *loop, int type, int fd)
+{
+    struct epoll_event ev;
+    struct loop_src *src;
+
+    src = calloc(1, sizeof(*src));
+    if (src == NULL) {
+        return NULL;
+    }
+
+    src->type = type;
+    src->fd = fd;
+    ev.events = EPOLLIN;
+    ev.data.ptr = src;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        free(src);
+        return NULL;
+    }
+
+    src->next = loop->srcs;
+    loop->srcs = src;
+    return src;
+}
+
+static void
+loop_src_free(struct loop_src *src)
+{
+    if (src->type == LOOP_SRC_TIMER) {
+        close(src->fd);
+    } else if (src->frame != NULL) {
+        dgram_frame_put(src->link, src->frame);
+    }
+
+    free(src);
+}
+
+/*
+ * Take a source off a loop, it is freed once whatever
+ * is being dispatched is done with it.
+ */
+static void
+loop_src_del(struct onet_loop *loop, struct loop_src *src)
+{
+    struct loop_src **pp;
+
+    for (pp = &loop->srcs; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == src) {
+            *pp = src->next;
+            break;
+        }
+    }
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    src->dead = true;
+    src->next = loop->dead;
+    loop->dead = src;
+}
+
+static struct loop_src *
+loop_src_find(struct onet_loop *loop, int type, int fd)
+{
+    struct loop_src *src;
+
+    for (src = loop->srcs; src != NULL; src = src->next) {
+        if (src->type == type && src->fd == fd) {
+            return src;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Dispatch whatever datagrams a link has queued, up
+ * to LOOP_BUDGET of them.
+ */
+static void
+loop_link_read(struct loop_src *src)
+{
+    struct onet_link *link = src->link;
+    const struct ether_hdr *eth;
+    const struct onet_dgram *hdr;
+    onet_recv_fn fn;
+    size_t frame_len, len;
+    ssize_t recv_len;
+    void *arg;
+    char *p, *whole;
+    int n;
+
+    frame_len = sizeof(struct ether_hdr) + link->mtu;
+    for (n = 0; n < LOOP_BUDGET && !src->dead; ++n) {
+        if (dgram_rx_mapped(link)) {
+            if ((p = dgram_rx_next(link, &len, 0)) == NULL) {
+                break;
+            }
+        } else {
+            recv_len = recv(link->sockfd, src->frame, frame_len, MSG_DONTWAIT);
+            if (recv_len < 0) {
+                break;
+            }
+
+            p = src->frame;
+            len = recv_len;
+        }
+
+        if (!dgram_accept(link, p, DGRAM_DATA(p), len)) {
+            continue;
+        }
+
+        len = dgram_frame_len(p);
+
+        /* Hand fragments over once they make a whole datagram */
+        whole = NULL;
+        if (DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+            whole = dgram_reasm(link, p, DGRAM_DATA(p), len, &len);
+            if ((p = whole) == NULL) {
+                continue;
+            }
+        }
+
+        hdr = DGRAM_HDR(p);
+        fn = src->fns[hdr->port];
+        arg = src->args[hdr->port];
+        if (fn == NULL) {
+            fn = src->any;
+            arg = src->any_arg;
+        }
+
+        if (fn != NULL) {
+            eth = (const void *)p;
+            fn(
+                link, mac_swap((void *)eth->source), hdr->port,
+                DGRAM_DATA(p), len - DGRAM_LEN(0), arg
+            );
+        }
+
+        if (whole != NULL) {
+            dgram_frame_put(link, whole);
+        }
+    }
+}
+
+static void
+loop_timer_fire(struct onet_loop *loop, struct loop_src *src)
+{
+    uint64_t expirations;
+
+    if (read(src->fd, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+
+    if (src->oneshot) {
+        loop_src_del(loop, src);
+    }
+
+    src->timer_fn(loop, src->timer_arg);
+}
+
+int
+onet_loop_init(struct onet_loop *loop)
+{
+    struct epoll_event ev;
+
+    if (loop == NULL) {
+        return -EINVAL;
+    }
+
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        return -errno;
+    }
+
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakefd < 0) {
+        close(loop->epfd);
+        return -errno;
+    }
+
+    /* NULL marks the wakeup eventfd */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+        close(loop->wakefd);
+        close(loop->epfd);
+        return -errno;
+    }
+
+    return 0;
+}
+
+void
+onet_loop_free(struct onet_loop *loop)
+{
+    struct loop_src *src;
+
+    if (loop == NULL) {
+        return;
+    }
+
+    while (loop->srcs != NULL) {
+        loop_src_del(loop, loop->srcs);
+    }
+
+    while ((src = loop->dead) != NULL) {
+        loop->dead = src->next;
+        loop_src_free(src);
+    }
+
+    close(loop->wakefd);
+    close(loop->epfd);
+}
+
+int
+onet_loop_add(struct onet_loop *loop, struct onet_link *link, int port,
+              onet_recv_fn fn, void *arg)
+{
+    struct loop_src *src;
+
+    if (loop == NULL || link == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    if (port < ONET_LOOP_ANY || port >= ONET_PORT_MAX) {
+        return -EINVAL;
+    }
+
+    /* The loop waits on the packet socket */
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /* Bound ports have their own demultiplexer */
+    if (__atomic_load_n(&link->nports, __ATOMIC_ACQUIRE) > 0) {
+        return -EBUSY;
+    }
+
+    src = loop_src_find(loop, LOOP_SRC_LINK, dgram_rx_fd(link));
+    if (src == NULL) {
+        src = loop_src_alloc(loop, LOOP_SRC_LINK, dgram_rx_fd(link));
+        if (src == NULL) {
+            return -errno;
+        }
+
+        src->link = link;
+        if (!dgram_rx_mapped(link)) {
+            src->frame = dgram_frame_get(
+                link, sizeof(struct ether_hdr) + link->mtu
+            );
+
+            if (src->frame == NULL) {
+                loop_src_del(loop, src);
+                return -ENOMEM;
+            }
+        }
+    }
+
+    if (port == ONET_LOOP_ANY) {
+        src->any = fn;
+        src->any_arg = arg;
+    } else {
+        src->fns[port] = fn;
+        src->args[port] = arg;
+    }
+
+    return 0;
+}
+
+int
+onet_loop_del(struct onet_loop *loop, struct onet_link *link)
+{
+    struct loop_src *src;
+
+    if (loop == NULL || link == NULL) {
+        return -EINVAL;
+    }
+
+    src = loop_src_find(loop, LOOP_SRC_LINK, dgram_rx_fd(link));
+    if (src == NULL) {
+        return -ENOENT;
+    }
+
+    loop_src_del(loop, src);
+    return 0;
+}
+
+int
+onet_loop_timer(struct onet_loop *loop, uint32_t ms, uint32_t interval,
+                onet_timer_fn fn, void *arg)
+{
+    struct itimerspec its;
+    struct loop_src *src;
+    int fd, error;
+
+    if (loop == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    /* A zero it_value would disarm the timer */
+    if (ms == 0) {
+        ms = 1;
+    }
+
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    its.it_interval.tv_sec = interval / 1000;
+    its.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+    if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+        error = -errno;
+        close(fd);
+        return error;
+    }
+
+    if ((src = loop_src_alloc(loop, LOOP_SRC_TIMER, fd)) == NULL) {
+        error = -errno;
+        close(fd);
+        return error;
+    }
+
+    src->timer_fn = fn;
+    src->timer_arg = arg;
+    src->oneshot = (interval == 0);
+    return fd;
+}
+
+int
+onet_loop_cancel(struct onet_loop *loop, int timer)
+{
+    struct loop_src *src;
+
+    if (loop == NULL) {
+        return -EINVAL;
+    }
+
+    if ((src = loop_src_find(loop, LOOP_SRC_TIMER, timer)) == NULL) {
+        return -ENOENT;
+    }
+
+    loop_src_del(loop, src);
+    return 0;
+}
+
+int
+onet_loop_run(struct onet_loop *loop, int timeout)
+{
+    struct epoll_event events[LOOP_EVENTS];
+    struct loop_src *src;
+    uint64_t val;
+    int64_t deadline;
+    int i, n, error = 0;
+
+    if (loop == NULL) {
+        return -EINVAL;
+    }
+
+    deadline = dgram_deadline(timeout);
+    while (!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE)) {
+        n = epoll_wait(loop->epfd, events, LOOP_EVENTS,
+                       dgram_remaining(deadline));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            error = -errno;
+            break;
+        }
+
+        for (i = 0; i < n; ++i) {
+            if ((src = events[i].data.ptr) == NULL) {
+                read(loop->wakefd, &val, sizeof(val));
+                continue;
+            }
+
+            if (src->dead) {
+                continue;
+            }
+
+            if (src->type == LOOP_SRC_LINK) {
+                loop_link_read(src);
+            } else {
+                loop_timer_fire(loop, src);
+            }
+        }
+
+        /* Nothing can be pointing at removed sources now */
+        while ((src = loop->dead) != NULL) {
+            loop->dead = src->next;
+            loop_src_free(src);
+        }
+
+        if (dgram_remaining(deadline) == 0) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&loop->stop, false, __ATOMIC_RELEASE);
+    return error;
+}
+
+void
+onet_loop_stop(struct onet_loop *loop)
+{
+    uint64_t val = 1;
+
+    if (loop == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&loop->stop, true, __ATOMIC_RELEASE);
+    write(loop->wakefd, &val, sizeof(val));
+}
@@ -0,0 +1,1147 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "mcast.h"
+#include "fec.h"
+#include "dgram_var.h"
+
+#define PUB_MASK (ONET_PUB_BUF - 1)
+#define SUB_MASK (ONET_SUB_WND - 1)
+
+/* Heartbeat interval bounds (us), it doubles while idle */
+#define MCAST_HB_MIN    1000
+#define MCAST_HB_MAX    250000
+
+/* Time a repaired segment is not sent again for (us) */
+#define MCAST_HOLDOFF   2000
+
+/* Max random delay before a NACK goes out (us) */
+#define MCAST_NACK_DELAY 1000
+
+/* Extra NACK delay when FEC may get a segment back first (us) */
+#define MCAST_FEC_WAIT 3000
+
+/* Time before a segment is asked for again (us) */
+#define MCAST_NACK_RETRY 10000
+
+/* Times a segment is asked for before it is given up on */
+#define MCAST_NACK_MAX 8
+
+/* Max frames handled per wakeup */
+#define MCAST_DRAIN 64
+
+/* Segments sent between looks at the NACKs */
+#define MCAST_PUMP_EVERY 32
+
+/*
+ * Segment slot states (subscriber side)
+ *
+ * @SEG_HAVE: The slot holds a segment
+ * @SEG_LOST: Could not be repaired, skipped on read
+ * @SEG_READ: Was read, the data is still there for FEC
+ */
+#define SEG_HAVE    (1 << 0)
+#define SEG_LOST    (1 << 1)
+#define SEG_READ    (1 << 2)
+
+/*
+ * State of a publisher or subscriber segment slot
+ *
+ * @len: Data length of the segment
+ * @state: Slot state (see SEG_*)
+ * @flags: Header flags of the segment (see MCAST_F_*)
+ * @tries: Number of NACKs sent for it (subscriber side)
+ * @when: When it may be repaired again (publisher side),
+ *        when the next NACK is due (subscriber side)
+ */
+struct mcast_seg {
+    uint16_t len;
+    uint8_t state;
+    uint8_t tries;
+    uint16_t flags;
+    uint64_t when;
+};
+
+/*
+ * Repair blocks of a FEC group held by a subscriber
+ *
+ * @used: The entry holds a group
+ * @base: First sequence number of the group
+ * @k, @r: Source and repair block counts
+ * @len: Length of each block
+ * @have: Repair blocks had (bit N for block N)
+ * @cap: Number of blocks `par' has room for
+ * @par: Repair blocks
+ */
+struct mcast_fec {
+    bool used;
+    uint32_t base;
+    uint32_t k;
+    uint32_t r;
+    uint32_t len;
+    uint64_t have;
+    uint32_t cap;
+    uint8_t *par;
+};
+
+static inline uint64_t
+mcast_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Turn a point in time (us) into a wait in ms, capped
+ * at `timeout' (-1 meaning no cap)
+ */
+static int
+mcast_wait(uint64_t at, int timeout)
+{
+    uint64_t now = mcast_now();
+    int wait;
+
+    if (at == 0) {
+        return timeout;
+    }
+
+    wait = (at > now) ? (at - now + 999) / 1000 : 0;
+    return (timeout < 0 || wait < timeout) ? wait : timeout;
+}
+
+/*
+ * Join the group a stream goes to, unless it is
+ * the broadcast address
+ */
+static int
+mcast_join(struct onet_link *link, mac_addr_t group)
+{
+    if (group == MAC_BROADCAST || !MAC_IS_MULTICAST(group)) {
+        return 0;
+    }
+
+    return dgram_join(link, group);
+}
+
+static void
+mcast_leave(struct onet_link *link, mac_addr_t group)
+{
+    if (group != MAC_BROADCAST && MAC_IS_MULTICAST(group)) {
+        dgram_leave(link, group);
+    }
+}
+
+static int
+mcast_output(struct onet_link *link, mac_addr_t dst, uint8_t port,
+             uint8_t type, void *buf, uint32_t len)
+{
+    struct dgram_params params;
+
+    params.dst = dst;
+    params.buf = buf;
+    params.len = len;
+    params.type = type;
+    params.port = port;
+    params.frag = 0;
+    return dgram_do_send(link, &params);
+}
+
+/*
+ * Get the header (then the data) of a frame from a
+ * stream port, NULL if it is not one of ours.
+ */
+static const struct onet_mcast_hdr *
+mcast_frame(const struct dgram_slot *slot, uint32_t *len, mac_addr_t *src)
+{
+    const struct ether_hdr *eth = (const void *)slot->p;
+
+    if (slot->len < DGRAM_LEN(sizeof(struct onet_mcast_hdr))) {
+        return NULL;
+    }
+
+    *len = slot->len - DGRAM_LEN(sizeof(struct onet_mcast_hdr));
+    *src = mac_swap((void *)eth->source);
+    return (const void *)DGRAM_DATA(slot->p);
+}
+
+/*
+ * Send a segment the publisher holds (again)
+ */
+static void
+pub_xmit(struct onet_pub *pub, uint32_t seq, uint16_t flags)
+{
+    struct mcast_seg *seg = &pub->segs[seq & PUB_MASK];
+    struct onet_mcast_hdr *h;
+
+    h = (void *)(pub->arena + (size_t)(seq & PUB_MASK) * pub->seg_size);
+    h->session = htonl(pub->session);
+    h->seq = htonl(seq);
+    h->lo = htonl(pub->lo);
+    h->map = 0;
+    h->flags = htons(seg->flags | flags);
+    mcast_output(
+        pub->link, pub->group, pub->port,
+        OTYPE_MDATA, h, sizeof(*h) + seg->len
+    );
+}
+
+/*
+ * Send the repair blocks of the current FEC group,
+ * cutting it short if it is not full yet
+ */
+static void
+pub_fec_emit(struct onet_pub *pub)
+{
+    struct onet_mcast_hdr *h;
+    size_t blk = MCAST_FEC_PREFIX + pub->mss;
+    uint8_t *p;
+    uint32_t j;
+
+    for (j = 0; j < pub->fec_r; ++j) {
+        /* The header goes right in front of the block */
+        p = pub->fec_par + j * (sizeof(*h) + blk);
+        h = (void *)p;
+        h->session = htonl(pub->session);
+        h->seq = htonl(pub->fec_base);
+        h->lo = htonl(pub->lo);
+        h->map = htobe64(pub->fec_n | pub->fec_r << 8 | (uint64_t)j << 16);
+        h->flags = 0;
+        mcast_output(
+            pub->link, pub->group, pub->port,
+            OTYPE_MFEC, h, sizeof(*h) + pub->fec_len
+        );
+        memset(p + sizeof(*h), 0, pub->fec_len);
+    }
+
+    pub->fec_base = pub->seq;
+    pub->fec_n = 0;
+    pub->fec_len = 0;
+}
+
+/*
+ * Add a segment just sent to the repair blocks of the
+ * current FEC group
+ */
+static void
+pub_fec_add(struct onet_pub *pub, uint32_t seq, const uint8_t *data)
+{
+    struct mcast_seg *seg = &pub->segs[seq & PUB_MASK];
+    size_t blk = MCAST_FEC_PREFIX + pub->mss;
+    uint8_t prefix[MCAST_FEC_PREFIX], *p, c;
+    uint32_t j;
+
+    if (pub->fec_n == 0) {
+        pub->fec_base = seq;
+    }
+
+    prefix[0] = seg->len >> 8;
+    prefix[1] = seg->len & 0xFF;
+    prefix[2] = seg->flags >> 8;
+    prefix[3] = seg->flags & 0xFF;
+    for (j = 0; j < pub->fec_r; ++j) {
+        p = pub->fec_par + j * (sizeof(struct onet_mcast_hdr) + blk) +
+            sizeof(struct onet_mcast_hdr);
+        c = fec_coef(j, pub->fec_n);
+        gf_mul_add(p, prefix, c, sizeof(prefix));
+        gf_mul_add(p + sizeof(prefix), data, c, seg->len);
+    }
+
+    if (MCAST_FEC_PREFIX + seg->len > pub->fec_len) {
+        pub->fec_len = MCAST_FEC_PREFIX + seg->len;
+    }
+
+    if (++pub->fec_n == pub->fec_k) {
+        pub_fec_emit(pub);
+    }
+}
+
+static void
+pub_heartbeat(struct onet_pub *pub)
+{
+    struct onet_mcast_hdr h;
+
+    memset(&h, 0, sizeof(h));
+    h.session = htonl(pub->session);
+    h.seq = htonl(pub->seq);
+    h.lo = htonl(pub->lo);
+    h.flags = htons(MCAST_F_HB);
+    mcast_output(pub->link, pub->group, pub->port, OTYPE_MDATA, &h, sizeof(h));
+}
+
+/*
+ * Repair whatever a NACK asks for that is still held,
+ * unless it was just repaired for someone else.
+ */
+static void
+pub_input(struct onet_pub *pub, const struct dgram_slot *slot)
+{
+    const struct onet_dgram *hdr = DGRAM_HDR(slot->p);
+    const struct onet_mcast_hdr *h;
+    struct mcast_seg *seg;
+    mac_addr_t src;
+    uint64_t map, now;
+    uint32_t len, seq;
+
+    if (hdr->type != OTYPE_MNACK) {
+        return;
+    }
+
+    h = mcast_frame(slot, &len, &src);
+    if (h == NULL || ntohl(h->session) != pub->session) {
+        return;
+    }
+
+    now = mcast_now();
+    seq = ntohl(h->seq);
+    for (map = be64toh(h->map); map != 0; map >>= 1, ++seq) {
+        if (!(map & 1) || SEQ_LT(seq, pub->lo) ||
+            !SEQ_LT(seq, pub->seq)) {
+            continue;
+        }
+
+        seg = &pub->segs[seq & PUB_MASK];
+        if (now < seg->when) {
+            continue;
+        }
+
+        seg->when = now + MCAST_HOLDOFF;
+        pub_xmit(pub, seq, MCAST_F_RETX);
+        ++pub->repairs;
+    }
+}
+
+/*
+ * Handle NACKs for up to `timeout' ms and send a
+ * heartbeat if one is due.
+ */
+static int
+pub_pump(struct onet_pub *pub, int timeout)
+{
+    struct dgram_slot slot;
+    uint64_t now;
+    int error, n = 0;
+
+    error = dgram_port_wait(
+        pub->link, pub->rxq, &slot,
+        mcast_wait(pub->hb_at, timeout)
+    );
+
+    while (error == 0) {
+        pub_input(pub, &slot);
+        dgram_frame_put(pub->link, slot.p);
+        if (++n == MCAST_DRAIN) {
+            break;
+        }
+
+        error = dgram_port_wait(pub->link, pub->rxq, &slot, 0);
+    }
+
+    if (error < 0 && error != -EAGAIN) {
+        return error;
+    }
+
+    now = mcast_now();
+    if (now >= pub->hb_at) {
+        /* Going idle, do not leave a group hanging */
+        if (pub->fec_n > 0) {
+            pub_fec_emit(pub);
+        }
+
+        pub_heartbeat(pub);
+        pub->hb_ivl *= 2;
+        if (pub->hb_ivl > MCAST_HB_MAX) {
+            pub->hb_ivl = MCAST_HB_MAX;
+        }
+        pub->hb_at = now + pub->hb_ivl;
+    }
+
+    return 0;
+}
+
+int
+onet_pub_open(struct onet_link *link, mac_addr_t group, uint8_t port,
+              struct onet_pub *res)
+{
+    int error;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->link = link;
+    res->group = group;
+    res->port = port;
+    res->mss = link->mtu - sizeof(struct onet_dgram) -
+        sizeof(struct onet_mcast_hdr);
+    res->seg_size = sizeof(struct onet_mcast_hdr) + res->mss;
+
+    res->arena = malloc((size_t)ONET_PUB_BUF * res->seg_size);
+    res->segs = calloc(ONET_PUB_BUF, sizeof(*res->segs));
+    if (res->arena == NULL || res->segs == NULL) {
+        error = -ENOMEM;
+        goto fail;
+    }
+
+    if ((error = dgram_bind(link, port, 0)) < 0) {
+        goto fail;
+    }
+
+    if ((error = mcast_join(link, group)) < 0) {
+        dgram_unbind(link, port);
+        goto fail;
+    }
+
+    res->rxq = link->ports[port];
+    res->session = (uint32_t)mcast_now() ^ ((uint32_t)getpid() << 16);
+    res->seq = res->session;
+    res->lo = res->seq;
+    res->hb_ivl = MCAST_HB_MIN;
+    res->hb_at = mcast_now();
+    return 0;
+fail:
+    free(res->arena);
+    free(res->segs);
+    memset(res, 0, sizeof(*res));
+    return error;
+}
+
+void
+onet_pub_close(struct onet_pub *pub)
+{
+    if (pub == NULL || pub->link == NULL) {
+        return;
+    }
+
+    mcast_leave(pub->link, pub->group);
+    dgram_unbind(pub->link, pub->port);
+    free(pub->arena);
+    free(pub->segs);
+    free(pub->fec_par);
+    memset(pub, 0, sizeof(*pub));
+}
+
+tx_len_t
+onet_pub_send(struct onet_pub *pub, const void *buf, uint32_t len)
+{
+    struct mcast_seg *seg;
+    uint32_t off = 0, n, seq;
+    int error;
+
+    if (pub == NULL || (buf == NULL && len > 0)) {
+        return -EINVAL;
+    }
+
+    if (len > INT32_MAX) {
+        return -EMSGSIZE;
+    }
+
+    do {
+        n = len - off;
+        if (n > pub->mss) {
+            n = pub->mss;
+        }
+
+        /* The oldest segment makes room, it cannot be repaired now */
+        seq = pub->seq++;
+        if (pub->seq - pub->lo > ONET_PUB_BUF) {
+            ++pub->lo;
+        }
+
+        seg = &pub->segs[seq & PUB_MASK];
+        seg->len = n;
+        seg->flags = (off + n == len) ? MCAST_F_END : 0;
+        seg->when = 0;
+        memcpy(
+            pub->arena + (size_t)(seq & PUB_MASK) * pub->seg_size +
+            sizeof(struct onet_mcast_hdr), (const char *)buf + off, n
+        );
+
+        pub_xmit(pub, seq, 0);
+        if (pub->fec_k > 0) {
+            pub_fec_add(pub, seq, (const uint8_t *)buf + off);
+        }
+        off += n;
+
+        if ((seq & (MCAST_PUMP_EVERY - 1)) == 0 &&
+            (error = pub_pump(pub, 0)) < 0) {
+            return error;
+        }
+    } while (off < len);
+
+    /* Keep heartbeats close behind the data */
+    pub->hb_ivl = MCAST_HB_MIN;
+    pub->hb_at = mcast_now() + MCAST_HB_MIN;
+    return len;
+}
+
+int
+onet_pub_fec(struct onet_pub *pub, uint32_t k, uint32_t r)
+{
+    size_t blk;
+    uint16_t mss;
+    uint8_t *par = NULL;
+
+    if (pub == NULL || k > FEC_K_MAX || r > FEC_R_MAX) {
+        return -EINVAL;
+    }
+
+    mss = pub->link->mtu - sizeof(struct onet_dgram) -
+        sizeof(struct onet_mcast_hdr);
+    if (k == 0 || r == 0) {
+        k = r = 0;
+    } else {
+        /* Segments make room for the prefix, repair blocks fit a frame */
+        mss -= MCAST_FEC_PREFIX;
+        blk = sizeof(struct onet_mcast_hdr) + MCAST_FEC_PREFIX + mss;
+        if ((par = calloc(r, blk)) == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    if (pub->fec_n > 0) {
+        pub_fec_emit(pub);
+    }
+
+    pub->mss = mss;
+    free(pub->fec_par);
+    pub->fec_par = par;
+    pub->fec_k = k;
+    pub->fec_r = r;
+    pub->fec_base = pub->seq;
+    return 0;
+}
+
+int
+onet_pub_poll(struct onet_pub *pub, int timeout)
+{
+    if (pub == NULL) {
+        return -EINVAL;
+    }
+
+    return pub_pump(pub, timeout);
+}
+
+/*
+ * Pick a random NACK delay, so that subscribers missing
+ * the same segments do not all ask at once
+ */
+static uint64_t
+sub_delay(struct onet_sub *sub)
+{
+    sub->rand ^= sub->rand << 13;
+    sub->rand ^= sub->rand >> 17;
+    sub->rand ^= sub->rand << 5;
+    return sub->rand % MCAST_NACK_DELAY;
+}
+
+static inline char *
+sub_data(struct onet_sub *sub, uint32_t seq)
+{
+    return sub->arena + (size_t)(seq & SUB_MASK) * sub->mss;
+}
+
+/*
+ * Move `rcv_nxt' past whatever is had or lost
+ */
+static void
+sub_advance(struct onet_sub *sub)
+{
+    while (SEQ_LT(sub->rcv_nxt, sub->rx_top) &&
+           (sub->segs[sub->rcv_nxt & SUB_MASK].state &
+            (SEG_HAVE | SEG_LOST))) {
+        ++sub->rcv_nxt;
+    }
+}
+
+/*
+ * Learn that everything up to `top' exists, and schedule
+ * NACKs for what we do not have of it
+ */
+static void
+sub_extend(struct onet_sub *sub, uint32_t top)
+{
+    struct mcast_seg *seg;
+    uint64_t now;
+
+    if (SEQ_LT(sub->rx_read + ONET_SUB_WND, top)) {
+        top = sub->rx_read + ONET_SUB_WND;
+    }
+
+    if (!SEQ_LT(sub->rx_top, top)) {
+        return;
+    }
+
+    now = mcast_now();
+    for (; sub->rx_top != top; ++sub->rx_top) {
+        seg = &sub->segs[sub->rx_top & SUB_MASK];
+        memset(seg, 0, sizeof(*seg));
+        seg->when = now + sub_delay(sub);
+        if (sub->fec_seen) {
+            seg->when += MCAST_FEC_WAIT;
+        }
+        if (sub->nack_at == 0 || seg->when < sub->nack_at) {
+            sub->nack_at = seg->when;
+        }
+    }
+}
+
+/*
+ * Give up on anything older than what the publisher
+ * still holds
+ */
+static void
+sub_forget(struct onet_sub *sub, uint32_t lo)
+{
+    struct mcast_seg *seg;
+    uint32_t seq;
+
+    for (seq = sub->rcv_nxt; SEQ_LT(seq, lo) &&
+         SEQ_LT(seq, sub->rx_top); ++seq) {
+        seg = &sub->segs[seq & SUB_MASK];
+        if (!(seg->state & SEG_HAVE)) {
+            seg->state |= SEG_LOST;
+        }
+    }
+
+    sub_advance(sub);
+}
+
+static void
+sub_nack(struct onet_sub *sub, uint32_t base, uint64_t map)
+{
+    struct onet_mcast_hdr h;
+
+    memset(&h, 0, sizeof(h));
+    h.session = htonl(sub->session);
+    h.seq = htonl(base);
+    h.map = htobe64(map);
+    mcast_output(
+        sub->link, sub->group, sub->port,
+        OTYPE_MNACK, &h, sizeof(h)
+    );
+}
+
+/*
+ * Send NACKs for every missing segment that is due,
+ * 64 to a NACK
+ */
+static void
+sub_nack_round(struct onet_sub *sub)
+{
+    struct mcast_seg *seg;
+    uint64_t now, map = 0;
+    uint32_t seq, base = 0;
+
+    now = mcast_now();
+    sub->nack_at = 0;
+    for (seq = sub->rcv_nxt; SEQ_LT(seq, sub->rx_top); ++seq) {
+        seg = &sub->segs[seq & SUB_MASK];
+        if (seg->state & (SEG_HAVE | SEG_LOST)) {
+            continue;
+        }
+
+        if (seg->when <= now) {
+            if (seg->tries >= MCAST_NACK_MAX) {
+                seg->state |= SEG_LOST;
+                continue;
+            }
+
+            if (map != 0 && seq - base >= 64) {
+                sub_nack(sub, base, map);
+                map = 0;
+            }
+
+            if (map == 0) {
+                base = seq;
+            }
+
+            map |= 1ULL << (seq - base);
+            ++seg->tries;
+            seg->when = now + MCAST_NACK_RETRY;
+        }
+
+        if (sub->nack_at == 0 || seg->when < sub->nack_at) {
+            sub->nack_at = seg->when;
+        }
+    }
+
+    if (map != 0) {
+        sub_nack(sub, base, map);
+    }
+
+    sub_advance(sub);
+}
+
+/*
+ * Someone else asked for segments, do not ask for the
+ * same ones until the repair had a chance to arrive
+ */
+static void
+sub_suppress(struct onet_sub *sub, const struct onet_mcast_hdr *h)
+{
+    struct mcast_seg *seg;
+    uint64_t map, when;
+    uint32_t seq;
+
+    when = mcast_now() + MCAST_NACK_RETRY;
+    seq = ntohl(h->seq);
+    for (map = be64toh(h->map); map != 0; map >>= 1, ++seq) {
+        if (!(map & 1) || SEQ_LT(seq, sub->rcv_nxt) ||
+            !SEQ_LT(seq, sub->rx_top)) {
+            continue;
+        }
+
+        seg = &sub->segs[seq & SUB_MASK];
+        if (!(seg->state & (SEG_HAVE | SEG_LOST)) && seg->when < when) {
+            ++seg->tries;
+            seg->when = when;
+        }
+    }
+}
+
+/*
+ * Get the lost segments of a FEC group back if enough
+ * repair blocks are in
+ */
+static void
+sub_fec_decode(struct onet_sub *sub, struct mcast_fec *fec)
+{
+    const uint8_t *par[FEC_R_MAX];
+    uint8_t *src[FEC_K_MAX], *p;
+    struct mcast_seg *seg;
+    uint64_t have = 0;
+    uint32_t i, j, seq, nlost = 0;
+    uint16_t len;
+
+    /* Some of the group has been written over since */
+    if (SEQ_LT(fec->base, sub->rx_top - ONET_SUB_WND)) {
+        fec->used = false;
+        return;
+    }
+
+    for (i = 0; i < fec->k; ++i) {
+        seq = fec->base + i;
+        seg = &sub->segs[seq & SUB_MASK];
+        src[i] = sub->fec_tmp + i * (MCAST_FEC_PREFIX + sub->mss);
+        if (!(seg->state & (SEG_HAVE | SEG_READ))) {
+            ++nlost;
+            continue;
+        }
+
+        if (MCAST_FEC_PREFIX + seg->len > fec->len) {
+            fec->used = false;
+            return;
+        }
+
+        have |= 1ULL << i;
+        p = src[i];
+        p[0] = seg->len >> 8;
+        p[1] = seg->len & 0xFF;
+        p[2] = seg->flags >> 8;
+        p[3] = seg->flags & 0xFF;
+        memcpy(p + MCAST_FEC_PREFIX, sub_data(sub, seq), seg->len);
+        memset(
+            p + MCAST_FEC_PREFIX + seg->len, 0,
+            fec->len - MCAST_FEC_PREFIX - seg->len
+        );
+    }
+
+    if (nlost == 0) {
+        fec->used = false;
+        return;
+    }
+
+    if (nlost > (uint32_t)__builtin_popcountll(fec->have)) {
+        return;
+    }
+
+    for (j = 0; j < fec->r; ++j) {
+        par[j] = fec->par + j * (MCAST_FEC_PREFIX + sub->mss);
+    }
+
+    if (fec_decode(fec->k, fec->r, src, have, par, fec->have, fec->len) < 0) {
+        return;
+    }
+
+    for (i = 0; i < fec->k; ++i) {
+        if (have & (1ULL << i)) {
+            continue;
+        }
+
+        p = src[i];
+        len = p[0] << 8 | p[1];
+        if (MCAST_FEC_PREFIX + len > fec->len) {
+            continue;
+        }
+
+        seq = fec->base + i;
+        if (SEQ_LT(seq, sub->rx_read)) {
+            continue;
+        }
+
+        seg = &sub->segs[seq & SUB_MASK];
+        memcpy(sub_data(sub, seq), p + MCAST_FEC_PREFIX, len);
+        seg->len = len;
+        seg->flags = p[2] << 8 | p[3];
+        seg->state = SEG_HAVE;
+        ++sub->recovered;
+    }
+
+    fec->used = false;
+    sub_advance(sub);
+}
+
+/*
+ * Take in a repair block of a FEC group
+ */
+static void
+sub_fec_input(struct onet_sub *sub, const struct onet_mcast_hdr *h,
+              uint32_t len)
+{
+    struct mcast_fec *fec, *res = NULL;
+    uint32_t base, k, r, idx, i;
+    uint64_t map;
+    uint8_t *par;
+
+    map = be64toh(h->map);
+    base = ntohl(h->seq);
+    k = map & 0xFF;
+    r = (map >> 8) & 0xFF;
+    idx = (map >> 16) & 0xFF;
+    if (k == 0 || k > FEC_K_MAX || r > FEC_R_MAX || idx >= r ||
+        len < MCAST_FEC_PREFIX || len > MCAST_FEC_PREFIX + sub->mss) {
+        return;
+    }
+
+    /* All of it was read already, or too far ahead to hold on to */
+    if (SEQ_LEQ(base + k, sub->rx_read) ||
+        SEQ_LT(sub->rx_read + ONET_SUB_WND, base + k)) {
+        return;
+    }
+
+    sub->fec_seen = true;
+    sub_extend(sub, base + k);
+
+    /* Find the group, or make room for it */
+    for (i = 0; i < ONET_SUB_FEC; ++i) {
+        fec = &sub->fec[i];
+        if (fec->used && fec->base == base) {
+            res = fec;
+            break;
+        }
+
+        if (!fec->used || SEQ_LEQ(fec->base + fec->k, sub->rx_read)) {
+            if (res == NULL || res->used) {
+                res = fec;
+            }
+        } else if (res == NULL ||
+                   (res->used && SEQ_LT(fec->base, res->base))) {
+            res = fec;
+        }
+    }
+
+    fec = res;
+    if (!fec->used || fec->base != base || fec->k != k || fec->r != r ||
+        fec->len != len) {
+        if (fec->cap < r) {
+            par = realloc(fec->par, r * (MCAST_FEC_PREFIX + sub->mss));
+            if (par == NULL) {
+                fec->used = false;
+                return;
+            }
+            fec->par = par;
+            fec->cap = r;
+        }
+
+        fec->used = true;
+        fec->base = base;
+        fec->k = k;
+        fec->r = r;
+        fec->len = len;
+        fec->have = 0;
+    }
+
+    memcpy(fec->par + idx * (MCAST_FEC_PREFIX + sub->mss), h + 1, len);
+    fec->have |= 1ULL << idx;
+    sub_fec_decode(sub, fec);
+}
+
+static void
+sub_input(struct onet_sub *sub, const struct dgram_slot *slot)
+{
+    const struct onet_dgram *hdr = DGRAM_HDR(slot->p);
+    const struct onet_mcast_hdr *h;
+    struct mcast_seg *seg;
+    mac_addr_t src;
+    uint32_t len, seq, session;
+    uint16_t flags;
+
+    if ((h = mcast_frame(slot, &len, &src)) == NULL) {
+        return;
+    }
+
+    session = ntohl(h->session);
+    if (hdr->type == OTYPE_MNACK) {
+        if (sub->synced && session == sub->session &&
+            src != sub->link->hwaddr) {
+            sub_suppress(sub, h);
+        }
+        return;
+    }
+
+    if (sub->pub != MAC_BROADCAST && src != sub->pub) {
+        return;
+    }
+
+    if (hdr->type == OTYPE_MFEC) {
+        if (sub->synced && session == sub->session) {
+            sub_fec_input(sub, h, len);
+        }
+        return;
+    }
+
+    if (hdr->type != OTYPE_MDATA || len > sub->mss) {
+        return;
+    }
+
+    seq = ntohl(h->seq);
+    flags = ntohs(h->flags);
+
+    /* First word from the publisher (or it restarted), join in here */
+    if (!sub->synced || session != sub->session) {
+        memset(sub->segs, 0, ONET_SUB_WND * sizeof(*sub->segs));
+        sub->pub = src;
+        sub->session = session;
+        sub->rcv_nxt = seq;
+        sub->rx_read = seq;
+        sub->rx_top = seq;
+        sub->rx_off = 0;
+        sub->nack_at = 0;
+        sub->synced = true;
+    }
+
+    if (flags & MCAST_F_HB) {
+        sub_extend(sub, seq);
+    } else if (!SEQ_LT(seq, sub->rcv_nxt) &&
+               SEQ_LT(seq, sub->rx_read + ONET_SUB_WND)) {
+        sub_extend(sub, seq + 1);
+        seg = &sub->segs[seq & SUB_MASK];
+        if (!(seg->state & (SEG_HAVE | SEG_LOST))) {
+            memcpy(sub_data(sub, seq), h + 1, len);
+            seg->len = len;
+            seg->flags = flags;
+            seg->state = SEG_HAVE;
+        }
+    }
+
+    sub_forget(sub, ntohl(h->lo));
+}
+
+static int
+sub_pump(struct onet_sub *sub, int timeout)
+{
+    struct dgram_slot slot;
+    int error, n = 0;
+
+    error = dgram_port_wait(
+        sub->link, sub->rxq, &slot,
+        mcast_wait(sub->nack_at, timeout)
+    );
+
+    while (error == 0) {
+        sub_input(sub, &slot);
+        dgram_frame_put(sub->link, slot.p);
+        if (++n == MCAST_DRAIN) {
+            break;
+        }
+
+        error = dgram_port_wait(sub->link, sub->rxq, &slot, 0);
+    }
+
+    if (error < 0 && error != -EAGAIN) {
+        return error;
+    }
+
+    if (sub->nack_at != 0 && mcast_now() >= sub->nack_at) {
+        sub_nack_round(sub);
+    }
+
+    return 0;
+}
+
+int
+onet_sub_open(struct onet_link *link, mac_addr_t group, mac_addr_t pub,
+              uint8_t port, struct onet_sub *res)
+{
+    int error;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->link = link;
+    res->group = group;
+    res->pub = pub;
+    res->port = port;
+    res->mss = link->mtu - sizeof(struct onet_dgram) -
+        sizeof(struct onet_mcast_hdr);
+
+    res->arena = malloc((size_t)ONET_SUB_WND * res->mss);
+    res->segs = calloc(ONET_SUB_WND, sizeof(*res->segs));
+    res->fec = calloc(ONET_SUB_FEC, sizeof(*res->fec));
+    res->fec_tmp = malloc(FEC_K_MAX * (MCAST_FEC_PREFIX + res->mss));
+    if (res->arena == NULL || res->segs == NULL || res->fec == NULL ||
+        res->fec_tmp == NULL) {
+        error = -ENOMEM;
+        goto fail;
+    }
+
+    if ((error = dgram_bind(link, port, 2 * ONET_SUB_WND)) < 0) {
+        goto fail;
+    }
+
+    if ((error = mcast_join(link, group)) < 0) {
+        dgram_unbind(link, port);
+        goto fail;
+    }
+
+    res->rxq = link->ports[port];
+    res->rand = (uint32_t)mcast_now() ^ (uint32_t)link->hwaddr;
+    if (res->rand == 0) {
+        res->rand = 1;
+    }
+    return 0;
+fail:
+    free(res->arena);
+    free(res->segs);
+    free(res->fec);
+    free(res->fec_tmp);
+    memset(res, 0, sizeof(*res));
+    return error;
+}
+
+void
+onet_sub_close(struct onet_sub *sub)
+{
+    uint32_t i;
+
+    if (sub == NULL || sub->link == NULL) {
+        return;
+    }
+
+    mcast_leave(sub->link, sub->group);
+    dgram_unbind(sub->link, sub->port);
+    for (i = 0; i < ONET_SUB_FEC; ++i) {
+        free(sub->fec[i].par);
+    }
+
+    free(sub->arena);
+    free(sub->segs);
+    free(sub->fec);
+    free(sub->fec_tmp);
+    memset(sub, 0, sizeof(*sub));
+}
+
+rx_len_t
+onet_sub_recv(struct onet_sub *sub, void *buf, uint32_t len, int timeout)
+{
+    struct mcast_seg *seg;
+    int64_t deadline;
+    uint32_t copied = 0, n;
+    bool end;
+    int error, left;
+
+    if (sub == NULL || (buf == NULL && len > 0)) {
+        return -EINVAL;
+    }
+
+    deadline = dgram_deadline(timeout);
+    for (;;) {
+        end = false;
+        while (SEQ_LT(sub->rx_read, sub->rcv_nxt) && !end && copied < len) {
+            seg = &sub->segs[sub->rx_read & SUB_MASK];
+
+            /* Hand over what we have first, then own up to the hole */
+            if (seg->state & SEG_LOST) {
+                if (copied > 0) {
+                    return copied;
+                }
+
+                seg->state = 0;
+                sub->rx_off = 0;
+                ++sub->rx_read;
+                ++sub->lost;
+                return -ENODATA;
+            }
+
+            n = seg->len - sub->rx_off;
+            if (n > len - copied) {
+                n = len - copied;
+            }
+
+            memcpy(
+                (char *)buf + copied,
+                sub_data(sub, sub->rx_read) + sub->rx_off, n
+            );
+            copied += n;
+            sub->rx_off += n;
+            if (sub->rx_off < seg->len) {
+                break;
+            }
+
+            end = (seg->flags & MCAST_F_END) != 0;
+            seg->state = SEG_READ;
+            sub->rx_off = 0;
+            ++sub->rx_read;
+        }
+
+        if (end || copied == len) {
+            return copied;
+        }
+
+        if ((left = dgram_remaining(deadline)) == 0) {
+            return (copied > 0) ? (rx_len_t)copied : -EAGAIN;
+        }
+
+        if ((error = sub_pump(sub, left)) < 0) {
+            return error;
+        }
+    }
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "if_ether.h"
+#include "neigh.h"
+#include "dgram_var.h"
+
+/* Slots looked at for a given neighbor */
+#define NEIGH_PROBE 8
+
+/* Time (in ms) before the same neighbor is answered again */
+#define NEIGH_HOLDOFF 100
+
+/*
+ * Represents a slot of the neighbor table
+ *
+ * @used: Slot is in use
+ * @info: The neighbor
+ * @reply_at: When it may be answered again
+ */
+struct neigh_ent {
+    bool used;
+    struct onet_neigh info;
+    int64_t reply_at;
+};
+
+/*
+ * Represents the neighbor table of a link. Squeaks are
+ * answered out of a token bucket holding `burst' tokens
+ * and refilled at `rate' tokens per second, tokens are
+ * counted in thousandths.
+ *
+ * @lock: Held while the table is used
+ * @ttl: Time neighbors are kept for (ms)
+ * @rate: Tokens added per second
+ * @burst: Most tokens the bucket holds
+ * @tokens: Tokens in the bucket (thousandths)
+ * @refill_at: When tokens were last added
+ * @ent: Neighbors, hashed by address
+ */
+struct onet_neigh_tab {
+    uint8_t lock;
+    uint32_t ttl;
+    uint32_t rate;
+    uint32_t burst;
+    uint64_t tokens;
+    int64_t refill_at;
+    struct neigh_ent ent[ONET_NEIGH_MAX];
+};
+
+static inline void
+neigh_lock(struct onet_neigh_tab *tab)
+{
+    while (__atomic_test_and_set(&tab->lock, __ATOMIC_ACQUIRE)) {
+        continue;
+    }
+}
+
+static inline void
+neigh_unlock(struct onet_neigh_tab *tab)
+{
+    __atomic_clear(&tab->lock, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+neigh_hash(mac_addr_t addr)
+{
+    return (addr * 0x9E3779B97F4A7C15ULL) >> 56;
+}
+
+static inline bool
+neigh_live(const struct onet_neigh_tab *tab, const struct neigh_ent *ent,
+           int64_t now)
+{
+    return ent->used && ent->info.last_seen + tab->ttl > now;
+}
+
+/*
+ * Get the neighbor table of a link, setting it up
+ * on first use
+ */
+static struct onet_neigh_tab *
+neigh_get(struct onet_link *link)
+{
+    struct onet_neigh_tab *tab, *cur = NULL;
+
+    tab = __atomic_load_n(&link->neigh, __ATOMIC_ACQUIRE);
+    if (tab != NULL) {
+        return tab;
+    }
+
+    if ((tab = calloc(1, sizeof(*tab))) == NULL) {
+        return NULL;
+    }
+
+    tab->ttl = ONET_NEIGH_TTL;
+    tab->rate = ONET_SQUEAK_RATE;
+    tab->burst = ONET_SQUEAK_BURST;
+    tab->tokens = ONET_SQUEAK_BURST * 1000ULL;
+    tab->refill_at = dgram_deadline(0);
+
+    /* Someone else may have beaten us to it */
+    if (!__atomic_compare_exchange_n(&link->neigh, &cur, tab, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(tab);
+        return cur;
+    }
+
+    return tab;
+}
+
+/*
+ * Find the slot of a neighbor
+ *
+ * @tab: Table to look in
+ * @addr: Address of the neighbor
+ * @now: Current time (ms)
+ * @add: Take a free (or expired, or else the least
+ *       recently seen) slot if it has none
+ *
+ * Returns NULL if it has none and `add' is false.
+ */
+static struct neigh_ent *
+neigh_find(struct onet_neigh_tab *tab, mac_addr_t addr, int64_t now,
+           bool add)
+{
+    struct neigh_ent *ent, *victim = NULL;
+    uint32_t h, i;
+
+    h = neigh_hash(addr);
+    for (i = 0; i < NEIGH_PROBE; ++i) {
+        ent = &tab->ent[(h + i) & (ONET_NEIGH_MAX - 1)];
+        if (ent->used && ent->info.addr == addr) {
+            if (neigh_live(tab, ent, now)) {
+                return ent;
+            }
+
+            /* Forgotten, it starts over if heard again */
+            victim = ent;
+            break;
+        }
+
+        if (!neigh_live(tab, ent, now)) {
+            if (victim == NULL || neigh_live(tab, victim, now)) {
+                victim = ent;
+            }
+        } else if (victim == NULL || (neigh_live(tab, victim, now) &&
+                   ent->info.last_seen < victim->info.last_seen)) {
+            victim = ent;
+        }
+    }
+
+    if (!add) {
+        return NULL;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->used = true;
+    victim->info.addr = addr;
+    victim->info.first_seen = now;
+    return victim;
+}
+
+/*
+ * Take a token out of the bucket if there is one
+ */
+static bool
+neigh_take(struct onet_neigh_tab *tab, int64_t now)
+{
+    uint64_t max = tab->burst * 1000ULL;
+
+    if (now > tab->refill_at) {
+        tab->tokens += (uint64_t)(now - tab->refill_at) * tab->rate;
+        if (tab->tokens > max) {
+            tab->tokens = max;
+        }
+        tab->refill_at = now;
+    }
+
+    if (tab->tokens < 1000) {
+        return false;
+    }
+
+    tab->tokens -= 1000;
+    return true;
+}
+
+static void
+neigh_export(const struct onet_neigh_tab *tab, const struct neigh_ent *ent,
+             struct onet_neigh *res)
+{
+    *res = ent->info;
+    res->expire = ent->info.last_seen + tab->ttl;
+}
+
+bool
+dgram_neigh_input(struct onet_link *link, mac_addr_t src, bool ask)
+{
+    struct onet_neigh_tab *tab;
+    struct neigh_ent *ent;
+    int64_t now;
+    bool answer = false;
+
+    if ((tab = neigh_get(link)) == NULL) {
+        return false;
+    }
+
+    now = dgram_deadline(0);
+    neigh_lock(tab);
+    ent = neigh_find(tab, src, now, true);
+    ent->info.last_seen = now;
+    ++ent->info.squeaks;
+
+    /* Answer each neighbor once in a while, and only so many overall */
+    if (ask && now >= ent->reply_at && neigh_take(tab, now)) {
+        ent->reply_at = now + NEIGH_HOLDOFF;
+        answer = true;
+    }
+
+    neigh_unlock(tab);
+    return answer;
+}
+
+int
+onet_neigh_lookup(struct onet_link *link, mac_addr_t addr,
+                  struct onet_neigh *res)
+{
+    struct onet_neigh_tab *tab;
+    struct neigh_ent *ent;
+    int64_t now;
+    int error = -ENOENT;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    tab = __atomic_load_n(&link->neigh, __ATOMIC_ACQUIRE);
+    if (tab == NULL) {
+        return -ENOENT;
+    }
+
+    now = dgram_deadline(0);
+    neigh_lock(tab);
+    ent = neigh_find(tab, addr, now, false);
+    if (ent != NULL && neigh_live(tab, ent, now)) {
+        neigh_export(tab, ent, res);
+        error = 0;
+    }
+
+    neigh_unlock(tab);
+    return error;
+}
+
+int
+onet_neigh_list(struct onet_link *link, struct onet_neigh *res,
+                uint32_t max)
+{
+    struct onet_neigh_tab *tab;
+    struct neigh_ent *ent;
+    uint32_t i, n = 0;
+    int64_t now;
+
+    if (link == NULL || (res == NULL && max > 0)) {
+        return -EINVAL;
+    }
+
+    tab = __atomic_load_n(&link->neigh, __ATOMIC_ACQUIRE);
+    if (tab == NULL) {
+        return 0;
+    }
+
+    now = dgram_deadline(0);
+    neigh_lock(tab);
+    for (i = 0; i < ONET_NEIGH_MAX && n < max; ++i) {
+        ent = &tab->ent[i];
+        if (neigh_live(tab, ent, now)) {
+            neigh_export(tab, ent, &res[n++]);
+        }
+    }
+
+    neigh_unlock(tab);
+    return n;
+}
+
+int
+onet_neigh_ttl(struct onet_link *link, uint32_t ttl)
+{
+    struct onet_neigh_tab *tab;
+
+    if (link == NULL || ttl == 0) {
+        return -EINVAL;
+    }
+
+    if ((tab = neigh_get(link)) == NULL) {
+        return -ENOMEM;
+    }
+
+    neigh_lock(tab);
+    tab->ttl = ttl;
+    neigh_unlock(tab);
+    return 0;
+}
+
+int
+onet_squeak_limit(struct onet_link *link, uint32_t rate, uint32_t burst)
+{
+    struct onet_neigh_tab *tab;
+
+    if (link == NULL || (rate > 0 && burst == 0)) {
+        return -EINVAL;
+    }
+
+    if ((tab = neigh_get(link)) == NULL) {
+        return -ENOMEM;
+    }
+
+    neigh_lock(tab);
+    tab->rate = rate;
+    tab->burst = burst;
+    if (tab->tokens > burst * 1000ULL) {
+        tab->tokens = burst * 1000ULL;
+    }
+
+    neigh_unlock(tab);
+    return 0;
+}
+
+void
+onet_neigh_free(struct onet_link *link)
+{
+    free(link->neigh);
+    link->neigh = NULL;
+}
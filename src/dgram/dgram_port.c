@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/futex.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "dgram_var.h"
+
+/*
+ * Default port queue depth
+ */
+#define PORT_DEPTH 256
+
+/*
+ * How long (in ms) the demultiplexing thread waits on
+ * the wire before checking if someone wants the link
+ * lock (see dgram_unbind()).
+ */
+#define PORT_POLL_MS 100
+
+/*
+ * States of the link RX lock
+ */
+#define RXL_FREE      0
+#define RXL_HELD      1
+#define RXL_CONTENDED 2
+
+static inline void
+futex_wait(uint32_t *uaddr, uint32_t val, int timeout)
+{
+    struct timespec ts, *tsp = NULL;
+
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        tsp = &ts;
+    }
+
+    syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, tsp, NULL, 0);
+}
+
+static inline void
+futex_wake(uint32_t *uaddr, int count)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Try to become the thread demultiplexing a link
+ *
+ * Returns true on success.
+ */
+static inline bool
+rx_trylock(struct onet_link *link)
+{
+    uint32_t expected = RXL_FREE;
+
+    return __atomic_compare_exchange_n(
+        &link->rx_lock, &expected, RXL_HELD,
+        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED
+    );
+}
+
+/*
+ * Wait for a link RX lock, this may take up to
+ * PORT_POLL_MS if a frame is not received.
+ */
+static void
+rx_lock(struct onet_link *link)
+{
+    if (rx_trylock(link)) {
+        return;
+    }
+
+    while (__atomic_exchange_n(&link->rx_lock, RXL_CONTENDED,
+                               __ATOMIC_ACQUIRE) != RXL_FREE) {
+        futex_wait(&link->rx_lock, RXL_CONTENDED, -1);
+    }
+}
+
+/*
+ * Poke a port so its consumer takes another look
+ * at the queue and the link lock.
+ */
+static inline void
+port_wake(struct onet_port *port)
+{
+    __atomic_add_fetch(&port->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&port->waiting, __ATOMIC_SEQ_CST)) {
+        futex_wake(&port->seq, 1);
+    }
+}
+
+/*
+ * Release a link RX lock and wake up every consumer
+ * so one of them may take over.
+ */
+static void
+rx_unlock(struct onet_link *link)
+{
+    struct onet_port *port;
+    size_t i;
+
+    if (__atomic_exchange_n(&link->rx_lock, RXL_FREE,
+                            __ATOMIC_SEQ_CST) == RXL_CONTENDED) {
+        futex_wake(&link->rx_lock, 1);
+    }
+
+    for (i = 0; i < ONET_PORT_MAX; ++i) {
+        port = __atomic_load_n(&link->ports[i], __ATOMIC_ACQUIRE);
+        if (port != NULL) {
+            port_wake(port);
+        }
+    }
+
+    if (link->port_any != NULL) {
+        port_wake(link->port_any);
+    }
+}
+
+static struct onet_port *
+port_alloc(uint32_t depth)
+{
+    struct onet_port *port;
+    uint32_t n = 1;
+
+    while (n < depth) {
+        n <<= 1;
+    }
+
+    port = aligned_alloc(64, sizeof(*port));
+    if (port == NULL) {
+        return NULL;
+    }
+
+    memset(port, 0, sizeof(*port));
+    port->slots = calloc(n, sizeof(*port->slots));
+    if (port->slots == NULL) {
+        free(port);
+        return NULL;
+    }
+
+    port->mask = n - 1;
+    return port;
+}
+
+/*
+ * Drop whatever is left in a port queue and free it
+ */
+static void
+port_free(struct onet_link *link, struct onet_port *port)
+{
+    while (port->head != port->tail) {
+        dgram_frame_put(link, port->slots[port->head & port->mask].p);
+        ++port->head;
+    }
+
+    free(port->slots);
+    free(port);
+}
+
+/*
+ * Put a frame on a port queue (producer side)
+ *
+ * Returns true if the frame was queued, false if the
+ * queue is full.
+ */
+static bool
+port_push(struct onet_port *port, char *p, uint32_t len)
+{
+    uint32_t head, tail;
+
+    tail = port->tail;
+    head = __atomic_load_n(&port->head, __ATOMIC_ACQUIRE);
+    if (tail - head > port->mask) {
+        return false;
+    }
+
+    port->slots[tail & port->mask].p = p;
+    port->slots[tail & port->mask].len = len;
+    __atomic_store_n(&port->tail, tail + 1, __ATOMIC_RELEASE);
+    port_wake(port);
+    return true;
+}
+
+/*
+ * Take a frame off a port queue (consumer side)
+ *
+ * Returns true if a frame was dequeued.
+ */
+static bool
+port_pop(struct onet_port *port, struct dgram_slot *res)
+{
+    uint32_t head, tail;
+
+    head = port->head;
+    tail = __atomic_load_n(&port->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+
+    *res = port->slots[head & port->mask];
+    __atomic_store_n(&port->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Receive a single frame off the wire and queue it on
+ * the port it was sent to. Must be called with the link
+ * RX lock held.
+ *
+ * @link: Link to read
+ * @timeout: How long to wait for a frame in ms
+ *
+ * Returns one if a frame was handled, zero if the wait
+ * timed out, otherwise a less than zero value on failure.
+ */
+static int
+port_demux(struct onet_link *link, int timeout)
+{
+    const struct onet_dgram *hdr;
+    struct onet_port *port;
+    size_t frame_len, len;
+    ssize_t recv_len;
+    char *p, *frame;
+
+    frame_len = sizeof(struct ether_hdr) + link->mtu;
+    p = dgram_frame_get(link, frame_len);
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+
+    /* RX ring frames go back to the kernel, take a copy */
+    if (dgram_rx_mapped(link)) {
+        frame = dgram_rx_next(link, &len, timeout);
+        if (frame == NULL) {
+            dgram_frame_put(link, p);
+            return (errno == EAGAIN) ? 0 : -errno;
+        }
+
+        if (len > frame_len) {
+            len = frame_len;
+        }
+        memcpy(p, frame, len);
+    } else {
+        recv_len = link->tp->recv(link, p, frame_len, timeout);
+        if (recv_len < 0) {
+            dgram_frame_put(link, p);
+            return (recv_len == -EAGAIN) ? 0 : recv_len;
+        }
+        len = recv_len;
+    }
+
+    if (!dgram_accept(link, p, DGRAM_DATA(p), len)) {
+        dgram_frame_put(link, p);
+        return 1;
+    }
+
+    len = dgram_frame_len(p);
+
+    /* Queue fragments up once they make a whole datagram */
+    if (DGRAM_IS_FRAG((struct onet_dgram *)DGRAM_HDR(p))) {
+        frame = dgram_reasm(link, p, DGRAM_DATA(p), len, &len);
+        dgram_frame_put(link, p);
+        if ((p = frame) == NULL) {
+            return 1;
+        }
+    }
+
+    hdr = DGRAM_HDR(p);
+    port = __atomic_load_n(&link->ports[hdr->port], __ATOMIC_ACQUIRE);
+    if (port == NULL) {
+        /* Channel traffic nobody is bound for, drop it */
+        if (hdr->type != OTYPE_DATA) {
+            dgram_frame_put(link, p);
+            return 1;
+        }
+
+        port = link->port_any;
+    }
+
+    /* Nobody is keeping up with this port, drop it */
+    if (!port_push(port, p, len)) {
+        dgram_frame_put(link, p);
+    }
+
+    return 1;
+}
+
+int
+dgram_port_wait(struct onet_link *link, struct onet_port *port,
+                struct dgram_slot *res, int timeout)
+{
+    int64_t deadline = dgram_deadline(timeout);
+    uint32_t seq;
+    int error, left;
+
+    for (;;) {
+        seq = __atomic_load_n(&port->seq, __ATOMIC_SEQ_CST);
+        if (port_pop(port, res)) {
+            return 0;
+        }
+
+        /*
+         * Nothing queued for us. If no one is reading the
+         * wire, do it ourselves until something turns up,
+         * stepping aside if someone wants the lock.
+         */
+        if (rx_trylock(link)) {
+            error = 0;
+            while (!port_pop(port, res)) {
+                if (__atomic_load_n(&link->rx_lock, __ATOMIC_RELAXED)
+                        == RXL_CONTENDED) {
+                    error = -EBUSY;
+                    break;
+                }
+
+                left = dgram_remaining(deadline);
+                if (left < 0 || left > PORT_POLL_MS) {
+                    left = PORT_POLL_MS;
+                }
+
+                if ((error = port_demux(link, left)) < 0) {
+                    break;
+                }
+
+                if (error == 0 && dgram_remaining(deadline) == 0) {
+                    error = -EAGAIN;
+                    break;
+                }
+
+                error = 0;
+            }
+
+            rx_unlock(link);
+            if (error != -EBUSY) {
+                return error;
+            }
+
+            continue;
+        }
+
+        if ((left = dgram_remaining(deadline)) == 0) {
+            return -EAGAIN;
+        }
+
+        __atomic_store_n(&port->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&port->seq, __ATOMIC_SEQ_CST) == seq) {
+            futex_wait(&port->seq, seq, left);
+        }
+        __atomic_store_n(&port->waiting, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+int
+dgram_bind(struct onet_link *link, uint8_t port, uint32_t depth)
+{
+    struct onet_port *res;
+    int error = 0;
+
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    if (depth == 0) {
+        depth = PORT_DEPTH;
+    }
+
+    if (depth > (1U << 20)) {
+        return -EINVAL;
+    }
+
+    rx_lock(link);
+    if (link->ports[port] != NULL) {
+        error = -EADDRINUSE;
+        goto done;
+    }
+
+    /* Frames to unbound ports need somewhere to go */
+    if (link->port_any == NULL) {
+        link->port_any = port_alloc(PORT_DEPTH);
+        if (link->port_any == NULL) {
+            error = -ENOMEM;
+            goto done;
+        }
+    }
+
+    if ((res = port_alloc(depth)) == NULL) {
+        error = -ENOMEM;
+        goto done;
+    }
+
+    __atomic_store_n(&link->ports[port], res, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&link->nports, 1, __ATOMIC_RELEASE);
+done:
+    rx_unlock(link);
+    return error;
+}
+
+int
+dgram_unbind(struct onet_link *link, uint8_t port)
+{
+    struct onet_port *res;
+
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    rx_lock(link);
+    if ((res = link->ports[port]) == NULL) {
+        rx_unlock(link);
+        return -ENOENT;
+    }
+
+    __atomic_store_n(&link->ports[port], NULL, __ATOMIC_RELEASE);
+
+    /*
+     * Last one out, dgram_recv() goes back to the wire. The
+     * port_any queue stays, a dgram_recv() that saw nports
+     * before we dropped it may still be waiting on it; it
+     * lives until onet_close().
+     */
+    __atomic_sub_fetch(&link->nports, 1, __ATOMIC_RELEASE);
+
+    rx_unlock(link);
+    port_free(link, res);
+    return 0;
+}
+
+void
+onet_port_free(struct onet_link *link)
+{
+    size_t i;
+
+    for (i = 0; i < ONET_PORT_MAX; ++i) {
+        if (link->ports[i] != NULL) {
+            port_free(link, link->ports[i]);
+            link->ports[i] = NULL;
+        }
+    }
+
+    if (link->port_any != NULL) {
+        port_free(link, link->port_any);
+        link->port_any = NULL;
+    }
+
+    link->nports = 0;
+}
+
+rx_len_t
+dgram_port_recv(struct onet_link *link, uint8_t port, void *buf,
+                uint32_t len, mac_addr_t *src)
+{
+    const struct ether_hdr *hdr;
+    struct onet_port *res;
+    struct dgram_slot slot;
+    size_t data_len;
+    int error;
+
+    if (link == NULL || buf == NULL) {
+        return -EINVAL;
+    }
+
+    res = __atomic_load_n(&link->ports[port], __ATOMIC_ACQUIRE);
+    if (res == NULL) {
+        return -ENOTCONN;
+    }
+
+    error = dgram_port_wait(link, res, &slot, dgram_rx_timeout(link));
+    if (error < 0) {
+        return error;
+    }
+
+    data_len = slot.len - DGRAM_LEN(0);
+    if (data_len > len) {
+        data_len = len;
+    }
+
+    hdr = (const void *)slot.p;
+    if (src != NULL) {
+        *src = mac_swap((void *)hdr->source);
+    }
+
+    memcpy(buf, DGRAM_DATA(slot.p), data_len);
+    dgram_frame_put(link, slot.p);
+    return data_len;
+}
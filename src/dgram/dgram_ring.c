@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "dgram_var.h"
+
+/*
+ * Offset of the frame from the start of a TPACKET_V3
+ * TX ring slot.
+ */
+#define TX_DATA_OFF (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+/*
+ * Get a TX ring slot by index
+ */
+static inline struct tpacket3_hdr *
+tx_frame(struct onet_ring *ring, uint32_t idx)
+{
+    return (void *)(ring->base + (size_t)idx * ring->frame_size);
+}
+
+/*
+ * Returns true if a TX ring slot may be written to
+ */
+static inline bool
+tx_frame_free(struct tpacket3_hdr *hdr)
+{
+    uint32_t status;
+
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    return status == TP_STATUS_AVAILABLE ||
+        status == TP_STATUS_WRONG_FORMAT;
+}
+
+/*
+ * Get an RX ring block by index
+ */
+static inline struct tpacket_block_desc *
+rx_block(struct onet_ring *ring, uint32_t idx)
+{
+    return (void *)(ring->base + (size_t)idx * ring->block_size);
+}
+
+char *
+dgram_rx_next(struct onet_link *link, size_t *len, int timeout)
+{
+    struct onet_ring *ring = &link->rx_ring;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *hdr;
+    struct pollfd pfd;
+    uint32_t status;
+
+    if (link->xsk != NULL) {
+        return dgram_xsk_next(link, len, timeout);
+    }
+
+    for (;;) {
+        bd = rx_block(ring, ring->head);
+
+        /* Done with this block? Hand it back to the kernel */
+        if (ring->cur != NULL && ring->cur_left == 0) {
+            __atomic_store_n(
+                &bd->hdr.bh1.block_status,
+                TP_STATUS_KERNEL, __ATOMIC_RELEASE
+            );
+
+            ring->head = (ring->head + 1) % ring->block_nr;
+            ring->cur = NULL;
+            continue;
+        }
+
+        if (ring->cur != NULL) {
+            break;
+        }
+
+        status = __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+        if ((status & TP_STATUS_USER) == 0) {
+            pfd.fd = link->sockfd;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+            switch (poll(&pfd, 1, timeout)) {
+            case -1:
+                if (errno != EINTR) {
+                    return NULL;
+                }
+                break;
+            case 0:
+                errno = EAGAIN;
+                return NULL;
+            }
+            continue;
+        }
+
+        ring->cur = (char *)bd + bd->hdr.bh1.offset_to_first_pkt;
+        ring->cur_left = bd->hdr.bh1.num_pkts;
+    }
+
+    hdr = (void *)ring->cur;
+    ring->cur += hdr->tp_next_offset;
+    ring->cur_left--;
+    *len = hdr->tp_snaplen;
+    return (char *)hdr + hdr->tp_mac;
+}
+
+char *
+dgram_tx_frame(struct onet_link *link, size_t len)
+{
+    struct onet_ring *ring = &link->tx_ring;
+    struct tpacket3_hdr *hdr;
+
+    if (len > ring->frame_size - TX_DATA_OFF) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    /*
+     * If the ring is full, push out whatever is pending and
+     * wait for the kernel to hand the slot back.
+     */
+    hdr = tx_frame(ring, ring->head);
+    if (!tx_frame_free(hdr)) {
+        dgram_tx_kick(link, 0);
+        if (!tx_frame_free(hdr)) {
+            errno = ENOBUFS;
+            return NULL;
+        }
+    }
+
+    hdr->tp_len = len;
+    hdr->tp_next_offset = 0;
+    return (char *)hdr + TX_DATA_OFF;
+}
+
+char *
+dgram_tx_slot(struct onet_link *link, struct dgram_params *params)
+{
+    char *p;
+
+    if ((p = dgram_tx_frame(link, DGRAM_LEN(params->len))) == NULL) {
+        return NULL;
+    }
+
+    dgram_build(link, params, p);
+    return DGRAM_DATA(p);
+}
+
+int
+dgram_tx_kick(struct onet_link *link, int flags)
+{
+    struct sockaddr_ll saddr;
+
+    dgram_sockaddr(link, &saddr);
+    return sendto(
+        link->sockfd, NULL, 0, flags,
+        (struct sockaddr *)&saddr, sizeof(saddr)
+    );
+}
+
+char *
+dgram_tx_begin(struct onet_link *link, mac_addr_t dst, uint16_t len)
+{
+    struct dgram_params params;
+    char *p;
+
+    if (link == NULL || link->tx_ring.base == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    params.dst = dst;
+    params.buf = NULL;
+    params.len = len;
+    params.type = OTYPE_DATA;
+    params.port = DGRAM_PORT_DEFAULT;
+    params.frag = 0;
+
+    /* Other senders wait until the slot is committed */
+    pthread_mutex_lock(&link->tx_lock);
+    if ((p = dgram_tx_slot(link, &params)) == NULL) {
+        pthread_mutex_unlock(&link->tx_lock);
+    }
+
+    return p;
+}
+
+void
+dgram_tx_push(struct onet_link *link)
+{
+    struct onet_ring *ring = &link->tx_ring;
+    struct tpacket3_hdr *hdr;
+
+    hdr = tx_frame(ring, ring->head);
+    dgram_stat_tx(link, hdr->tp_len, hdr->tp_len);
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    ring->head = (ring->head + 1) % ring->frame_nr;
+}
+
+int
+dgram_tx_commit(struct onet_link *link)
+{
+    struct onet_dgram *dgram;
+    char *p;
+
+    if (link == NULL || link->tx_ring.base == NULL) {
+        return -EINVAL;
+    }
+
+    /* The caller wrote the data in place, cover it now */
+    p = (char *)tx_frame(&link->tx_ring, link->tx_ring.head) + TX_DATA_OFF;
+    dgram = DGRAM_HDR(p);
+    dgram_seal(dgram, DGRAM_DATA(p), ntohs(dgram->length));
+    dgram_tx_push(link);
+    pthread_mutex_unlock(&link->tx_lock);
+    return 0;
+}
+
+int
+dgram_tx_flush(struct onet_link *link)
+{
+    if (link == NULL || link->tx_ring.base == NULL) {
+        return -EINVAL;
+    }
+
+    if (dgram_tx_kick(link, MSG_DONTWAIT) < 0) {
+        return (errno == EAGAIN) ? 0 : -errno;
+    }
+
+    return 0;
+}
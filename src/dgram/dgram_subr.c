@@ -28,23 +28,121 @@
  */
 
 #include <sys/errno.h>
+#include <netinet/in.h>
 #include <stdint.h>
 #include <string.h>
 #include "dgram.h"
 #include "crc.h"
+#include "dgram_var.h"
 
-int
-dgram_load(uint16_t length, uint8_t port, uint8_t type, struct onet_dgram *res)
+/*
+ * Initialize an ONET datagram header with flags set
+ *
+ * @length: Length of a packet to send
+ * @port: Port number to send on
+ * @type: Packet type (OTYPE_*)
+ * @flags: Datagram flags (DGRAM_F_*)
+ * @frag_id: Fragment ID (zero if not fragmented)
+ * @res: Result is written here
+ */
+static void
+dgram_load_flags(uint16_t length, uint8_t port, uint8_t type,
+                 uint16_t flags, uint16_t frag_id, struct onet_dgram *res)
 {
-    if (res == NULL) {
-        return -EINVAL;
-    }
-
     memset(res, 0, sizeof(*res));
     res->length = (length >> 8) & 0xFF;
     res->length |= (length & 0xFF) << 8;
+    res->frag_id = htons(frag_id);
     res->type = type;
+    res->flags = flags;
     res->port = port;
     res->crc32 = crc32(res, sizeof(*res) - sizeof(res->crc32));
+}
+
+int
+dgram_load(uint16_t length, uint8_t port, uint8_t type, struct onet_dgram *res)
+{
+    if (res == NULL) {
+        return -EINVAL;
+    }
+
+    dgram_load_flags(length, port, type, 0, 0, res);
     return 0;
 }
+
+void
+dgram_build(struct onet_link *link, struct dgram_params *params, char *p)
+{
+    uint16_t flags = params->frag & 0xFFFF;
+
+    if (link->flags & ONET_F_PCRC) {
+        flags |= DGRAM_F_PCRC;
+    }
+
+    ether_load_route(link->hwaddr, params->dst, (struct ether_hdr *)p);
+    dgram_load_flags(
+        params->len, params->port, params->type,
+        flags, params->frag >> 16, DGRAM_HDR(p)
+    );
+}
+
+void
+dgram_fill(char *p, const void *buf, uint16_t len)
+{
+    struct onet_dgram *hdr = DGRAM_HDR(p);
+
+    if (hdr->flags & DGRAM_F_PCRC) {
+        hdr->crc32 = crc32_copy(hdr->crc32, DGRAM_DATA(p), buf, len);
+    } else {
+        memcpy(DGRAM_DATA(p), buf, len);
+    }
+}
+
+void
+dgram_fill_iov(char *p, const struct iovec *iov, int iovcnt)
+{
+    struct onet_dgram *hdr = DGRAM_HDR(p);
+    char *data = DGRAM_DATA(p);
+    int i;
+
+    for (i = 0; i < iovcnt; ++i) {
+        if (hdr->flags & DGRAM_F_PCRC) {
+            hdr->crc32 = crc32_copy(
+                hdr->crc32, data,
+                iov[i].iov_base, iov[i].iov_len
+            );
+        } else {
+            memcpy(data, iov[i].iov_base, iov[i].iov_len);
+        }
+
+        data += iov[i].iov_len;
+    }
+}
+
+void
+dgram_seal(struct onet_dgram *hdr, const void *data, size_t len)
+{
+    if (hdr->flags & DGRAM_F_PCRC) {
+        hdr->crc32 = crc32_update(hdr->crc32, data, len);
+    }
+}
+
+bool
+dgram_crc_ok(const struct onet_dgram *hdr, const void *data, size_t len)
+{
+    uint32_t crc;
+    uint16_t length;
+
+    crc = crc32(hdr, sizeof(*hdr) - sizeof(crc));
+    if ((hdr->flags & DGRAM_F_PCRC) == 0) {
+        return crc == hdr->crc32;
+    }
+
+    /* The whole payload must be here to check it */
+    length = ntohs(hdr->length);
+    if (length > len) {
+        return false;
+    }
+
+    return crc32_update(crc, data, length) == hdr->crc32;
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "tstamp.h"
+#include "dgram_var.h"
+
+/* Stamps in the ts[] array of `struct scm_timestamping' */
+#define TS_SW 0
+#define TS_HW 2
+
+/*
+ * Timestamping state of a link
+ *
+ * @flags: Sources turned on (ONET_TS_*)
+ * @tx_lock: Held from sending a stamped frame until its
+ *           stamps are in
+ * @tx_key: ID the kernel gives the next stamped frame
+ * @hist: Latency histograms by direction and port
+ */
+struct onet_tstamp_state {
+    uint32_t flags;
+    pthread_mutex_t tx_lock;
+    uint32_t tx_key;
+    struct onet_ts_hist hist[2][ONET_PORT_MAX];
+};
+
+static int64_t
+ts_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Record a latency in a histogram
+ *
+ * @hist: Histogram to record it in
+ * @ns: Latency in ns (ignored if negative)
+ */
+static void
+ts_record(struct onet_ts_hist *hist, int64_t ns)
+{
+    uint64_t max;
+    uint32_t idx;
+
+    if (ns < 0) {
+        return;
+    }
+
+    idx = (ns == 0) ? 0 : 63 - __builtin_clzll(ns);
+    if (idx >= ONET_TS_BUCKETS) {
+        idx = ONET_TS_BUCKETS - 1;
+    }
+
+    __atomic_add_fetch(&hist->bucket[idx], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while ((uint64_t)ns > max &&
+           !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        continue;
+    }
+}
+
+/*
+ * Pull the stamps out of the control data of a message
+ *
+ * @mh: Message received
+ * @ts: Stamps found are written here
+ * @key: ID of the stamped frame is written here, if the
+ *       message comes off the error queue
+ */
+static void
+ts_parse(struct msghdr *mh, struct onet_tstamp *ts, uint32_t *key)
+{
+    struct scm_timestamping tss;
+    struct sock_extended_err ee;
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET &&
+            cm->cmsg_type == SO_TIMESTAMPING &&
+            cm->cmsg_len >= CMSG_LEN(sizeof(tss))) {
+            memcpy(&tss, CMSG_DATA(cm), sizeof(tss));
+            if (tss.ts[TS_SW].tv_sec != 0 || tss.ts[TS_SW].tv_nsec != 0) {
+                ts->sw = tss.ts[TS_SW];
+            }
+            if (tss.ts[TS_HW].tv_sec != 0 || tss.ts[TS_HW].tv_nsec != 0) {
+                ts->hw = tss.ts[TS_HW];
+            }
+        } else if (cm->cmsg_level == SOL_PACKET &&
+                   cm->cmsg_type == PACKET_TX_TIMESTAMP &&
+                   cm->cmsg_len >= CMSG_LEN(sizeof(ee)) && key != NULL) {
+            memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+            if (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                *key = ee.ee_data;
+            }
+        }
+    }
+}
+
+/*
+ * Receive a frame off the packet socket of a link
+ * along with its stamps
+ *
+ * Returns the length of the frame, otherwise a less
+ * than zero value (-EAGAIN if nothing came in time).
+ */
+static ssize_t
+ts_recv(struct onet_link *link, char *p, size_t len, int timeout,
+        struct onet_tstamp *ts)
+{
+    char ctl[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct pollfd pfd;
+    struct msghdr mh;
+    struct iovec iov;
+    ssize_t recv_len;
+
+    if (timeout >= 0) {
+        pfd.fd = link->sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) <= 0) {
+            return -EAGAIN;
+        }
+    }
+
+    iov.iov_base = p;
+    iov.iov_len = len;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl;
+    mh.msg_controllen = sizeof(ctl);
+
+    recv_len = recvmsg(link->sockfd, &mh, (timeout >= 0) ? MSG_DONTWAIT : 0);
+    if (recv_len < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? -EAGAIN : -errno;
+    }
+
+    memset(ts, 0, sizeof(*ts));
+    ts_parse(&mh, ts, NULL);
+    return recv_len;
+}
+
+/*
+ * Wait for the stamps of the frame last sent, the
+ * TX lock must be held
+ *
+ * @link: Link the frame was sent through
+ * @key: ID of the frame
+ * @ts: Stamps are written here
+ */
+static void
+ts_tx_wait(struct onet_link *link, uint32_t key, struct onet_tstamp *ts)
+{
+    struct onet_tstamp_state *tss = link->tstamp;
+    char ctl[256];
+    struct onet_tstamp got;
+    struct pollfd pfd;
+    struct msghdr mh;
+    int64_t deadline;
+    uint32_t got_key;
+    int remaining;
+
+    deadline = dgram_deadline(ONET_TS_TX_WAIT);
+    for (;;) {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_control = ctl;
+        mh.msg_controllen = sizeof(ctl);
+        if (recvmsg(link->sockfd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((remaining = dgram_remaining(deadline)) == 0) {
+                return;
+            }
+
+            /* The error queue always reports as POLLERR */
+            pfd.fd = link->sockfd;
+            pfd.events = 0;
+            pfd.revents = 0;
+            poll(&pfd, 1, remaining);
+            continue;
+        }
+
+        /* Stamps of frames we gave up on are skipped */
+        memset(&got, 0, sizeof(got));
+        got_key = key + 1;
+        ts_parse(&mh, &got, &got_key);
+        if (got_key != key) {
+            continue;
+        }
+
+        if (got.sw.tv_sec != 0 || got.sw.tv_nsec != 0) {
+            ts->sw = got.sw;
+        }
+        if (got.hw.tv_sec != 0 || got.hw.tv_nsec != 0) {
+            ts->hw = got.hw;
+        }
+
+        /* Each source reports on its own */
+        if ((ts->sw.tv_sec != 0 || ts->sw.tv_nsec != 0) &&
+            ((tss->flags & ONET_TS_HARDWARE) == 0 ||
+             ts->hw.tv_sec != 0 || ts->hw.tv_nsec != 0)) {
+            return;
+        }
+    }
+}
+
+int
+onet_tstamp_enable(struct onet_link *link, uint32_t flags)
+{
+    struct onet_tstamp_state *tss;
+    struct hwtstamp_config cfg;
+    struct ifreq ifr;
+    uint32_t so_flags;
+
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /* Frames would never go through recvmsg() */
+    if (link->rx_ring.base != NULL || link->xsk != NULL ||
+        link->shm != NULL) {
+        return -EBUSY;
+    }
+
+    if ((tss = link->tstamp) == NULL) {
+        if ((tss = calloc(1, sizeof(*tss))) == NULL) {
+            return -ENOMEM;
+        }
+        pthread_mutex_init(&tss->tx_lock, NULL);
+    }
+
+    /*
+     * Kernel stamps cost next to nothing and are always on,
+     * NIC stamps are only used if the driver takes them.
+     */
+    flags = ONET_TS_SOFTWARE | (flags & ONET_TS_HARDWARE);
+    if ((flags & ONET_TS_HARDWARE) != 0) {
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.tx_type = HWTSTAMP_TX_ON;
+        cfg.rx_filter = HWTSTAMP_FILTER_ALL;
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_data = (void *)&cfg;
+        if (if_indextoname(link->iface_idx, ifr.ifr_name) == NULL ||
+            ioctl(link->sockfd, SIOCSHWTSTAMP, &ifr) < 0) {
+            flags &= ~ONET_TS_HARDWARE;
+        }
+    }
+
+    so_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+        SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if ((flags & ONET_TS_HARDWARE) != 0) {
+        so_flags |= SOF_TIMESTAMPING_RX_HARDWARE |
+            SOF_TIMESTAMPING_RAW_HARDWARE;
+    }
+
+    if (setsockopt(link->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &so_flags,
+                   sizeof(so_flags)) < 0) {
+        if (link->tstamp == NULL) {
+            pthread_mutex_destroy(&tss->tx_lock);
+            free(tss);
+        }
+        return -errno;
+    }
+
+    /* Setting OPT_ID starts the frame IDs over */
+    pthread_mutex_lock(&tss->tx_lock);
+    tss->tx_key = 0;
+    tss->flags = flags;
+    pthread_mutex_unlock(&tss->tx_lock);
+    link->tstamp = tss;
+    return flags;
+}
+
+void
+onet_tstamp_free(struct onet_link *link)
+{
+    if (link->tstamp == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&link->tstamp->tx_lock);
+    free(link->tstamp);
+    link->tstamp = NULL;
+}
+
+rx_len_t
+dgram_recv_ts(struct onet_link *link, void *buf, uint32_t len, int timeout,
+              struct onet_tstamp *ts)
+{
+    struct onet_dgram *hdr;
+    struct timespec now;
+    size_t frame_len, dgram_len;
+    ssize_t recv_len;
+    int64_t deadline;
+    char *p, *whole;
+
+    if (link == NULL || buf == NULL || len == 0 || ts == NULL) {
+        return -EINVAL;
+    }
+
+    if (link->tstamp == NULL ||
+        __atomic_load_n(&link->nports, __ATOMIC_ACQUIRE) > 0) {
+        return -EINVAL;
+    }
+
+    frame_len = sizeof(struct ether_hdr) + link->mtu;
+    if ((p = dgram_frame_get(link, frame_len)) == NULL) {
+        return -1;
+    }
+
+    /* Same as dgram_recv_timed(), with the stamps kept */
+    deadline = dgram_deadline(timeout);
+    for (;;) {
+        recv_len = ts_recv(link, p, frame_len, dgram_remaining(deadline), ts);
+        if (recv_len == -EAGAIN) {
+            if (deadline >= 0 && dgram_remaining(deadline) == 0) {
+                dgram_frame_put(link, p);
+                return -EAGAIN;
+            }
+            continue;
+        }
+
+        if (recv_len < 0) {
+            dgram_frame_put(link, p);
+            return -1;
+        }
+
+        if (!dgram_accept(link, p, DGRAM_DATA(p), recv_len)) {
+            continue;
+        }
+
+        recv_len = dgram_frame_len(p);
+
+        hdr = DGRAM_HDR(p);
+        if (!DGRAM_IS_FRAG(hdr)) {
+            break;
+        }
+
+        whole = dgram_reasm(link, p, DGRAM_DATA(p), recv_len, &dgram_len);
+        if (whole != NULL) {
+            dgram_frame_put(link, p);
+            p = whole;
+            recv_len = dgram_len;
+            break;
+        }
+    }
+
+    recv_len -= DGRAM_LEN(0);
+    if ((size_t)recv_len > len) {
+        recv_len = len;
+    }
+
+    memcpy(buf, DGRAM_DATA(p), recv_len);
+
+    hdr = DGRAM_HDR(p);
+    if (ts->sw.tv_sec != 0 || ts->sw.tv_nsec != 0) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        ts_record(
+            &link->tstamp->hist[ONET_TS_RX][hdr->port],
+            ts_ns(&now) - ts_ns(&ts->sw)
+        );
+    }
+
+    dgram_frame_put(link, p);
+    return recv_len;
+}
+
+tx_len_t
+dgram_send_ts(struct onet_link *link, mac_addr_t dst, uint8_t port,
+              const void *buf, uint32_t len, struct onet_tstamp *ts)
+{
+    struct onet_tstamp_state *tss;
+    struct dgram_params params;
+    struct sockaddr_ll saddr;
+    struct timespec start;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(uint32_t))];
+    } ctl;
+    struct cmsghdr *cm;
+    uint32_t tx_flags;
+    ssize_t ret;
+    char *p;
+
+    if (link == NULL || buf == NULL || ts == NULL) {
+        return -EINVAL;
+    }
+
+    if ((tss = link->tstamp) == NULL) {
+        return -EINVAL;
+    }
+
+    if (len > link->mtu - sizeof(struct onet_dgram)) {
+        return -EMSGSIZE;
+    }
+
+    if ((p = dgram_frame_get(link, DGRAM_LEN(len))) == NULL) {
+        return -ENOMEM;
+    }
+
+    params.dst = dst;
+    params.buf = (void *)buf;
+    params.len = len;
+    params.type = OTYPE_DATA;
+    params.port = port;
+    params.frag = 0;
+    dgram_build(link, &params, p);
+    dgram_fill(p, buf, len);
+
+    /* Only this frame asks for TX stamps */
+    tx_flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+    if ((tss->flags & ONET_TS_HARDWARE) != 0) {
+        tx_flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+    }
+
+    dgram_sockaddr(link, &saddr);
+    iov.iov_base = p;
+    iov.iov_len = DGRAM_LEN(len);
+    memset(&mh, 0, sizeof(mh));
+    memset(&ctl, 0, sizeof(ctl));
+    mh.msg_name = &saddr;
+    mh.msg_namelen = sizeof(saddr);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SO_TIMESTAMPING;
+    cm->cmsg_len = CMSG_LEN(sizeof(tx_flags));
+    memcpy(CMSG_DATA(cm), &tx_flags, sizeof(tx_flags));
+
+    memset(ts, 0, sizeof(*ts));
+    pthread_mutex_lock(&tss->tx_lock);
+    clock_gettime(CLOCK_REALTIME, &start);
+    ret = sendmsg(link->sockfd, &mh, 0);
+    if (ret < 0) {
+        ret = -errno;
+    }
+
+    dgram_stat_tx(link, ret, DGRAM_LEN(len));
+    if (ret >= 0) {
+        ts_tx_wait(link, tss->tx_key++, ts);
+    }
+    pthread_mutex_unlock(&tss->tx_lock);
+    dgram_frame_put(link, p);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (ts->sw.tv_sec != 0 || ts->sw.tv_nsec != 0) {
+        ts_record(&tss->hist[ONET_TS_TX][port],
+                  ts_ns(&ts->sw) - ts_ns(&start));
+    }
+
+    return len;
+}
+
+int
+onet_ts_hist(struct onet_link *link, uint8_t port, int dir,
+             struct onet_ts_hist *res)
+{
+    struct onet_ts_hist *hist;
+
+    if (link == NULL || res == NULL || link->tstamp == NULL ||
+        (dir != ONET_TS_RX && dir != ONET_TS_TX)) {
+        return -EINVAL;
+    }
+
+    hist = &link->tstamp->hist[dir][port];
+    res->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    res->sum_ns = __atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED);
+    res->max_ns = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < ONET_TS_BUCKETS; ++i) {
+        res->bucket[i] = __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
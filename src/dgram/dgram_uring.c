@@ -0,0 +1,599 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "uring.h"
+#include "dgram_var.h"
+
+/* Default number of sends in flight */
+#define URING_DEPTH 256
+
+/* Number of receive buffers, must be a power of two */
+#define URING_RX_NR 256
+
+/* Provided buffer group of the receive buffers */
+#define URING_BGID 0
+
+/* user_data of the receive request, sends use their buffer index */
+#define URING_RX_TAG UINT64_MAX
+
+#define URING_ALIGN(n, a) (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+static inline int
+uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+uring_enter(int fd, uint32_t to_submit, uint32_t min, uint32_t flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min, flags, NULL, 0);
+}
+
+static inline int
+uring_register(int fd, uint32_t op, void *arg, uint32_t nr)
+{
+    return syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/*
+ * Hand queued submissions to the kernel, optionally
+ * waiting for completions as well.
+ */
+static int
+uring_submit(struct onet_uring *ur, uint32_t min)
+{
+    uint32_t flags = (min > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+
+    if (ur->sq_queued == 0 && min == 0) {
+        return 0;
+    }
+
+    do {
+        ret = uring_enter(ur->fd, ur->sq_queued, min, flags);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return -errno;
+    }
+
+    ur->sq_queued -= ret;
+    return 0;
+}
+
+/*
+ * Get a free submission queue entry, submitting what
+ * is queued if the queue is full.
+ */
+static struct io_uring_sqe *
+uring_sqe(struct onet_uring *ur)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t head, tail;
+
+    tail = *ur->sq_tail;
+    head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ur->sq_entries) {
+        if (uring_submit(ur, 0) < 0) {
+            return NULL;
+        }
+
+        head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= ur->sq_entries) {
+            return NULL;
+        }
+    }
+
+    sqe = (struct io_uring_sqe *)ur->sqes + (tail & ur->sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*
+ * Make a filled in submission queue entry visible
+ * to the kernel.
+ */
+static inline void
+uring_sqe_push(struct onet_uring *ur)
+{
+    __atomic_store_n(ur->sq_tail, *ur->sq_tail + 1, __ATOMIC_RELEASE);
+    ++ur->sq_queued;
+}
+
+/*
+ * Give a receive buffer (back) to the kernel
+ */
+static void
+uring_rx_put(struct onet_uring *ur, uint16_t bid)
+{
+    struct io_uring_buf_ring *br = ur->rx_bufs;
+    struct io_uring_buf *buf;
+    uint16_t tail = br->tail;
+
+    buf = &br->bufs[tail & (ur->rx_nr - 1)];
+    buf->addr = (uintptr_t)(ur->rx_arena + (size_t)bid * ur->frame_size);
+    buf->len = ur->frame_size;
+    buf->bid = bid;
+    __atomic_store_n(&br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Queue a receive request, multishot if the kernel
+ * supports it.
+ */
+static int
+uring_rx_arm(struct onet_uring *ur)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = uring_sqe(ur)) == NULL) {
+        return -EBUSY;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ur->link->sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->ioprio = ur->multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = URING_RX_TAG;
+    uring_sqe_push(ur);
+    ur->rx_armed = true;
+    return 0;
+}
+
+static void
+uring_rx_done(struct onet_uring *ur, const struct io_uring_cqe *cqe)
+{
+    const struct ether_hdr *eth;
+    const struct onet_dgram *hdr;
+    uint16_t bid;
+    size_t len;
+    char *p, *q, *whole;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        ur->rx_armed = false;
+    }
+
+    if (cqe->res < 0) {
+        /* Multishot is not supported here, re-arm each time */
+        if (cqe->res == -EINVAL && ur->multishot) {
+            ur->multishot = false;
+        } else if (cqe->res != -ENOBUFS && cqe->res != -EINTR &&
+                   cqe->res != -EAGAIN) {
+            return;
+        }
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        p = ur->rx_arena + (size_t)bid * ur->frame_size;
+        len = cqe->res;
+        whole = NULL;
+        if (cqe->res >= 0 && ur->rx_fn != NULL &&
+            dgram_accept(ur->link, p, DGRAM_DATA(p), len)) {
+            len = dgram_frame_len(p);
+            hdr = DGRAM_HDR(p);
+            if (DGRAM_IS_FRAG(hdr)) {
+                whole = dgram_reasm(ur->link, p, DGRAM_DATA(p), len, &len);
+            }
+
+            /* Fragments are only handed over once whole */
+            if (!DGRAM_IS_FRAG(hdr) || whole != NULL) {
+                q = (whole != NULL) ? whole : p;
+                eth = (const void *)q;
+                ur->rx_fn(
+                    ur, mac_swap((void *)eth->source), hdr->port,
+                    DGRAM_DATA(q), len - DGRAM_LEN(0), ur->rx_arg
+                );
+            }
+        }
+
+        uring_rx_put(ur, bid);
+        if (whole != NULL) {
+            dgram_frame_put(ur->link, whole);
+        }
+    }
+
+    if (!ur->rx_armed) {
+        uring_rx_arm(ur);
+    }
+}
+
+static void
+uring_tx_done(struct onet_uring *ur, const struct io_uring_cqe *cqe)
+{
+    uint32_t slot = cqe->user_data;
+    onet_uring_tx_fn fn = ur->tx_fn[slot];
+    void *arg = ur->tx_arg[slot];
+    int status = cqe->res;
+
+    if (status >= 0) {
+        status -= DGRAM_LEN(0);
+    }
+
+    ur->tx_free[ur->tx_nfree++] = slot;
+    if (fn != NULL) {
+        fn(ur, status, arg);
+    }
+}
+
+/*
+ * Map the submission and completion queues
+ */
+static int
+uring_map(struct onet_uring *ur, struct io_uring_params *p)
+{
+    char *sq, *cq;
+
+    ur->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+    ur->cq_map_len = p->cq_off.cqes +
+        p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_map_len > ur->sq_map_len) {
+            ur->sq_map_len = ur->cq_map_len;
+        }
+        ur->cq_map_len = ur->sq_map_len;
+    }
+
+    sq = mmap(
+        NULL, ur->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING
+    );
+    if (sq == MAP_FAILED) {
+        return -errno;
+    }
+
+    ur->sq_map = sq;
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(
+            NULL, ur->cq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING
+        );
+        if (cq == MAP_FAILED) {
+            return -errno;
+        }
+    }
+
+    ur->cq_map = cq;
+    ur->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(
+        NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES
+    );
+    if (ur->sqes == MAP_FAILED) {
+        ur->sqes = NULL;
+        return -errno;
+    }
+
+    ur->sq_head = (void *)(sq + p->sq_off.head);
+    ur->sq_tail = (void *)(sq + p->sq_off.tail);
+    ur->sq_array = (void *)(sq + p->sq_off.array);
+    ur->sq_mask = *(uint32_t *)(sq + p->sq_off.ring_mask);
+    ur->sq_entries = p->sq_entries;
+    ur->cq_head = (void *)(cq + p->cq_off.head);
+    ur->cq_tail = (void *)(cq + p->cq_off.tail);
+    ur->cq_mask = *(uint32_t *)(cq + p->cq_off.ring_mask);
+    ur->cqes = cq + p->cq_off.cqes;
+    return 0;
+}
+
+/*
+ * Set up the send and receive buffers
+ */
+static int
+uring_buffers(struct onet_uring *ur)
+{
+    struct io_uring_buf_reg reg;
+    struct iovec iov;
+    size_t len;
+    uint32_t i;
+
+    len = URING_ALIGN((size_t)ur->tx_nr * ur->frame_size, 4096);
+    ur->tx_arena = aligned_alloc(4096, len);
+    ur->tx_fn = calloc(ur->tx_nr, sizeof(*ur->tx_fn));
+    ur->tx_arg = calloc(ur->tx_nr, sizeof(*ur->tx_arg));
+    ur->tx_free = calloc(ur->tx_nr, sizeof(*ur->tx_free));
+    if (ur->tx_arena == NULL || ur->tx_fn == NULL ||
+        ur->tx_arg == NULL || ur->tx_free == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < ur->tx_nr; ++i) {
+        ur->tx_free[i] = ur->tx_nr - i - 1;
+    }
+    ur->tx_nfree = ur->tx_nr;
+
+    /* Without registered buffers we fall back to plain sends */
+    iov.iov_base = ur->tx_arena;
+    iov.iov_len = len;
+    ur->fixed = uring_register(ur->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    len = URING_ALIGN((size_t)ur->rx_nr * ur->frame_size, 4096);
+    ur->rx_arena = aligned_alloc(4096, len);
+    if (ur->rx_arena == NULL) {
+        return -ENOMEM;
+    }
+
+    ur->rx_bufs = mmap(
+        NULL, ur->rx_nr * sizeof(struct io_uring_buf),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if (ur->rx_bufs == MAP_FAILED) {
+        ur->rx_bufs = NULL;
+        return -ENOMEM;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)ur->rx_bufs;
+    reg.ring_entries = ur->rx_nr;
+    reg.bgid = URING_BGID;
+    if (uring_register(ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -errno;
+    }
+
+    for (i = 0; i < ur->rx_nr; ++i) {
+        uring_rx_put(ur, i);
+    }
+
+    return 0;
+}
+
+int
+onet_uring_init(struct onet_uring *ur, struct onet_link *link,
+                uint32_t depth)
+{
+    struct io_uring_params p;
+    uint32_t i;
+    int error;
+
+    if (ur == NULL || link == NULL) {
+        return -EINVAL;
+    }
+
+    /* Requests go to the packet socket */
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /* AF_XDP frames never reach the packet socket */
+    if (link->xsk != NULL) {
+        return -EOPNOTSUPP;
+    }
+
+    if (depth == 0) {
+        depth = URING_DEPTH;
+    }
+
+    memset(ur, 0, sizeof(*ur));
+    ur->link = link;
+    ur->tx_nr = depth;
+    ur->rx_nr = URING_RX_NR;
+    ur->frame_size = URING_ALIGN(sizeof(struct ether_hdr) + link->mtu, 64);
+    ur->multishot = true;
+
+    /*
+     * Leave room in the completion queue for a burst of
+     * receives on top of every send in flight. Older kernels
+     * do not know some of these flags, try again without.
+     */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+        IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    p.cq_entries = (depth + URING_RX_NR) * 2;
+    ur->fd = uring_setup(depth, &p);
+    if (ur->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        ur->fd = uring_setup(depth, &p);
+    }
+
+    if (ur->fd < 0) {
+        return -errno;
+    }
+
+    if ((error = uring_map(ur, &p)) < 0) {
+        onet_uring_free(ur);
+        return error;
+    }
+
+    for (i = 0; i < ur->sq_entries; ++i) {
+        ur->sq_array[i] = i;
+    }
+
+    if ((error = uring_buffers(ur)) < 0) {
+        onet_uring_free(ur);
+        return error;
+    }
+
+    return 0;
+}
+
+void
+onet_uring_free(struct onet_uring *ur)
+{
+    if (ur == NULL) {
+        return;
+    }
+
+    /* Closing the ring drops every registration */
+    if (ur->fd >= 0) {
+        close(ur->fd);
+    }
+
+    if (ur->sqes != NULL) {
+        munmap(ur->sqes, ur->sqes_len);
+    }
+    if (ur->cq_map != NULL && ur->cq_map != ur->sq_map) {
+        munmap(ur->cq_map, ur->cq_map_len);
+    }
+    if (ur->sq_map != NULL) {
+        munmap(ur->sq_map, ur->sq_map_len);
+    }
+    if (ur->rx_bufs != NULL) {
+        munmap(ur->rx_bufs, ur->rx_nr * sizeof(struct io_uring_buf));
+    }
+
+    free(ur->tx_arena);
+    free(ur->tx_fn);
+    free(ur->tx_arg);
+    free(ur->tx_free);
+    free(ur->rx_arena);
+    memset(ur, 0, sizeof(*ur));
+    ur->fd = -1;
+}
+
+int
+onet_uring_send(struct onet_uring *ur, mac_addr_t dst, uint8_t port,
+                void *buf, uint16_t len, onet_uring_tx_fn fn, void *arg)
+{
+    struct dgram_params params;
+    struct io_uring_sqe *sqe;
+    uint32_t slot;
+    char *p;
+    int error;
+
+    if (ur == NULL || buf == NULL) {
+        return -EINVAL;
+    }
+
+    if (DGRAM_LEN(len) > ur->frame_size) {
+        return -EMSGSIZE;
+    }
+
+    /* Every buffer is in flight, wait for one to come back */
+    while (ur->tx_nfree == 0) {
+        if ((error = onet_uring_poll(ur, 1)) < 0) {
+            return error;
+        }
+    }
+
+    if ((sqe = uring_sqe(ur)) == NULL) {
+        return -EBUSY;
+    }
+
+    slot = ur->tx_free[--ur->tx_nfree];
+    ur->tx_fn[slot] = fn;
+    ur->tx_arg[slot] = arg;
+
+    params.dst = dst;
+    params.buf = buf;
+    params.len = len;
+    params.type = OTYPE_DATA;
+    params.port = port;
+    params.frag = 0;
+    p = ur->tx_arena + (size_t)slot * ur->frame_size;
+    dgram_build(ur->link, &params, p);
+    dgram_fill(p, buf, len);
+
+    /*
+     * The link socket is bound, so a write goes out on its
+     * interface and protocol just like a send would.
+     */
+    if (ur->fixed) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+    }
+
+    sqe->fd = ur->link->sockfd;
+    sqe->addr = (uintptr_t)p;
+    sqe->len = DGRAM_LEN(len);
+    sqe->user_data = slot;
+    uring_sqe_push(ur);
+    return 0;
+}
+
+int
+onet_uring_recv(struct onet_uring *ur, onet_uring_rx_fn fn, void *arg)
+{
+    if (ur == NULL || fn == NULL) {
+        return -EINVAL;
+    }
+
+    ur->rx_fn = fn;
+    ur->rx_arg = arg;
+    if (ur->rx_armed) {
+        return 0;
+    }
+
+    return uring_rx_arm(ur);
+}
+
+int
+onet_uring_poll(struct onet_uring *ur, uint32_t min)
+{
+    struct io_uring_cqe cqe;
+    uint32_t head, tail;
+    int error, n = 0;
+
+    if (ur == NULL) {
+        return -EINVAL;
+    }
+
+    if ((error = uring_submit(ur, min)) < 0) {
+        return error;
+    }
+
+    /*
+     * Each completion is consumed before its callback runs,
+     * so callbacks may queue more work (or poll) themselves.
+     */
+    for (;;) {
+        head = *ur->cq_head;
+        tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+
+        cqe = ((struct io_uring_cqe *)ur->cqes)[head & ur->cq_mask];
+        __atomic_store_n(ur->cq_head, head + 1, __ATOMIC_RELEASE);
+        if (cqe.user_data == URING_RX_TAG) {
+            uring_rx_done(ur, &cqe);
+        } else {
+            uring_tx_done(ur, &cqe);
+        }
+
+        ++n;
+    }
+
+    return n;
+}
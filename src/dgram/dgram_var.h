@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DGRAM_VAR_H
+#define DGRAM_VAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <linux/if_packet.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "link.h"
+#include "stats.h"
+
+/*
+ * Represents datagram parameters to use for
+ * dgram_do_send()
+ *
+ * @dst: Destination MAC address
+ * @buf: Buffer to use
+ * @len: Length to transmit
+ * @type: Packet type to use
+ * @port: Port to send on
+ * @frag: Fragment ID in the upper 16 bits, DGRAM_F_MF and
+ *        the fragment index in the lower ones (see DGRAM_FRAG())
+ */
+struct dgram_params {
+    mac_addr_t dst;
+    void *buf;
+    uint32_t len;
+    uint8_t type;
+    uint8_t port;
+    uint32_t frag;
+};
+
+/*
+ * Build the `frag' value of datagram parameters
+ */
+#define DGRAM_FRAG(id, idx, more) \
+    (((uint32_t)(id) << 16) | ((idx) << DGRAM_FRAG_SHIFT) | \
+     ((more) ? DGRAM_F_MF : 0))
+
+/*
+ * Compare 32-bit sequence numbers that may wrap around
+ */
+#define SEQ_LT(a, b)    ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b)   ((int32_t)((a) - (b)) <= 0)
+
+/*
+ * A frame sitting in a port receive queue
+ *
+ * @p: Frame (from dgram_frame_get())
+ * @len: Length of the frame
+ */
+struct dgram_slot {
+    char *p;
+    uint32_t len;
+};
+
+/*
+ * Represents a port bound on a link. Its receive queue
+ * is a single producer (whoever is demultiplexing the
+ * link) single consumer ring.
+ *
+ * @slots: Queued frames
+ * @mask: Number of slots minus one
+ * @head: Next slot to dequeue (consumer side)
+ * @tail: Next slot to enqueue (producer side)
+ * @seq: Bumped whenever the consumer should look again,
+ *       the consumer sleeps on it as a futex
+ * @waiting: Set while the consumer sleeps on `seq'
+ */
+struct onet_port {
+    struct dgram_slot *slots;
+    uint32_t mask;
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t seq __attribute__((aligned(64)));
+    uint32_t waiting;
+};
+
+/*
+ * Write the ethernet and datagram headers for a frame
+ * described by `params' to `p'.
+ *
+ * @link: Link the frame will be sent through
+ * @params: Parameters to use
+ * @p: Start of the frame
+ */
+void dgram_build(
+    struct onet_link *link,
+    struct dgram_params *params, char *p
+);
+
+/*
+ * Copy the data of a frame built by dgram_build() into
+ * place, extending the CRC over it in the same pass if
+ * the datagram asks for it.
+ *
+ * @p: Start of the frame
+ * @buf: Data to copy
+ * @len: Length of the data
+ */
+void dgram_fill(char *p, const void *buf, uint16_t len);
+
+/*
+ * Gather scattered data into a frame built by dgram_build(),
+ * like dgram_fill() does for a single buffer.
+ *
+ * @p: Start of the frame
+ * @iov: Pieces of data to gather, in order
+ * @iovcnt: Number of pieces
+ */
+void dgram_fill_iov(char *p, const struct iovec *iov, int iovcnt);
+
+/*
+ * Extend the CRC of a datagram header over data that
+ * is already in place (e.g., scattered from the caller).
+ * Nothing is done unless the header has DGRAM_F_PCRC set.
+ * May be called once per piece of the data, in order.
+ *
+ * @hdr: Datagram header built by dgram_build()
+ * @data: Data (or next piece of it) to cover
+ * @len: Length of the data
+ */
+void dgram_seal(struct onet_dgram *hdr, const void *data, size_t len);
+
+/*
+ * Check the CRC of a received datagram
+ *
+ * @hdr: Datagram header
+ * @data: Datagram data
+ * @len: Number of data bytes available at `data'
+ */
+bool dgram_crc_ok(const struct onet_dgram *hdr, const void *data, size_t len);
+
+/*
+ * Reserve the next TX ring slot for a frame
+ *
+ * @link: Link with a mapped TX ring
+ * @len: Length of the whole frame
+ *
+ * Returns a pointer to where the frame should be written,
+ * otherwise NULL if no slot is available.
+ */
+char *dgram_tx_frame(struct onet_link *link, size_t len);
+
+/*
+ * Reserve the next TX ring slot and build the headers of
+ * the frame described by `params' in place.
+ *
+ * @link: Link with a mapped TX ring
+ * @params: Parameters to use (`params->buf' is unused)
+ *
+ * Returns a pointer to where the datagram data should be
+ * written, otherwise NULL if no slot is available.
+ */
+char *dgram_tx_slot(struct onet_link *link, struct dgram_params *params);
+
+/*
+ * Hand the slot returned by the last dgram_tx_slot() to
+ * the kernel, its data must already be sealed.
+ *
+ * @link: Link with a mapped TX ring
+ */
+void dgram_tx_push(struct onet_link *link);
+
+/*
+ * Ask the kernel to transmit every committed TX ring slot
+ *
+ * @link: Link with a mapped TX ring
+ * @flags: Flags passed to sendto() (e.g., MSG_DONTWAIT)
+ */
+int dgram_tx_kick(struct onet_link *link, int flags);
+
+/*
+ * Fill in the link layer address used to send frames
+ * through a link.
+ *
+ * @link: Link to send through
+ * @saddr: Result is written here
+ */
+static inline void
+dgram_sockaddr(struct onet_link *link, struct sockaddr_ll *saddr)
+{
+    memset(saddr, 0, sizeof(*saddr));
+    saddr->sll_family = AF_PACKET;
+    saddr->sll_protocol = htons(PROTO_ID);
+    saddr->sll_ifindex = link->iface_idx;
+    saddr->sll_halen = HW_ADDR_LEN;
+}
+
+/*
+ * Bump a counter of a link (see stats.h)
+ *
+ * @link: Link to bump the counter of
+ * @stat: Counter to bump (ONET_STAT_*)
+ * @n: What to add to it
+ */
+static inline void
+dgram_stat(struct onet_link *link, uint32_t stat, uint64_t n)
+{
+    struct onet_stats_page *page;
+
+    page = __atomic_load_n(&link->stats, __ATOMIC_ACQUIRE);
+    if (page == NULL) {
+        return;
+    }
+
+    if (onet_stats_idx == 0) {
+        onet_stats_idx = onet_stats_slot() + 1;
+    }
+
+    __atomic_fetch_add(&page->slot[onet_stats_idx - 1].v[stat], n,
+                       __ATOMIC_RELAXED);
+}
+
+/*
+ * Account for a frame handed to the transport
+ *
+ * @link: Link the frame went out of
+ * @ret: What the transport returned
+ * @len: Length of the frame
+ */
+static inline void
+dgram_stat_tx(struct onet_link *link, ssize_t ret, size_t len)
+{
+    if (ret == (ssize_t)len) {
+        dgram_stat(link, ONET_STAT_TX_PACKETS, 1);
+        dgram_stat(link, ONET_STAT_TX_BYTES, len);
+    } else {
+        dgram_stat(link, ONET_STAT_DROP_SEND, 1);
+    }
+}
+
+/*
+ * Get a frame buffer of at least `len' bytes, out of
+ * the link pool if it can hold it.
+ *
+ * @link: Link the frame is for
+ * @len: Length needed in bytes
+ */
+static inline char *
+dgram_frame_get(struct onet_link *link, size_t len)
+{
+    char *p = NULL;
+
+    if (len <= link->pool.frame_size) {
+        p = onet_pool_get(&link->pool);
+    }
+
+    if (p == NULL && (p = malloc(len)) == NULL) {
+        dgram_stat(link, ONET_STAT_DROP_ALLOC, 1);
+    }
+
+    return p;
+}
+
+/*
+ * Release a frame buffer from dgram_frame_get()
+ *
+ * @link: Link the frame is for
+ * @p: Frame to release
+ */
+static inline void
+dgram_frame_put(struct onet_link *link, char *p)
+{
+    if (onet_pool_owns(&link->pool, p)) {
+        onet_pool_put(&link->pool, p);
+    } else {
+        free(p);
+    }
+}
+
+/*
+ * Send data through a link using specific parameters,
+ * splitting it in fragments if it does not fit in a
+ * single frame.
+ *
+ * @link: Link to transmit through
+ * @params: Parameters to use
+ *
+ * Returns the number of bytes sent on success, otherwise
+ * a less than zero value on failure.
+ */
+tx_len_t dgram_do_send(
+    struct onet_link *link,
+    struct dgram_params *params
+);
+
+/*
+ * Check whether a received frame is an ONET datagram
+ * that should be handed to the user. Squeaks are
+ * answered here and never handed out. Other types than
+ * OTYPE_DATA only get through while ports are bound,
+ * for the port demultiplexer to hand to their channel.
+ *
+ * Frames whose header claims more data than they hold are
+ * dropped. Frames may hold more, Ethernet pads short ones,
+ * so take the length from dgram_frame_len() afterwards.
+ *
+ * @link: Link the frame was received on
+ * @hdr: Start of the frame (the headers)
+ * @data: Start of the datagram data
+ * @len: Length of the whole frame
+ */
+bool dgram_accept(
+    struct onet_link *link, const char *hdr,
+    const char *data, size_t len
+);
+
+/*
+ * Get the length of a received frame (see dgram_accept())
+ * without the padding it may have picked up on the wire.
+ * Only good for frames as they come off the wire, not for
+ * the ones dgram_reasm() hands out.
+ *
+ * @p: Start of the frame (the headers)
+ */
+static inline size_t
+dgram_frame_len(const char *p)
+{
+    const struct onet_dgram *hdr = DGRAM_HDR(p);
+
+    return DGRAM_LEN(ntohs(hdr->length));
+}
+
+/*
+ * Get the next frame out of the RX ring (or the AF_XDP
+ * socket), sleeping in poll() if the kernel has not handed
+ * us a block yet. The frame stays valid until the next call.
+ *
+ * @link: Link with a mapped RX ring or an AF_XDP socket
+ * @len: Length of the frame is written here
+ * @timeout: poll() timeout in ms (-1 to wait forever)
+ *
+ * Returns a pointer to the start of the frame, otherwise
+ * NULL with errno set (EAGAIN if the timeout expired).
+ */
+char *dgram_rx_next(struct onet_link *link, size_t *len, int timeout);
+
+/*
+ * dgram_rx_next() for links with an AF_XDP socket
+ */
+char *dgram_xsk_next(struct onet_link *link, size_t *len, int timeout);
+
+/*
+ * Send a datagram through the AF_XDP socket of a link
+ *
+ * @link: Link with an AF_XDP socket
+ * @params: Parameters to use
+ *
+ * Returns the number of bytes transmitted on success, otherwise
+ * a less than zero value on failure.
+ */
+tx_len_t dgram_xsk_send(struct onet_link *link, struct dgram_params *params);
+
+/*
+ * Hand a received fragment to the reassembly engine of a
+ * link. Fragments are copied, so the frame may be reused
+ * as soon as this returns.
+ *
+ * @link: Link the fragment was received on
+ * @p: Start of the frame (the headers)
+ * @data: Start of the datagram data
+ * @len: Length of the frame (see dgram_frame_len())
+ * @res_len: Length of the reassembled frame is written here
+ *
+ * Returns the reassembled frame (headers then data) once
+ * the last fragment is in, to be released with
+ * dgram_frame_put(). Returns NULL until then.
+ */
+char *dgram_reasm(
+    struct onet_link *link, const char *p,
+    const char *data, size_t len, size_t *res_len
+);
+
+/*
+ * Returns true if a link joined the multicast
+ * group `group' (see dgram_join())
+ */
+bool dgram_joined(struct onet_link *link, mac_addr_t group);
+
+/*
+ * Record a squeak heard on a link in its neighbor table
+ * and decide whether it may be answered (see neigh.h)
+ *
+ * @link: Link the squeak was heard on
+ * @src: Who squeaked
+ * @ask: The squeak asks for an answer (SQUEAK_ASK)
+ *
+ * Returns true if the squeak should be answered.
+ */
+bool dgram_neigh_input(struct onet_link *link, mac_addr_t src, bool ask);
+
+/*
+ * Returns true if frames are received in place with
+ * dgram_rx_next() rather than copied out of the socket.
+ */
+static inline bool
+dgram_rx_mapped(struct onet_link *link)
+{
+    return link->rx_ring.base != NULL || link->xsk != NULL;
+}
+
+/*
+ * Get the file descriptor to poll for received frames
+ */
+static inline int
+dgram_rx_fd(struct onet_link *link)
+{
+    return (link->xsk != NULL) ? link->xsk->fd : link->sockfd;
+}
+
+/*
+ * Wait for a frame on a port queue, demultiplexing
+ * the link ourselves if no one else is.
+ *
+ * @link: Link the port is bound on
+ * @port: Port to wait on
+ * @res: The dequeued frame is written here
+ * @timeout: Timeout in ms (-1 to wait forever)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure (-EAGAIN if the timeout expired).
+ */
+int dgram_port_wait(
+    struct onet_link *link, struct onet_port *port,
+    struct dgram_slot *res, int timeout
+);
+
+/*
+ * Get the receive timeout of a link for calls that
+ * do not take one.
+ */
+static inline int
+dgram_rx_timeout(struct onet_link *link)
+{
+    return (link->flags & ONET_F_NONBLOCK) ? 0 : -1;
+}
+
+/*
+ * Turn a timeout in ms (-1 for none) into a deadline
+ * on the monotonic clock.
+ */
+static inline int64_t
+dgram_deadline(int timeout)
+{
+    struct timespec ts;
+
+    if (timeout < 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + timeout;
+}
+
+/*
+ * Get the time left until a deadline in ms, -1 if
+ * there is no deadline.
+ */
+static inline int
+dgram_remaining(int64_t deadline)
+{
+    struct timespec ts;
+    int64_t now;
+
+    if (deadline < 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    return (now >= deadline) ? 0 : deadline - now;
+}
+
+#endif  /* !DGRAM_VAR_H */
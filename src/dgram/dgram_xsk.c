@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <linux/if_xdp.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "dgram_var.h"
+
+#define XSK_TX_WAIT 10          /* Wait for a send frame (ms) */
+
+/*
+ * Give a frame back to the fill ring so the kernel
+ * may receive into it again.
+ */
+static void
+xsk_fill(struct onet_xsk *xsk, uint64_t addr)
+{
+    uint64_t *fill = xsk->fill.ring;
+    uint32_t prod = *xsk->fill.producer;
+
+    fill[prod & xsk->fill.mask] = addr;
+    __atomic_store_n(xsk->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take back every send frame the kernel is done with
+ */
+static void
+xsk_reclaim(struct onet_xsk *xsk)
+{
+    uint64_t *comp = xsk->comp.ring;
+    uint32_t cons, prod;
+
+    cons = *xsk->comp.consumer;
+    prod = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE);
+    while (cons != prod) {
+        xsk->tx_free[xsk->tx_nfree++] = comp[cons++ & xsk->comp.mask];
+    }
+
+    __atomic_store_n(xsk->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/*
+ * Tell the kernel there is something on the TX ring,
+ * in copy mode this sends it out there and then.
+ */
+static inline void
+xsk_kick(struct onet_xsk *xsk)
+{
+    sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+char *
+dgram_xsk_next(struct onet_link *link, size_t *len, int timeout)
+{
+    struct onet_xsk *xsk = link->xsk;
+    struct xdp_desc *rx = xsk->rx.ring;
+    struct xdp_desc desc;
+    struct pollfd pfd;
+    uint32_t cons, prod;
+
+    /* The last frame handed out is done with */
+    if (xsk->rx_cur != UINT64_MAX) {
+        xsk_fill(xsk, xsk->rx_cur);
+        xsk->rx_cur = UINT64_MAX;
+    }
+
+    for (;;) {
+        cons = *xsk->rx.consumer;
+        prod = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE);
+        if (cons != prod) {
+            break;
+        }
+
+        /* The kernel may be waiting on us to refill */
+        if (__atomic_load_n(xsk->fill.flags, __ATOMIC_RELAXED) &
+            XDP_RING_NEED_WAKEUP) {
+            recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+
+        pfd.fd = xsk->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        switch (poll(&pfd, 1, timeout)) {
+        case -1:
+            if (errno != EINTR) {
+                return NULL;
+            }
+            break;
+        case 0:
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+
+    desc = rx[cons & xsk->rx.mask];
+    __atomic_store_n(xsk->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+    xsk->rx_cur = desc.addr;
+    *len = desc.len;
+    return xsk->umem + desc.addr;
+}
+
+tx_len_t
+dgram_xsk_send(struct onet_link *link, struct dgram_params *params)
+{
+    struct onet_xsk *xsk = link->xsk;
+    struct xdp_desc *tx = xsk->tx.ring;
+    struct pollfd pfd;
+    int64_t deadline = -1;
+    uint32_t prod, cons;
+    uint64_t addr;
+    char *p;
+
+    if (DGRAM_LEN(params->len) > xsk->frame_size) {
+        return -EMSGSIZE;
+    }
+
+    /* Squeak replies come from receivers, so there is more than one */
+    pthread_mutex_lock(&link->tx_lock);
+
+    /* Out of frames, push the ring out and wait for some back */
+    xsk_reclaim(xsk);
+    while (xsk->tx_nfree == 0) {
+        if (deadline < 0) {
+            deadline = dgram_deadline(XSK_TX_WAIT);
+        } else if (dgram_remaining(deadline) == 0) {
+            pthread_mutex_unlock(&link->tx_lock);
+            return -ENOBUFS;
+        }
+
+        xsk_kick(xsk);
+        pfd.fd = xsk->fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 1);
+        xsk_reclaim(xsk);
+    }
+
+    prod = *xsk->tx.producer;
+    cons = __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+    if (prod - cons > xsk->tx.mask) {
+        xsk_kick(xsk);
+        pthread_mutex_unlock(&link->tx_lock);
+        return -ENOBUFS;
+    }
+
+    addr = xsk->tx_free[--xsk->tx_nfree];
+    p = xsk->umem + addr;
+    dgram_build(link, params, p);
+    dgram_fill(p, params->buf, params->len);
+
+    tx[prod & xsk->tx.mask].addr = addr;
+    tx[prod & xsk->tx.mask].len = DGRAM_LEN(params->len);
+    tx[prod & xsk->tx.mask].options = 0;
+    __atomic_store_n(xsk->tx.producer, prod + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&link->tx_lock);
+    xsk_kick(xsk);
+    return params->len;
+}
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "fec.h"
+
+/* GF(2^8) reducing polynomial, x^8 + x^4 + x^3 + x^2 + 1 */
+#define GF_POLY 0x11D
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_tab[256][256];
+
+struct fec_impl {
+    const char *name;
+    void (*mul_add)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+    int (*avail)(void);
+};
+
+static void gf_mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c,
+                              size_t len);
+static void (*gf_mul_add_fn)(uint8_t *, const uint8_t *, uint8_t, size_t) =
+    gf_mul_add_scalar;
+static int fec_cur_impl = FEC_IMPL_SCALAR;
+
+uint8_t
+gf_mul(uint8_t a, uint8_t b)
+{
+    return gf_mul_tab[a][b];
+}
+
+uint8_t
+gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+static void
+gf_mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const uint8_t *row = gf_mul_tab[c];
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Split c * x into c * (x & 0xF) ^ c * (x & 0xF0) and look
+ * both halves up in 16 entry tables with a byte shuffle,
+ * see "Screaming Fast Galois Field Arithmetic Using Intel
+ * SIMD Instructions" (Plank et al., FAST 2013).
+ */
+static void
+gf_nibble_tabs(uint8_t c, uint8_t lo[16], uint8_t hi[16])
+{
+    int x;
+
+    for (x = 0; x < 16; ++x) {
+        lo[x] = gf_mul_tab[c][x];
+        hi[x] = gf_mul_tab[c][x << 4];
+    }
+}
+
+__attribute__((target("ssse3")))
+static void
+gf_mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i tl, th, s, d, l, h;
+    uint8_t lo[16], hi[16];
+
+    gf_nibble_tabs(c, lo, hi);
+    tl = _mm_loadu_si128((const __m128i *)lo);
+    th = _mm_loadu_si128((const __m128i *)hi);
+
+    while (len >= 16) {
+        s = _mm_loadu_si128((const __m128i *)src);
+        d = _mm_loadu_si128((const __m128i *)dst);
+        l = _mm_shuffle_epi8(tl, _mm_and_si128(s, mask));
+        h = _mm_shuffle_epi8(th, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+        _mm_storeu_si128((__m128i *)dst, d);
+        src += 16;
+        dst += 16;
+        len -= 16;
+    }
+
+    gf_mul_add_scalar(dst, src, c, len);
+}
+
+__attribute__((target("avx2")))
+static void
+gf_mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i tl, th, s, d, l, h;
+    __m128i m, sx, dx, lx, hx;
+    uint8_t lo[16], hi[16];
+
+    gf_nibble_tabs(c, lo, hi);
+    tl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    th = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+
+    while (len >= 32) {
+        s = _mm256_loadu_si256((const __m256i *)src);
+        d = _mm256_loadu_si256((const __m256i *)dst);
+        l = _mm256_shuffle_epi8(tl, _mm256_and_si256(s, mask));
+        h = _mm256_shuffle_epi8(
+            th, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)
+        );
+        d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+        _mm256_storeu_si256((__m256i *)dst, d);
+        src += 32;
+        dst += 32;
+        len -= 32;
+    }
+
+    /*
+     * Finish off here rather than in the SSSE3 kernel, its
+     * legacy encoded instructions would stall on the dirty
+     * upper halves.
+     */
+    if (len >= 16) {
+        m = _mm256_castsi256_si128(mask);
+        sx = _mm_loadu_si128((const __m128i *)src);
+        dx = _mm_loadu_si128((const __m128i *)dst);
+        lx = _mm_shuffle_epi8(_mm256_castsi256_si128(tl), _mm_and_si128(sx, m));
+        hx = _mm_shuffle_epi8(
+            _mm256_castsi256_si128(th), _mm_and_si128(_mm_srli_epi64(sx, 4), m)
+        );
+        dx = _mm_xor_si128(dx, _mm_xor_si128(lx, hx));
+        _mm_storeu_si128((__m128i *)dst, dx);
+        src += 16;
+        dst += 16;
+        len -= 16;
+    }
+
+    _mm256_zeroupper();
+    gf_mul_add_scalar(dst, src, c, len);
+}
+
+static int
+gf_ssse3_avail(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int
+gf_avx2_avail(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif  /* __x86_64__ || __i386__ */
+
+static const struct fec_impl fec_impls[] = {
+    [FEC_IMPL_SCALAR] = { "scalar", gf_mul_add_scalar, NULL },
+#if defined(__x86_64__) || defined(__i386__)
+    [FEC_IMPL_SSSE3] = { "ssse3", gf_mul_add_ssse3, gf_ssse3_avail },
+    [FEC_IMPL_AVX2] = { "avx2", gf_mul_add_avx2, gf_avx2_avail },
+#endif
+};
+
+#define FEC_NIMPL (sizeof(fec_impls) / sizeof(fec_impls[0]))
+
+/*
+ * Build the log, exp and multiplication tables and
+ * pick the fastest kernel the CPU supports.
+ */
+__attribute__((constructor))
+static void
+fec_init(void)
+{
+    unsigned int i, j, x = 1;
+
+    for (i = 0; i < 255; ++i) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= GF_POLY;
+        }
+    }
+
+    /* Spares a modulo in the multiply */
+    for (i = 255; i < 512; ++i) {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+
+    for (i = 1; i < 256; ++i) {
+        for (j = 1; j < 256; ++j) {
+            gf_mul_tab[i][j] = gf_exp[gf_log[i] + gf_log[j]];
+        }
+    }
+
+    fec_select(FEC_IMPL_AUTO);
+}
+
+int
+fec_select(int impl)
+{
+    const struct fec_impl *ip;
+
+    if (impl == FEC_IMPL_AUTO) {
+        if (fec_select(FEC_IMPL_AVX2) == 0) {
+            return 0;
+        }
+        if (fec_select(FEC_IMPL_SSSE3) == 0) {
+            return 0;
+        }
+        return fec_select(FEC_IMPL_SCALAR);
+    }
+
+    if (impl < 0 || (size_t)impl >= FEC_NIMPL) {
+        return -ENOTSUP;
+    }
+
+    ip = &fec_impls[impl];
+    if (ip->mul_add == NULL) {
+        return -ENOTSUP;
+    }
+    if (ip->avail != NULL && !ip->avail()) {
+        return -ENOTSUP;
+    }
+
+    gf_mul_add_fn = ip->mul_add;
+    fec_cur_impl = impl;
+    return 0;
+}
+
+const char *
+fec_impl_name(int impl)
+{
+    if (impl == FEC_IMPL_AUTO) {
+        impl = fec_cur_impl;
+    }
+
+    if (impl < 0 || (size_t)impl >= FEC_NIMPL) {
+        return NULL;
+    }
+
+    return fec_impls[impl].name;
+}
+
+void
+gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c != 0) {
+        gf_mul_add_fn(dst, src, c, len);
+    }
+}
+
+uint8_t
+fec_coef(uint32_t row, uint32_t col)
+{
+    /* Rows and columns use disjoint elements, so this is never 0 */
+    return gf_inv((FEC_K_MAX + row) ^ col);
+}
+
+int
+fec_encode(uint32_t k, uint32_t r, const uint8_t *const *src,
+           uint8_t **parity, size_t len)
+{
+    uint32_t i, j;
+
+    if (k == 0 || k > FEC_K_MAX || r > FEC_R_MAX) {
+        return -EINVAL;
+    }
+
+    for (j = 0; j < r; ++j) {
+        memset(parity[j], 0, len);
+        for (i = 0; i < k; ++i) {
+            gf_mul_add(parity[j], src[i], fec_coef(j, i), len);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Invert an n by n matrix in place (Gauss-Jordan)
+ *
+ * Returns zero on success, otherwise -EINVAL if the
+ * matrix is singular.
+ */
+static int
+fec_invert(uint8_t m[][FEC_K_MAX], uint32_t n)
+{
+    uint8_t inv[FEC_K_MAX][FEC_K_MAX], t, c;
+    uint32_t row, col, i;
+
+    memset(inv, 0, sizeof(inv));
+    for (i = 0; i < n; ++i) {
+        inv[i][i] = 1;
+    }
+
+    for (col = 0; col < n; ++col) {
+        row = col;
+        while (row < n && m[row][col] == 0) {
+            ++row;
+        }
+
+        if (row == n) {
+            return -EINVAL;
+        }
+
+        /* Swap a usable pivot in */
+        for (i = 0; row != col && i < n; ++i) {
+            t = m[row][i];
+            m[row][i] = m[col][i];
+            m[col][i] = t;
+            t = inv[row][i];
+            inv[row][i] = inv[col][i];
+            inv[col][i] = t;
+        }
+
+        c = gf_inv(m[col][col]);
+        for (i = 0; i < n; ++i) {
+            m[col][i] = gf_mul(m[col][i], c);
+            inv[col][i] = gf_mul(inv[col][i], c);
+        }
+
+        for (row = 0; row < n; ++row) {
+            if (row == col || (c = m[row][col]) == 0) {
+                continue;
+            }
+
+            for (i = 0; i < n; ++i) {
+                m[row][i] ^= gf_mul(m[col][i], c);
+                inv[row][i] ^= gf_mul(inv[col][i], c);
+            }
+        }
+    }
+
+    memcpy(m, inv, sizeof(inv));
+    return 0;
+}
+
+int
+fec_decode(uint32_t k, uint32_t r, uint8_t **src, uint64_t src_have,
+           const uint8_t *const *parity, uint64_t par_have, size_t len)
+{
+    uint8_t m[FEC_K_MAX][FEC_K_MAX], c;
+    uint32_t lost[FEC_K_MAX], rows[FEC_K_MAX];
+    uint32_t i, j, a, n = 0, nrows = 0;
+
+    if (k == 0 || k > FEC_K_MAX || r > FEC_R_MAX) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < k; ++i) {
+        if (!(src_have & (1ULL << i))) {
+            lost[n++] = i;
+        }
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    for (j = 0; j < r && nrows < n; ++j) {
+        if (par_have & (1ULL << j)) {
+            rows[nrows++] = j;
+        }
+    }
+
+    if (nrows < n) {
+        return -ENODATA;
+    }
+
+    /* What the repair blocks we use say about the lost ones */
+    for (a = 0; a < n; ++a) {
+        for (j = 0; j < n; ++j) {
+            m[a][j] = fec_coef(rows[a], lost[j]);
+        }
+    }
+
+    if (fec_invert(m, n) < 0) {
+        return -EINVAL;
+    }
+
+    /*
+     * lost[j] = sum(inv[j][a] * (parity[a] - known part of
+     * parity[a])), the known part being folded into one
+     * coefficient per source block we have.
+     */
+    for (j = 0; j < n; ++j) {
+        memset(src[lost[j]], 0, len);
+        for (a = 0; a < n; ++a) {
+            gf_mul_add(src[lost[j]], parity[rows[a]], m[j][a], len);
+        }
+
+        for (i = 0; i < k; ++i) {
+            if (!(src_have & (1ULL << i))) {
+                continue;
+            }
+
+            for (c = 0, a = 0; a < n; ++a) {
+                c ^= gf_mul(m[j][a], fec_coef(rows[a], i));
+            }
+            gf_mul_add(src[lost[j]], src[i], c, len);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CHAN_H
+#define CHAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "link.h"
+#include "dgram.h"
+
+/*
+ * Number of segments a channel may have in flight, and
+ * the number it buffers on the receive side. Sequence
+ * numbers count segments, not bytes.
+ */
+#define ONET_CHAN_WND 512
+
+/*
+ * Header in front of the data of every OTYPE_RDATA
+ * and OTYPE_RACK datagram (network byte order)
+ *
+ * @seq: Sequence number of this segment (OTYPE_RDATA)
+ * @ack: Next sequence number expected from the peer
+ * @sack: Segments received past `ack', bit N being
+ *        sequence number `ack' + 1 + N
+ * @tsval: Sender timestamp (us, never zero)
+ * @tsecr: Timestamp of the segment that last moved
+ *         `ack', echoed back for RTT samples
+ * @wnd: Number of segments the sender of this can take
+ *       past `ack'
+ * @flags: Segment flags (see CHAN_F_*)
+ */
+struct onet_chan_hdr {
+    uint32_t seq;
+    uint32_t ack;
+    uint64_t sack;
+    uint32_t tsval;
+    uint32_t tsecr;
+    uint16_t wnd;
+    uint16_t flags;
+} __attribute__((packed));
+
+/*
+ * Channel header flags
+ *
+ * @CHAN_F_SYN: First segment of a channel, the receiver
+ *              starts counting from its `seq'
+ * @CHAN_F_END: Last segment of a onet_chan_send() call
+ * @CHAN_F_ACK: The `ack' fields are valid
+ * @CHAN_F_PROBE: Window probe, answer with an ACK
+ */
+#define CHAN_F_SYN      (1 << 0)
+#define CHAN_F_END      (1 << 1)
+#define CHAN_F_ACK      (1 << 2)
+#define CHAN_F_PROBE    (1 << 3)
+
+struct chan_seg;
+
+/*
+ * Represents a reliable, ordered channel to a single peer
+ * on a port. Data is cut into segments that each fit in
+ * one frame; the sender keeps up to ONET_CHAN_WND of them
+ * in flight and repairs losses with selective ACKs, fast
+ * retransmit and an RTT based retransmission timer. A
+ * channel may only be used by one thread at a time.
+ *
+ * @link: Link the channel runs over
+ * @rxq: Receive queue of the channel port
+ * @peer: Address of the peer
+ * @port: Port the channel is bound to (on both ends)
+ * @mss: Max number of data bytes per segment
+ * @seg_size: Size of a segment buffer (header + data)
+ * @tx_arena: Send window segment buffers
+ * @tx_segs: State of each send window slot
+ * @isn: First sequence number we sent
+ * @snd_una: Oldest unacknowledged sequence number
+ * @snd_nxt: Next sequence number to send
+ * @snd_wnd: Window the peer last advertised
+ * @snd_fack: One past the highest sequence number the
+ *            peer is known to have
+ * @recover: `snd_nxt' when loss recovery started
+ * @in_recovery: Repairing losses found by the peer
+ * @dupacks: Number of duplicate ACKs in a row
+ * @srtt, @rttvar: Smoothed RTT and its variance (us)
+ * @rto: Retransmission timeout (us)
+ * @rto_at: When the retransmission timer fires (us, 0
+ *          if it is not running)
+ * @backoff: Number of timeouts in a row
+ * @rx_arena: Receive buffer segment buffers
+ * @rx_segs: State of each receive buffer slot
+ * @rx_isn: First sequence number the peer sent
+ * @rcv_nxt: Next in order sequence number expected
+ * @rx_read: Sequence number of the next segment to read
+ * @rx_off: Bytes of the `rx_read' segment already read
+ * @rx_adv: Window last advertised to the peer
+ * @rx_synced: Got the peer's first segment
+ * @ts_recent: Timestamp to echo back to the peer
+ * @ack_pending: Segments received since the last ACK
+ * @error: Set once the peer stopped answering
+ */
+struct onet_chan {
+    struct onet_link *link;
+    struct onet_port *rxq;
+    mac_addr_t peer;
+    uint8_t port;
+    uint16_t mss;
+    uint32_t seg_size;
+    char *tx_arena;
+    struct chan_seg *tx_segs;
+    uint32_t isn;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t snd_wnd;
+    uint32_t snd_fack;
+    uint32_t recover;
+    bool in_recovery;
+    uint32_t dupacks;
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+    uint64_t rto_at;
+    uint32_t backoff;
+    char *rx_arena;
+    struct chan_seg *rx_segs;
+    uint32_t rx_isn;
+    uint32_t rcv_nxt;
+    uint32_t rx_read;
+    uint32_t rx_off;
+    uint32_t rx_adv;
+    bool rx_synced;
+    uint32_t ts_recent;
+    uint32_t ack_pending;
+    int error;
+};
+
+/*
+ * Open a reliable channel to a peer. Both ends open a
+ * channel to each other on the same port; the port is
+ * bound on `link' (see dgram_bind()) until the channel
+ * is closed.
+ *
+ * @link: Link to run the channel over
+ * @peer: Address of the peer
+ * @port: Port to use
+ * @res: Channel to set up
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_chan_open(struct onet_link *link, mac_addr_t peer,
+                   uint8_t port, struct onet_chan *res);
+
+/*
+ * Close a channel, anything not yet acknowledged by the
+ * peer is dropped (see onet_chan_flush()).
+ *
+ * @ch: Channel to close
+ */
+void onet_chan_close(struct onet_chan *ch);
+
+/*
+ * Send data over a channel, waiting for room in the send
+ * window as needed. The data is copied, so `buf' may be
+ * reused as soon as this returns.
+ *
+ * @ch: Channel to send over
+ * @buf: The buffer containing data to send
+ * @len: Length of buffer to send
+ *
+ * Returns `len' on success, otherwise a less than zero
+ * value on failure (-ETIMEDOUT once the peer stopped
+ * answering).
+ */
+tx_len_t onet_chan_send(struct onet_chan *ch, const void *buf, uint32_t len);
+
+/*
+ * Receive data from a channel in order. This returns once
+ * `buf' is full or the end of the data of a single
+ * onet_chan_send() on the other end is reached, so a
+ * call never returns data of two sends.
+ *
+ * @ch: Channel to receive from
+ * @buf: Buffer to receive into
+ * @len: Size of `buf'
+ * @timeout: Max time to wait in ms (-1 to wait forever)
+ *
+ * Returns the number of bytes received on success, -EAGAIN
+ * if nothing came in time, otherwise a less than zero
+ * value on failure.
+ */
+rx_len_t onet_chan_recv(struct onet_chan *ch, void *buf, uint32_t len,
+                        int timeout);
+
+/*
+ * Wait until the peer acknowledged everything sent
+ * over a channel.
+ *
+ * @ch: Channel to flush
+ * @timeout: Max time to wait in ms (-1 to wait forever)
+ *
+ * Returns zero on success, -EAGAIN if the time ran out,
+ * otherwise a less than zero value on failure.
+ */
+int onet_chan_flush(struct onet_chan *ch, int timeout);
+
+#endif  /* !CHAN_H */
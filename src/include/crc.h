@@ -30,8 +30,88 @@
 #ifndef CRC_H
 #define CRC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/*
+ * CRC32 implementations
+ *
+ * @CRC32_IMPL_AUTO: Fastest one the CPU supports
+ * @CRC32_IMPL_TABLE: Byte at a time table lookup
+ * @CRC32_IMPL_SLICE8: Slicing-by-8 table lookup
+ * @CRC32_IMPL_SLICE16: Slicing-by-16 table lookup
+ * @CRC32_IMPL_HW: PCLMULQDQ folding on x86, CRC32
+ *                 instructions on ARMv8
+ *
+ * Every implementation returns bit-identical results,
+ * the fastest one is picked when the library is loaded.
+ */
+#define CRC32_IMPL_AUTO     0
+#define CRC32_IMPL_TABLE    1
+#define CRC32_IMPL_SLICE8   2
+#define CRC32_IMPL_SLICE16  3
+#define CRC32_IMPL_HW       4
+
+/*
+ * Compute the CRC32 of a buffer
+ *
+ * @buf: Buffer to checksum
+ * @size: Size of the buffer in bytes
+ */
 uint32_t crc32(const void *buf, size_t size);
 
+/*
+ * Continue a CRC32 over more data, such that
+ * crc32_update(crc32(a, n), b, m) is the CRC32 of
+ * `a' followed by `b'.
+ *
+ * @crc: CRC32 of the data so far
+ * @buf: Buffer to checksum
+ * @size: Size of the buffer in bytes
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size);
+
+/*
+ * Copy a buffer and continue a CRC32 over it in the
+ * same pass, so the data is only pulled through the
+ * cache once.
+ *
+ * @crc: CRC32 of the data so far
+ * @dst: Buffer to copy to
+ * @src: Buffer to copy (and checksum)
+ * @size: Number of bytes to copy
+ *
+ * Returns the updated CRC32.
+ */
+uint32_t crc32_copy(uint32_t crc, void *dst, const void *src, size_t size);
+
+/*
+ * Combine the CRC32s of two buffers into the CRC32 of
+ * both buffers back to back, without touching the data.
+ *
+ * @crc1: CRC32 of the first buffer
+ * @crc2: CRC32 of the second buffer
+ * @len2: Length of the second buffer in bytes
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/*
+ * Select the CRC32 implementation used by crc32()
+ *
+ * @impl: Implementation to use (see CRC32_IMPL_*)
+ *
+ * Returns zero on success, otherwise -ENOTSUP if it
+ * is not supported by this CPU.
+ */
+int crc32_select(int impl);
+
+/*
+ * Get the name of a CRC32 implementation
+ *
+ * @impl: Implementation (CRC32_IMPL_AUTO for the current one)
+ *
+ * Returns NULL if `impl' is not valid.
+ */
+const char *crc32_impl_name(int impl);
+
 #endif /* CRC_H */
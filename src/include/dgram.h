@@ -30,49 +30,167 @@
 #ifndef DGRAM_H
 #define DGRAM_H
 
+#include <sys/uio.h>
 #include <stdint.h>
 #include "if_ether.h"
 #include "link.h"
 
-typedef int16_t tx_len_t;
+typedef int32_t tx_len_t;
 typedef tx_len_t rx_len_t;
 
 /*
  * Represents an ONET datagram
  *
- * @length: Packet length in bytes
- * @reserved: Reserved for future use
+ * @length: Packet length in bytes (of this fragment)
+ * @frag_id: Fragment ID, shared by every fragment of a
+ *           datagram (see DGRAM_F_MF)
  * @type: Describes the type of packet (see OTYPE_*)
- * @reserved1: Reserved for future use
+ * @flags: Datagram flags (see DGRAM_F_*)
  * @port: Datagram port number to send on
- * @crc32: CRC32 checksum of data + header
+ * @crc32: CRC32 checksum of the header, and of the data
+ *         if DGRAM_F_PCRC is set
  */
 struct onet_dgram {
     uint16_t length;
-    uint16_t reserved;
+    uint16_t frag_id;
     uint8_t type : 3;
-    uint16_t reserved1 : 13;
+    uint16_t flags : 13;
     uint8_t port;
     uint32_t crc32;
 } __attribute__((packed));
 
+/*
+ * ONET datagram flags
+ *
+ * @DGRAM_F_PCRC: The CRC32 covers the data as well as the
+ *                header, receivers check both. Senders set
+ *                this on links with ONET_F_PCRC set.
+ * @DGRAM_F_MF: More fragments follow this one. Datagrams
+ *              too large for a single frame are split in
+ *              fragments of equal size (but the last), each
+ *              carrying its index in the upper flag bits.
+ *
+ * [ALL OTHER BITS ARE RESERVED]
+ */
+#define DGRAM_F_PCRC    (1 << 0)
+#define DGRAM_F_MF      (1 << 1)
+
+/*
+ * Fragment index bits of the datagram flags
+ */
+#define DGRAM_FRAG_SHIFT 2
+#define DGRAM_FRAG_MAX   (1 << (13 - DGRAM_FRAG_SHIFT))
+#define DGRAM_FRAG_IDX(flags) ((flags) >> DGRAM_FRAG_SHIFT)
+
+/*
+ * Returns true if a datagram header belongs to a fragment
+ */
+#define DGRAM_IS_FRAG(hdr) \
+    (((hdr)->flags & DGRAM_F_MF) != 0 || DGRAM_FRAG_IDX((hdr)->flags) != 0)
+
+/*
+ * Largest datagram that may be sent, larger ones
+ * are split in fragments.
+ */
+#define DGRAM_MSG_MAX (1 << 20)
+
+/*
+ * Describes a single datagram moved by
+ * dgram_send_batch() or dgram_recv_batch()
+ *
+ * @addr: Destination (send) or source (recv) address
+ * @buf: Buffer holding / receiving the data
+ * @len: Length of data to send or size of `buf'
+ * @status: Length of data moved, otherwise a less than
+ *          zero errno value
+ */
+struct dgram_vec {
+    mac_addr_t addr;
+    void *buf;
+    uint16_t len;
+    int status;
+};
+
+/*
+ * Represents a destination datagrams are sent to over and
+ * over (see dgram_connect()). The headers of every frame
+ * are built once, sends only fill in the length and patch
+ * the CRC for it.
+ *
+ * @link: Link to send through
+ * @dst: Destination address
+ * @port: Destination port
+ * @crc: CRC32 of the header with a zero length
+ * @hdr: Ethernet and ONET headers of every frame
+ */
+struct dgram_conn {
+    struct onet_link *link;
+    mac_addr_t dst;
+    uint8_t port;
+    uint32_t crc;
+    char hdr[sizeof(struct ether_hdr) + sizeof(struct onet_dgram)];
+};
+
 /*
  * ONET packet types
  *
  * @OTYPE_DATA: Regular data to be sent
  * @OTYPE_SQUEAK: For peer discovery
+ * @OTYPE_RDATA: Reliable channel data (see chan.h)
+ * @OTYPE_RACK: Reliable channel acknowledgement
+ * @OTYPE_MDATA: Reliable multicast data (see mcast.h)
+ * @OTYPE_MNACK: Reliable multicast repair request
+ * @OTYPE_MFEC: Reliable multicast FEC repair block
  *
  * [ALL OTHER VALUES ARE RESERVED]
  *
  *  -- Squeaks --
  *
  *  A machine may squeak at the wire and those whom the squeak is
- *  intended for shall squeak back. One thing to be aware of is that
- *  this may allow squeak storms / attacks where a machine continuously
- *  squeaks at a wire.
+ *  intended for shall squeak back. The first data byte tells a
+ *  squeak (SQUEAK_ASK) from an answer (SQUEAK_REPLY), answers are
+ *  never answered. Everyone heard squeaking goes in the neighbor
+ *  table of the link (see neigh.h), and squeaks are answered at a
+ *  limited rate so a machine continuously squeaking at a wire
+ *  cannot start a storm.
+ *
+ *  -- Reliable channels --
+ *
+ *  Channel traffic carries a `struct onet_chan_hdr' in front of
+ *  its data and is only ever handed to the channel bound to its
+ *  port, never to dgram_recv() and friends. The same goes for
+ *  reliable multicast traffic and its `struct onet_mcast_hdr'.
  */
 #define OTYPE_DATA      0x0
 #define OTYPE_SQUEAK    0x1
+#define OTYPE_RDATA     0x2
+#define OTYPE_RACK      0x3
+#define OTYPE_MDATA     0x4
+#define OTYPE_MNACK     0x5
+#define OTYPE_MFEC      0x6
+
+/*
+ * Squeak kinds (first data byte of an OTYPE_SQUEAK)
+ */
+#define SQUEAK_ASK      0x0
+#define SQUEAK_REPLY    0x1
+
+/*
+ * Ethernet multicast address of ONET group `id' (24 bits):
+ * 03:4F:4E, a locally administered multicast prefix,
+ * followed by the group ID.
+ */
+#define DGRAM_GROUP_ADDR(id) (0x034F4E000000ULL | ((id) & 0xFFFFFF))
+
+/*
+ * Port used by calls that do not take one
+ */
+#define DGRAM_PORT_DEFAULT 50
+
+/*
+ * Max number of data pieces dgram_sendv() takes
+ */
+#define DGRAM_IOV_MAX 64
 
 /*
  * Get the total length of a datagram including
@@ -113,7 +231,9 @@ int dgram_load(
 );
 
 /*
- * Send a datagram through ONET
+ * Send a datagram through ONET. Datagrams that do not fit
+ * in a single frame are fragmented (up to DGRAM_MSG_MAX
+ * bytes) and put back together by the receiver.
  *
  * @link: The ONET link to send data over
  * @dst: Destination address to send to
@@ -125,9 +245,196 @@ int dgram_load(
  */
 tx_len_t dgram_send(
     struct onet_link *link, mac_addr_t dst,
-    void *buf, uint16_t len
+    void *buf, uint32_t len
+);
+
+/*
+ * Send a datagram whose data is scattered across several
+ * buffers. The headers are built on the stack and handed
+ * to sendmsg() along with the caller's buffers, so the
+ * data is never copied in userspace.
+ *
+ * @link: The ONET link to send data over
+ * @dst: Destination address to send to
+ * @iov: Pieces of data to send, in order
+ * @iovcnt: Number of pieces (at most DGRAM_IOV_MAX)
+ *
+ * Returns the number of bytes transmitted on success, otherwise
+ * a less than zero value on failure.
+ */
+tx_len_t dgram_sendv(
+    struct onet_link *link, mac_addr_t dst,
+    const struct iovec *iov, int iovcnt
+);
+
+/*
+ * Borrow a TX frame from the link pool. The caller writes
+ * up to `link->mtu - sizeof(struct onet_dgram)' bytes of data
+ * in place at DGRAM_DATA(p), then passes the frame to
+ * dgram_submit() (or dgram_free() to drop it).
+ *
+ * @link: Link the frame will be sent through
+ *
+ * Returns the start of the frame, otherwise NULL if
+ * no memory is left.
+ */
+char *dgram_alloc(struct onet_link *link);
+
+/*
+ * Build the headers of a frame from dgram_alloc() in
+ * place and send it. The frame goes back to the pool
+ * either way.
+ *
+ * @link: The ONET link to send data over
+ * @dst: Destination address to send to
+ * @p: Frame returned by dgram_alloc()
+ * @len: Length of the data at DGRAM_DATA(p)
+ *
+ * Returns the number of bytes transmitted on success, otherwise
+ * a less than zero value on failure (-EMSGSIZE if `len' does
+ * not fit in the frame).
+ */
+tx_len_t dgram_submit(
+    struct onet_link *link, mac_addr_t dst,
+    char *p, uint32_t len
+);
+
+/*
+ * Give an unsent frame from dgram_alloc() back
+ *
+ * @link: Link the frame was borrowed from
+ * @p: Frame to give back
+ */
+void dgram_free(struct onet_link *link, char *p);
+
+/*
+ * Send a datagram to a specific port
+ *
+ * @link: The ONET link to send data over
+ * @dst: Destination address to send to
+ * @port: Destination port
+ * @buf: The buffer containing data to send
+ * @len: Length of buffer to send
+ *
+ * Returns the number of bytes transmitted on success, otherwise
+ * a less than zero value on failure.
+ */
+tx_len_t dgram_sendto(
+    struct onet_link *link, mac_addr_t dst,
+    uint8_t port, void *buf, uint32_t len
+);
+
+/*
+ * Set up a connected destination for sending many datagrams
+ * to the same port of the same machine. Whether the CRC
+ * covers the data (ONET_F_PCRC) is fixed at this point.
+ * There is nothing to release once done with it.
+ *
+ * @link: The ONET link to send data over
+ * @dst: Destination address to send to
+ * @port: Destination port
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int dgram_connect(
+    struct onet_link *link, mac_addr_t dst,
+    uint8_t port, struct dgram_conn *res
+);
+
+/*
+ * Send a datagram to a connected destination, like
+ * dgram_sendto() does but without building the headers
+ *
+ * @conn: Destination set up by dgram_connect()
+ * @buf: The buffer containing data to send
+ * @len: Length of buffer to send
+ *
+ * Returns the number of bytes transmitted on success, otherwise
+ * a less than zero value on failure.
+ */
+tx_len_t dgram_conn_send(struct dgram_conn *conn, const void *buf,
+                         uint32_t len);
+
+/*
+ * Bind a port on a link. Received datagrams are classified
+ * once and queued on the port they were sent to, so each
+ * service only ever reads its own traffic. Whichever thread
+ * waits on an empty queue first does the demultiplexing for
+ * everyone else.
+ *
+ * Once a port is bound, dgram_recv() only returns datagrams
+ * sent to ports that are not bound, and dgram_recv_batch()
+ * may no longer be used on the link.
+ *
+ * @link: Link to bind the port on
+ * @port: Port number to bind
+ * @depth: Number of datagrams the queue holds (rounded
+ *         up to a power of two, 0 for the default)
+ *
+ * Returns zero on success, otherwise a less than zero value
+ * on failure (-EADDRINUSE if the port is already bound).
+ */
+int dgram_bind(struct onet_link *link, uint8_t port, uint32_t depth);
+
+/*
+ * Unbind a port, no thread may be receiving on it. Ports
+ * still bound when the link is closed are freed with it.
+ *
+ * @link: Link the port is bound on
+ * @port: Port number to unbind
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int dgram_unbind(struct onet_link *link, uint8_t port);
+
+/*
+ * Get a datagram sent to a bound port, only one thread
+ * may receive on a given port at a time.
+ *
+ * @link: The ONET link the port is bound on
+ * @port: The port to recv from
+ * @buf: The buffer to recv data into
+ * @len: Size of `buf'
+ * @src: If non-NULL, the source address is written here
+ *
+ * Returns the number of bytes written to `buf' on success,
+ * otherwise a less than zero value on failure (-EAGAIN if
+ * the link is non-blocking and nothing is queued).
+ */
+rx_len_t dgram_port_recv(
+    struct onet_link *link, uint8_t port,
+    void *buf, uint32_t len, mac_addr_t *src
 );
 
+/*
+ * Join a multicast group on a link. The NIC is told to
+ * take frames sent to the group (PACKET_ADD_MEMBERSHIP)
+ * and the link filter lets them through to the receive
+ * calls. Groups may be joined more than once, they are
+ * left once every join was undone.
+ *
+ * @link: Link to join the group on
+ * @group: Multicast address of the group (see DGRAM_GROUP_ADDR())
+ *
+ * Returns zero on success, otherwise a less than zero value
+ * on failure (-ENOSPC if ONET_GROUP_MAX groups are joined).
+ */
+int dgram_join(struct onet_link *link, mac_addr_t group);
+
+/*
+ * Leave a multicast group joined with dgram_join()
+ *
+ * @link: Link the group was joined on
+ * @group: Multicast address of the group
+ *
+ * Returns zero on success, otherwise a less than zero value
+ * on failure (-ENOENT if the group was not joined).
+ */
+int dgram_leave(struct onet_link *link, mac_addr_t group);
+
 /*
  * Send a squeak through a wire
  *
@@ -140,12 +447,120 @@ tx_len_t dgram_send(
 tx_len_t dgram_squeak(struct onet_link *link, mac_addr_t dst);
 
 /*
- * Get data from an ONET link
+ * Get data from an ONET link, this returns -EAGAIN right
+ * away if nothing is there and the link is non-blocking
+ * (see ONET_F_NONBLOCK).
+ *
+ * Only one thread may receive from a link at a time, the
+ * fragments it is putting back together are not locked.
+ * Use dgram_bind() to have several threads receive.
  *
  * @link: The ONET link to recv data from
  * @buf: The buffer to recv data into
  * @len: The length of expected data
+ *
+ * Returns the number of bytes written to `buf' on success,
+ * the datagram is cut short if it is longer than `len'.
+ * Otherwise a less than zero value on failure.
+ */
+rx_len_t dgram_recv(struct onet_link *link, void *buf, uint32_t len);
+
+/*
+ * Get data from an ONET link, giving up after a while
+ *
+ * @link: The ONET link to recv data from
+ * @buf: The buffer to recv data into
+ * @len: The length of expected data
+ * @timeout: Timeout in ms (0 to poll, -1 to wait forever)
+ *
+ * Returns -EAGAIN if nothing was received in time,
+ * otherwise the same as dgram_recv().
+ */
+rx_len_t dgram_recv_timed(
+    struct onet_link *link, void *buf,
+    uint32_t len, int timeout
+);
+
+/*
+ * Send a batch of datagrams through ONET, moving up to
+ * 64 datagrams per syscall. The headers are built on
+ * the stack and the data is sent straight out of each
+ * entry's buffer.
+ *
+ * @link: The ONET link to send data over
+ * @vec: Datagrams to send (see `struct dgram_vec')
+ * @count: Number of entries in `vec'
+ *
+ * Returns the number of datagrams sent on success, otherwise
+ * a less than zero value on failure. The status of every
+ * entry is written to its `status' field. Links not on a
+ * packet socket send one datagram at a time.
+ */
+int dgram_send_batch(
+    struct onet_link *link, struct dgram_vec *vec,
+    unsigned int count
+);
+
+/*
+ * Receive a batch of datagrams from an ONET link with a
+ * single syscall. This waits for the first datagram, then
+ * takes whatever else is already queued, up to 64 of them.
+ *
+ * @link: The ONET link to recv data from
+ * @vec: Buffers to recv into (see `struct dgram_vec')
+ * @count: Number of entries in `vec'
+ *
+ * Returns the number of datagrams received on success,
+ * otherwise a less than zero value on failure. Entries
+ * that did not get a datagram have `status' set to -EAGAIN.
+ * On a non-blocking link this returns -EAGAIN instead of
+ * waiting for the first datagram. If any port is bound
+ * (see dgram_bind()), -EBUSY is returned. Fragments are
+ * skipped, datagrams larger than a frame need dgram_recv().
+ * Links not on a packet socket return -ENOTSUP.
+ */
+int dgram_recv_batch(
+    struct onet_link *link, struct dgram_vec *vec,
+    unsigned int count
+);
+
+/*
+ * Reserve the next slot of the link TX ring and build a
+ * datagram header for it in place. The caller writes `len'
+ * bytes of data to the returned pointer, then calls
+ * dgram_tx_commit(). Committed slots are transmitted by
+ * the next dgram_tx_flush(). Other threads sending through
+ * the link wait until the slot is committed.
+ *
+ * @link: Link with a TX ring (see onet_txring_init())
+ * @dst: Destination address to send to
+ * @len: Length of the data that will be written
+ *
+ * Returns a pointer to the data area of the slot on success,
+ * otherwise NULL with errno set.
+ */
+char *dgram_tx_begin(struct onet_link *link, mac_addr_t dst, uint16_t len);
+
+/*
+ * Hand the slot returned by the last dgram_tx_begin()
+ * to the kernel.
+ *
+ * @link: Link with a TX ring
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int dgram_tx_commit(struct onet_link *link);
+
+/*
+ * Transmit every committed TX ring slot with a single
+ * send() kick.
+ *
+ * @link: Link with a TX ring
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
  */
-rx_len_t dgram_recv(struct onet_link *link, void *buf, uint16_t len);
+int dgram_tx_flush(struct onet_link *link);
 
 #endif  /* DGRAM_H */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * GF(2^8) region kernel implementations
+ *
+ * @FEC_IMPL_AUTO: Fastest one the CPU supports
+ * @FEC_IMPL_SCALAR: Byte at a time table lookup
+ * @FEC_IMPL_SSSE3: 16 bytes at a time, PSHUFB nibble lookups
+ * @FEC_IMPL_AVX2: 32 bytes at a time, VPSHUFB nibble lookups
+ *
+ * Every implementation returns bit-identical results,
+ * the fastest one is picked when the library is loaded.
+ */
+#define FEC_IMPL_AUTO       0
+#define FEC_IMPL_SCALAR     1
+#define FEC_IMPL_SSSE3      2
+#define FEC_IMPL_AVX2       3
+
+/*
+ * Max number of source and repair blocks per group
+ */
+#define FEC_K_MAX 64
+#define FEC_R_MAX 64
+
+/*
+ * Multiply two GF(2^8) elements (polynomial 0x11D)
+ */
+uint8_t gf_mul(uint8_t a, uint8_t b);
+
+/*
+ * Get the multiplicative inverse of a non-zero
+ * GF(2^8) element
+ */
+uint8_t gf_inv(uint8_t a);
+
+/*
+ * Multiply a region by a constant and add (XOR) it
+ * to another one: dst[i] ^= c * src[i]
+ *
+ * @dst: Region to add to
+ * @src: Region to multiply
+ * @c: Constant to multiply by
+ * @len: Length of both regions in bytes
+ */
+void gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+/*
+ * Get the coefficient source block `col' is multiplied
+ * by in repair block `row'. These form a Cauchy matrix,
+ * so any K blocks out of the K source and R repair
+ * blocks of a group are enough to get the sources back.
+ *
+ * @row: Repair block index (< FEC_R_MAX)
+ * @col: Source block index (< FEC_K_MAX)
+ */
+uint8_t fec_coef(uint32_t row, uint32_t col);
+
+/*
+ * Compute the repair blocks of a group (systematic
+ * Reed-Solomon, Cauchy matrix)
+ *
+ * @k: Number of source blocks
+ * @r: Number of repair blocks
+ * @src: Source blocks
+ * @parity: Repair blocks to fill in
+ * @len: Length of every block in bytes
+ *
+ * Returns zero on success, otherwise -EINVAL if `k'
+ * or `r' are out of range.
+ */
+int fec_encode(uint32_t k, uint32_t r, const uint8_t *const *src,
+               uint8_t **parity, size_t len);
+
+/*
+ * Get the missing source blocks of a group back from
+ * the repair blocks
+ *
+ * @k: Number of source blocks
+ * @r: Number of repair blocks
+ * @src: Source blocks, the missing ones are filled in
+ * @src_have: Source blocks we have (bit N for `src[N]')
+ * @parity: Repair blocks
+ * @par_have: Repair blocks we have (bit N for `parity[N]')
+ * @len: Length of every block in bytes
+ *
+ * Returns zero on success, -ENODATA if fewer than `k'
+ * blocks are had, otherwise -EINVAL.
+ */
+int fec_decode(uint32_t k, uint32_t r, uint8_t **src, uint64_t src_have,
+               const uint8_t *const *parity, uint64_t par_have, size_t len);
+
+/*
+ * Select the region kernel used by gf_mul_add()
+ *
+ * @impl: Implementation to use (see FEC_IMPL_*)
+ *
+ * Returns zero on success, otherwise -ENOTSUP if it
+ * is not supported by this CPU.
+ */
+int fec_select(int impl);
+
+/*
+ * Get the name of a region kernel implementation
+ *
+ * @impl: Implementation (FEC_IMPL_AUTO for the current one)
+ *
+ * Returns NULL if `impl' is not valid.
+ */
+const char *fec_impl_name(int impl);
+
+#endif /* FEC_H */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "link.h"
+#include "dgram.h"
+
+/*
+ * How frames are spread over the links of a group
+ *
+ * @ONET_FANOUT_HASH: By sender, so each sender is always
+ *                    handled by the same worker and its
+ *                    datagrams stay in order
+ * @ONET_FANOUT_CPU: By the CPU the frame was received on
+ *                   (needs RSS or RPS on the interface)
+ * @ONET_FANOUT_LB: Round robin
+ */
+#define ONET_FANOUT_HASH 0
+#define ONET_FANOUT_CPU  1
+#define ONET_FANOUT_LB   2
+
+/*
+ * Called by a group worker for every datagram received
+ *
+ * @link: Link (of the group) the datagram came in on
+ * @buf: Datagram data
+ * @len: Length of the datagram data
+ * @arg: Argument given to onet_group_start()
+ */
+typedef void (*onet_group_fn)(
+    struct onet_link *link, void *buf,
+    rx_len_t len, void *arg
+);
+
+/*
+ * Represents a group of links on the same interface
+ * joined in a PACKET_FANOUT group so that received
+ * frames are spread over all of them.
+ *
+ * @links: Links of the group
+ * @workers: Worker thread of each link (once started)
+ * @nlinks: Number of links in the group
+ * @nworkers: Number of running workers
+ * @fn: Worker callback
+ * @arg: Argument passed to `fn'
+ */
+struct onet_group {
+    struct onet_link *links;
+    pthread_t *workers;
+    uint32_t nlinks;
+    uint32_t nworkers;
+    onet_group_fn fn;
+    void *arg;
+};
+
+/*
+ * Open a group of links on an interface. RX rings may be
+ * set up on each link before the group is started, ports
+ * may not be bound on them.
+ *
+ * @iface: The interface the group should be for
+ * @nlinks: Number of links (usually one per core)
+ * @mode: How to spread frames (ONET_FANOUT_*)
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_group_open(
+    const char *iface, uint32_t nlinks,
+    int mode, struct onet_group *res
+);
+
+/*
+ * Start a worker thread per link of a group, each pinned
+ * to its own CPU (round robin over the CPUs we may run on).
+ * Workers accept datagrams on their link like dgram_recv()
+ * does and pass each one to `fn'. With an RX ring, `buf'
+ * points into the ring and is only valid until `fn' returns.
+ *
+ * @grp: Group to start
+ * @fn: Callback to run for each datagram
+ * @arg: Argument passed to `fn'
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_group_start(struct onet_group *grp, onet_group_fn fn, void *arg);
+
+/*
+ * Stop the workers of a group and close its links
+ *
+ * @grp: Group to close
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_group_close(struct onet_group *grp);
+
+#endif  /* !GROUP_H */
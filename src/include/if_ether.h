@@ -38,6 +38,12 @@
 
 typedef uint64_t mac_addr_t;
 
+/*
+ * Returns true if `addr' is a multicast (group) address,
+ * the broadcast address being one too
+ */
+#define MAC_IS_MULTICAST(addr) ((((addr) >> 40) & 1) != 0)
+
 struct ether_hdr {
     uint8_t dest[HW_ADDR_LEN];
     uint8_t source[HW_ADDR_LEN];
@@ -30,13 +30,282 @@
 #ifndef LINK_H
 #define LINK_H
 
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "if_ether.h"
 
+/*
+ * Represents a PACKET_MMAP ring mapped on the
+ * link socket.
+ *
+ * @base: Start of the ring within the link mapping
+ * @size: Size of the ring in bytes
+ * @frame_size: Size of a single frame slot
+ * @frame_nr: Number of frame slots in the ring
+ * @block_size: Size of a block (the RX ring is walked
+ *              by block)
+ * @block_nr: Number of blocks in the ring
+ * @head: Index of the next frame slot (TX) or block (RX)
+ *        to use
+ * @cur: Next frame to read within the current RX block
+ * @cur_left: Frames left to read within the current RX block
+ */
+struct onet_ring {
+    char *base;
+    size_t size;
+    uint32_t frame_size;
+    uint32_t frame_nr;
+    uint32_t block_size;
+    uint32_t block_nr;
+    uint32_t head;
+    char *cur;
+    uint32_t cur_left;
+};
+
+/*
+ * Represents a pool of preallocated, cache aligned frame
+ * buffers with a lock-free freelist.
+ *
+ * @arena: Backing memory of every frame
+ * @next: Freelist link of each frame (by index)
+ * @top: Freelist head (index and ABA tag)
+ * @frame_size: Size of each frame in bytes
+ * @frame_nr: Number of frames in the pool
+ */
+struct onet_pool {
+    char *arena;
+    uint32_t *next;
+    uint64_t top;
+    uint32_t frame_size;
+    uint32_t frame_nr;
+};
+
+/*
+ * Represents one of the single producer, single consumer
+ * rings of an AF_XDP socket (mapped from the kernel).
+ *
+ * @producer: Producer index
+ * @consumer: Consumer index
+ * @flags: Ring flags (XDP_RING_NEED_WAKEUP)
+ * @ring: Ring entries
+ * @map: Mapping of the ring
+ * @map_len: Length of the mapping in bytes
+ * @mask: Number of entries minus one
+ */
+struct onet_xring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *ring;
+    void *map;
+    size_t map_len;
+    uint32_t mask;
+};
+
+/*
+ * Represents an AF_XDP socket bound to queue 0 of the
+ * link interface. The UMEM is split in two, the first
+ * half goes to the fill ring and the second half is
+ * used for sending.
+ *
+ * @fd: AF_XDP socket
+ * @map_fd: XSKMAP the XDP program redirects through
+ * @prog_fd: XDP program
+ * @link_fd: BPF link attaching the program to the interface
+ * @umem: UMEM area
+ * @umem_len: Length of the UMEM area in bytes
+ * @frame_size: Size of each UMEM frame
+ * @frame_nr: Number of UMEM frames
+ * @fill: Fill ring (frames for the kernel to receive into)
+ * @comp: Completion ring (frames the kernel is done sending)
+ * @rx: Receive ring
+ * @tx: Transmit ring
+ * @rx_cur: UMEM address of the frame last handed out by
+ *          dgram_rx_next() (UINT64_MAX if none)
+ * @tx_free: Free send frames (by UMEM address)
+ * @tx_nfree: Number of free send frames
+ */
+struct onet_xsk {
+    int fd;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    char *umem;
+    size_t umem_len;
+    uint32_t frame_size;
+    uint32_t frame_nr;
+    struct onet_xring fill;
+    struct onet_xring comp;
+    struct onet_xring rx;
+    struct onet_xring tx;
+    uint64_t rx_cur;
+    uint64_t *tx_free;
+    uint32_t tx_nfree;
+};
+
+struct onet_port;
+struct onet_reasm;
+struct onet_neigh_tab;
+struct onet_shm;
+struct onet_shm_peer;
+struct onet_stats_page;
+struct onet_tstamp_state;
+
+/*
+ * Number of co-located peers a link may send to, and
+ * receive from, through shared memory (see onet_shm_attach())
+ */
+#define ONET_SHM_PEERS 16
+
+/*
+ * Number of frames a shared memory ring holds
+ * (a power of two)
+ */
+#define ONET_SHM_DEPTH 512
+
+/*
+ * Number of ports on a link
+ */
+#define ONET_PORT_MAX 256
+
+/*
+ * Number of multicast groups a link may join
+ */
+#define ONET_GROUP_MAX 16
+
+/*
+ * ONET link flags, these may be set by the user
+ * once the link is open.
+ *
+ * @ONET_F_PCRC: Cover the data of every datagram sent with
+ *               its CRC32 as well (see DGRAM_F_PCRC)
+ * @ONET_F_NONBLOCK: Receive calls that do not take a timeout
+ *                   return -EAGAIN instead of waiting
+ */
+#define ONET_F_PCRC     (1 << 0)
+#define ONET_F_NONBLOCK (1 << 1)
+
+/*
+ * ONET link open flags (see onet_open_flags())
+ *
+ * @ONET_O_XDP: Receive (and send through dgram_send()) with
+ *              an AF_XDP socket instead of the packet socket.
+ *              ONET frames are redirected to it by an XDP
+ *              program in generic (SKB) mode, everything else
+ *              goes on to the kernel as usual. Like with an RX
+ *              ring, one thread receives at a time (see
+ *              onet_rxring_init()).
+ */
+#define ONET_O_XDP (1 << 0)
+
+struct onet_link;
+
+/*
+ * Represents the way whole frames get on and off the
+ * wire of a link. Links opened with onet_open() go
+ * through a packet socket (onet_packet_transport), and
+ * only those can have rings, an AF_XDP socket, fanout
+ * groups, an event loop or an io_uring.
+ *
+ * @name: Name of the transport
+ * @send: Send a frame, returns its length on success,
+ *        otherwise a less than zero errno value
+ * @recv: Receive a frame into `p' (`len' bytes long),
+ *        waiting up to `timeout' ms (-1 for ever). Returns
+ *        the frame length on success, -EAGAIN if nothing
+ *        came in time, otherwise a less than zero errno value
+ * @close: Release whatever the transport holds for a link
+ */
+struct onet_transport {
+    const char *name;
+    ssize_t (*send)(struct onet_link *link, const void *p, size_t len);
+    ssize_t (*recv)(struct onet_link *link, void *p, size_t len, int timeout);
+    void (*close)(struct onet_link *link);
+};
+
+/*
+ * Packet socket transport of links opened with onet_open()
+ */
+extern const struct onet_transport onet_packet_transport;
+
+/*
+ * Returns true if a link goes through a packet socket
+ */
+#define ONET_LINK_PACKET(link) ((link)->tp == &onet_packet_transport)
+
+/*
+ * Represents an ONET link
+ *
+ * @tp: Transport frames go through
+ * @tp_priv: Transport state (not used by packet sockets)
+ * @sockfd: Raw socket bound to the interface (-1 if the
+ *          link does not go through a packet socket)
+ * @iface_idx: Interface index
+ * @mtu: Interface MTU in bytes
+ * @flags: Link flags (see ONET_F_*)
+ * @hwaddr: Hardware address of the interface
+ * @map: PACKET_MMAP mapping holding every ring
+ * @map_len: Length of the mapping in bytes
+ * @pool: MTU sized frames used by the send and receive paths
+ * @rx_ring: Receive ring (if `rx_ring.base' is non-NULL)
+ * @tx_ring: Transmit ring (if `tx_ring.base' is non-NULL)
+ * @tx_lock: Held while a TX ring slot or AF_XDP send frame is
+ *     claimed and filled
+ * @rx_lock: Held by whoever is demultiplexing received frames
+ * @nports: Number of bound ports
+ * @port_any: Queue for frames to unbound ports (see dgram_recv()),
+ *     allocated on the first dgram_bind() and kept until onet_close()
+ * @ports: Bound ports by number
+ * @xsk: AF_XDP socket (if opened with ONET_O_XDP)
+ * @frag_seq: Last fragment ID used for sending
+ * @reasm: Fragment reassembly state (see onet_reasm_init())
+ * @neigh: Neighbors heard squeaking (allocated on demand)
+ * @group_lock: Held while groups are joined or left
+ * @ngroups: Number of multicast groups joined
+ * @groups: Multicast groups joined (see dgram_join())
+ * @group_refs: Number of times each group was joined
+ * @shm: Local delivery state (see onet_shm_attach())
+ * @stats: Counters (see stats.h), NULL if they could
+ *         not be allocated
+ * @stats_old: Counters in use before they were published
+ * @stats_pub: Length of the published stats page, zero if
+ *             `stats' is not one
+ * @tstamp: Timestamping state (see onet_tstamp_enable())
+ */
 struct onet_link {
+    const struct onet_transport *tp;
+    void *tp_priv;
     int sockfd;
     uint32_t iface_idx;
+    uint32_t mtu;
+    uint32_t flags;
     mac_addr_t hwaddr;
+    void *map;
+    size_t map_len;
+    struct onet_pool pool;
+    struct onet_ring rx_ring;
+    struct onet_ring tx_ring;
+    pthread_mutex_t tx_lock;
+    uint32_t rx_lock;
+    uint32_t nports;
+    struct onet_port *port_any;
+    struct onet_port *ports[ONET_PORT_MAX];
+    struct onet_xsk *xsk;
+    uint16_t frag_seq;
+    struct onet_reasm *reasm;
+    struct onet_neigh_tab *neigh;
+    uint8_t group_lock;
+    uint32_t ngroups;
+    mac_addr_t groups[ONET_GROUP_MAX];
+    uint32_t group_refs[ONET_GROUP_MAX];
+    struct onet_shm *shm;
+    struct onet_stats_page *stats;
+    struct onet_stats_page *stats_old;
+    size_t stats_pub;
+    struct onet_tstamp_state *tstamp;
 };
 
 /*
@@ -50,6 +319,34 @@ struct onet_link {
  */
 int onet_open(const char *iface, struct onet_link *res);
 
+/*
+ * Open an ONET link with open flags
+ *
+ * @iface: The interface the link should be for
+ * @flags: Open flags (see ONET_O_*)
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_open_flags(const char *iface, uint32_t flags, struct onet_link *res);
+
+/*
+ * Open an ONET link on a transport other than a packet
+ * socket (see struct onet_transport)
+ *
+ * @tp: Transport to use
+ * @priv: Transport state of the link (see `tp_priv')
+ * @hwaddr: Hardware address of the link
+ * @mtu: MTU of the link in bytes
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_open_tp(const struct onet_transport *tp, void *priv,
+                 mac_addr_t hwaddr, uint32_t mtu, struct onet_link *res);
+
 /*
  * Close an ONET link
  *
@@ -60,4 +357,255 @@ int onet_open(const char *iface, struct onet_link *res);
  */
 int onet_close(struct onet_link *olp);
 
+/*
+ * (Re)build the classic BPF program of a link and attach
+ * it to the link socket. The program drops every frame
+ * that is not an ONET frame addressed to the link hardware
+ * address, to the broadcast address or to a multicast group
+ * the link joined, so they are never copied to userspace.
+ *
+ * @link: Link to attach the filter to
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_filter_attach(struct onet_link *link);
+
+/*
+ * Set up a frame pool
+ *
+ * @pool: Pool to set up
+ * @frame_size: Size of each frame (rounded up to a cache line)
+ * @frame_nr: Number of frames
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_pool_init(struct onet_pool *pool, uint32_t frame_size, uint32_t frame_nr);
+
+/*
+ * Release the memory of a frame pool
+ *
+ * @pool: Pool to release
+ */
+void onet_pool_free(struct onet_pool *pool);
+
+/*
+ * Take a frame out of a pool, this is safe to call
+ * from any number of threads at once.
+ *
+ * @pool: Pool to take a frame from
+ *
+ * Returns NULL if the pool is empty.
+ */
+char *onet_pool_get(struct onet_pool *pool);
+
+/*
+ * Give a frame back to the pool it came from
+ *
+ * @pool: Pool the frame belongs to
+ * @p: Frame returned by onet_pool_get()
+ */
+void onet_pool_put(struct onet_pool *pool, char *p);
+
+/*
+ * Returns true if `p' is a frame of `pool'
+ */
+bool onet_pool_owns(const struct onet_pool *pool, const char *p);
+
+/*
+ * Map a PACKET_TX_RING on a link. Once the ring is
+ * mapped, every datagram sent through the link is
+ * built directly within a ring slot and handed to the
+ * kernel with a single send() kick, see dgram_tx_begin().
+ *
+ * @link: Link to map the ring on
+ * @frame_nr: Number of frame slots (0 for the default)
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_txring_init(struct onet_link *link, uint32_t frame_nr);
+
+/*
+ * Map a TPACKET_V3 PACKET_RX_RING on a link. Once the
+ * ring is mapped, dgram_recv() walks whole blocks of
+ * frames filled in by the kernel and only sleeps in
+ * poll() once it runs out of them.
+ *
+ * The position within the ring is kept in the link and
+ * is not locked, so only one thread may receive on a
+ * link with an RX ring (dgram_recv() and friends, batch
+ * receives, event loops and fanout groups alike). Threads
+ * receiving on bound ports (see dgram_bind()) are fine,
+ * only one of them reads the ring at a time.
+ *
+ * @link: Link to map the ring on
+ * @block_nr: Number of blocks (0 for the default)
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_rxring_init(struct onet_link *link, uint32_t block_nr);
+
+/*
+ * Unmap every ring mapped on a link
+ *
+ * @link: Link to unmap rings from
+ */
+void onet_ring_free(struct onet_link *link);
+
+/*
+ * Set up an AF_XDP socket on a link and attach the XDP
+ * program that feeds it, see ONET_O_XDP.
+ *
+ * @link: Link to set up the socket on
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_xsk_open(struct onet_link *link);
+
+/*
+ * Set up the fragment reassembly state of a link
+ *
+ * @link: Link to set up reassembly for
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int onet_reasm_init(struct onet_link *link);
+
+/*
+ * Drop every fragment a link is holding on to
+ *
+ * @link: Link to release the reassembly state of
+ */
+void onet_reasm_free(struct onet_link *link);
+
+/*
+ * Forget every neighbor of a link
+ *
+ * @link: Link to release the neighbor table of
+ */
+void onet_neigh_free(struct onet_link *link);
+
+/*
+ * Free every port queue of a link, bound or not
+ *
+ * @link: Link to release the port queues of
+ */
+void onet_port_free(struct onet_link *link);
+
+/*
+ * Release the timestamping state of a link
+ *
+ * @link: Link to release the timestamping state of
+ */
+void onet_tstamp_free(struct onet_link *link);
+
+/*
+ * Set up the counters of a link, the link works
+ * without them if this fails
+ *
+ * @link: Link to set up the counters of
+ */
+void onet_stats_init(struct onet_link *link);
+
+/*
+ * Release the counters of a link, taking its stats
+ * page down if it was published
+ *
+ * @link: Link to release the counters of
+ */
+void onet_stats_free(struct onet_link *link);
+
+/*
+ * Pick the counter set (see `struct onet_stats_page')
+ * the calling thread bumps
+ */
+uint32_t onet_stats_slot(void);
+
+/*
+ * Counter set of the calling thread, plus one (zero
+ * until it is picked with onet_stats_slot())
+ */
+extern __thread uint32_t onet_stats_idx;
+
+/*
+ * Turn on local delivery for a link. Frames for another
+ * process on this machine that did the same on its link
+ * are copied straight into a shared memory ring (a memfd
+ * handed over once per peer) instead of going through the
+ * NIC. Peers are found by hardware address, so this
+ * needs every process to be on a link of its own, and
+ * may not be used along with an RX ring or ONET_O_XDP.
+ * Event loops, io_uring and fanout groups do not see
+ * locally delivered frames.
+ *
+ * @link: Link to turn local delivery on for
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error (-EADDRINUSE if another process already
+ * did it for the same hardware address).
+ */
+int onet_shm_attach(struct onet_link *link);
+
+/*
+ * Turn local delivery off and unmap every ring
+ *
+ * @link: Link to turn local delivery off for
+ */
+void onet_shm_close(struct onet_link *link);
+
+/*
+ * Get the peer a frame to `dst' may be delivered to
+ * through shared memory
+ *
+ * @link: Link with local delivery on
+ * @dst: Destination address
+ *
+ * Returns NULL if `dst' is not a co-located peer.
+ */
+struct onet_shm_peer *onet_shm_peer(struct onet_link *link, mac_addr_t dst);
+
+/*
+ * Reserve room for a frame in the ring of a peer, it
+ * has to be handed over with onet_shm_push() right after
+ *
+ * @peer: Peer returned by onet_shm_peer()
+ * @dst: Destination address the peer was looked up for
+ * @len: Length of the frame
+ *
+ * Returns where the frame should be written, otherwise
+ * NULL with errno set to ENOBUFS if the ring is full, or
+ * to ENOTCONN if the peer went away (the frame should go
+ * through the NIC then).
+ */
+char *onet_shm_slot(struct onet_shm_peer *peer, mac_addr_t dst, size_t len);
+
+/*
+ * Hand the frame written in the slot returned by the
+ * last onet_shm_slot() over to the peer
+ *
+ * @peer: Peer the slot belongs to
+ */
+void onet_shm_push(struct onet_shm_peer *peer);
+
+/*
+ * Receive a frame on a link with local delivery on,
+ * from either a peer ring or the packet socket (see
+ * `struct onet_transport')
+ */
+ssize_t onet_shm_recv(struct onet_link *link, void *p, size_t len,
+                      int timeout);
+
+/*
+ * Detach the XDP program of a link and close its
+ * AF_XDP socket.
+ *
+ * @link: Link to close the socket of
+ */
+void onet_xsk_close(struct onet_link *link);
+
 #endif  /* LINK_H */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LO_H
+#define LO_H
+
+#include <stdint.h>
+#include "link.h"
+
+/*
+ * Number of links a loopback wire connects
+ */
+#define ONET_LO_LINKS 16
+
+/*
+ * Number of frames queued for each link of a loopback
+ * wire (a power of two), more are dropped
+ */
+#define ONET_LO_DEPTH 1024
+
+/*
+ * Represents a loopback wire. Links opened on it get
+ * frames from each other through lock-free rings in
+ * memory, with no socket or interface, so the whole
+ * datagram path can run without root.
+ */
+struct onet_lo;
+
+/*
+ * Set up a loopback wire
+ *
+ * @mtu: MTU of every link on the wire (0 for 1500)
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_lo_create(uint32_t mtu, struct onet_lo **res);
+
+/*
+ * Open a link on a loopback wire. The link gets a locally
+ * administered hardware address of its own and is closed
+ * with onet_close() like any other. Frames are delivered
+ * to the link they are addressed to, and to every other
+ * link if they go to a multicast address.
+ *
+ * @lo: Wire to open the link on
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error (-ENOSPC if ONET_LO_LINKS are open).
+ */
+int onet_lo_open(struct onet_lo *lo, struct onet_link *res);
+
+/*
+ * Get the number of frames dropped by a loopback wire
+ * because a link was not keeping up
+ */
+uint64_t onet_lo_drops(struct onet_lo *lo);
+
+/*
+ * Release a loopback wire, every link on it must be
+ * closed first
+ *
+ * @lo: Wire to release
+ */
+void onet_lo_destroy(struct onet_lo *lo);
+
+#endif  /* LO_H */
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "link.h"
+#include "dgram.h"
+
+/*
+ * Port value to use with onet_loop_add() to catch
+ * datagrams to ports without their own callback.
+ */
+#define ONET_LOOP_ANY -1
+
+struct onet_loop;
+struct loop_src;
+
+/*
+ * Called by a loop for every datagram received
+ *
+ * @link: Link the datagram came in on
+ * @src: Address of the sender
+ * @port: Port the datagram was sent to
+ * @buf: Datagram data, only valid until this returns
+ * @len: Length of the datagram data
+ * @arg: Argument given to onet_loop_add()
+ */
+typedef void (*onet_recv_fn)(
+    struct onet_link *link, mac_addr_t src,
+    uint8_t port, void *buf, uint32_t len,
+    void *arg
+);
+
+/*
+ * Called by a loop when a timer fires
+ *
+ * @loop: Loop the timer belongs to
+ * @arg: Argument given to onet_loop_timer()
+ */
+typedef void (*onet_timer_fn)(struct onet_loop *loop, void *arg);
+
+/*
+ * Represents an event loop that drives any number of
+ * links and timers from a single thread. Sources may be
+ * added and removed from within callbacks.
+ *
+ * @epfd: epoll instance
+ * @wakefd: eventfd used to kick onet_loop_run()
+ * @srcs: Every source of the loop
+ * @dead: Sources removed while dispatching, freed
+ *        once the dispatch is over
+ * @stop: Set by onet_loop_stop()
+ */
+struct onet_loop {
+    int epfd;
+    int wakefd;
+    struct loop_src *srcs;
+    struct loop_src *dead;
+    bool stop;
+};
+
+/*
+ * Set up an event loop
+ *
+ * @loop: Loop to set up
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_loop_init(struct onet_loop *loop);
+
+/*
+ * Release an event loop and all of its sources, the
+ * links themselves are left open.
+ *
+ * @loop: Loop to release
+ */
+void onet_loop_free(struct onet_loop *loop);
+
+/*
+ * Have a loop dispatch datagrams received on a link. The
+ * link may not have any ports bound with dgram_bind(), the
+ * loop does the port demultiplexing itself.
+ *
+ * @loop: Loop to add the link to
+ * @link: Link to read from
+ * @port: Port to dispatch to `fn' (or ONET_LOOP_ANY)
+ * @fn: Callback to run for each datagram
+ * @arg: Argument passed to `fn'
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_loop_add(
+    struct onet_loop *loop, struct onet_link *link,
+    int port, onet_recv_fn fn, void *arg
+);
+
+/*
+ * Stop dispatching datagrams from a link
+ *
+ * @loop: Loop the link was added to
+ * @link: Link to remove
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_loop_del(struct onet_loop *loop, struct onet_link *link);
+
+/*
+ * Arm a timer on a loop. One-shot timers are removed
+ * once they fire.
+ *
+ * @loop: Loop to arm the timer on
+ * @ms: Time until the timer first fires
+ * @interval: Period of the timer after that (0 for one-shot)
+ * @fn: Callback to run when the timer fires
+ * @arg: Argument passed to `fn'
+ *
+ * Returns a timer ID on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_loop_timer(
+    struct onet_loop *loop, uint32_t ms,
+    uint32_t interval, onet_timer_fn fn,
+    void *arg
+);
+
+/*
+ * Disarm and remove a timer
+ *
+ * @loop: Loop the timer is armed on
+ * @timer: Timer ID returned by onet_loop_timer()
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_loop_cancel(struct onet_loop *loop, int timer);
+
+/*
+ * Dispatch events until the loop is stopped or the
+ * timeout expires.
+ *
+ * @loop: Loop to run
+ * @timeout: Timeout in ms (0 to dispatch what is ready,
+ *           -1 to run until stopped)
+ *
+ * Returns zero once stopped or timed out, otherwise a
+ * less than zero value on error.
+ */
+int onet_loop_run(struct onet_loop *loop, int timeout);
+
+/*
+ * Make onet_loop_run() return, this may be called from
+ * any thread.
+ *
+ * @loop: Loop to stop
+ */
+void onet_loop_stop(struct onet_loop *loop);
+
+#endif  /* !LOOP_H */
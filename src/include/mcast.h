@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MCAST_H
+#define MCAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "link.h"
+#include "dgram.h"
+
+/*
+ * Number of segments a publisher keeps around for repairs,
+ * and the number a subscriber buffers out of order (as
+ * many, so a subscriber can ride out anything that can
+ * still be repaired). Sequence numbers count segments,
+ * not bytes.
+ */
+#define ONET_PUB_BUF 4096
+#define ONET_SUB_WND 4096
+
+/*
+ * Number of FEC groups a subscriber holds repair
+ * blocks of at once
+ */
+#define ONET_SUB_FEC 16
+
+/*
+ * Header in front of the data of every OTYPE_MDATA,
+ * OTYPE_MNACK and OTYPE_MFEC datagram (network byte order)
+ *
+ * @session: Picked by the publisher when it starts, a new
+ *           one tells subscribers to start over
+ * @seq: Sequence number of this segment (OTYPE_MDATA),
+ *       the next one to be sent (MCAST_F_HB), the first
+ *       one asked for (OTYPE_MNACK), or the first one of
+ *       the FEC group (OTYPE_MFEC)
+ * @lo: Oldest sequence number the publisher can still
+ *      repair (OTYPE_MDATA, OTYPE_MFEC)
+ * @map: Segments asked for, bit N being sequence number
+ *       `seq' + N (OTYPE_MNACK), or K | R << 8 | index << 16
+ *       of a repair block (OTYPE_MFEC)
+ * @flags: Segment flags (see MCAST_F_*)
+ */
+struct onet_mcast_hdr {
+    uint32_t session;
+    uint32_t seq;
+    uint32_t lo;
+    uint64_t map;
+    uint16_t flags;
+} __attribute__((packed));
+
+/*
+ * Multicast header flags
+ *
+ * @MCAST_F_END: Last segment of a onet_pub_send() call
+ * @MCAST_F_HB: Heartbeat, no data. Lets subscribers find
+ *              losses at the tail of a burst
+ * @MCAST_F_RETX: Retransmission of a segment
+ */
+#define MCAST_F_END     (1 << 0)
+#define MCAST_F_HB      (1 << 1)
+#define MCAST_F_RETX    (1 << 2)
+
+/*
+ *  -- FEC --
+ *
+ *  A publisher may follow every K segments (a group) with R repair
+ *  blocks (see fec.h), so subscribers can get up to R lost segments
+ *  of a group back without asking. Each source block is the segment
+ *  length and flags (16 bits each, network byte order) then its data,
+ *  zero padded to the longest one of the group. Groups are cut short
+ *  when the publisher goes idle.
+ */
+#define MCAST_FEC_PREFIX 4U
+
+struct mcast_seg;
+struct mcast_fec;
+
+/*
+ * Represents the sending end of a reliable multicast
+ * stream. Segments go out once to the group; subscribers
+ * that miss one ask for it again (NACK) and the repair
+ * goes to the whole group as well. The last ONET_PUB_BUF
+ * segments are kept for that. A publisher may only be
+ * used by one thread at a time.
+ *
+ * @link: Link the stream is sent on
+ * @rxq: Receive queue of the stream port (for NACKs)
+ * @group: Address the stream is sent to
+ * @port: Port of the stream
+ * @mss: Max number of data bytes per segment
+ * @seg_size: Size of a segment buffer (header + data)
+ * @arena: Segment buffers
+ * @segs: State of each segment slot
+ * @session: Session ID of the stream
+ * @seq: Next sequence number to send
+ * @lo: Oldest sequence number still held
+ * @hb_at: When the next heartbeat goes out (us)
+ * @hb_ivl: Current heartbeat interval (us)
+ * @fec_k, @fec_r: FEC group and repair block counts (0 if off)
+ * @fec_base: First sequence number of the current group
+ * @fec_n: Segments in the current group so far
+ * @fec_len: Longest source block of the current group
+ * @fec_par: Repair blocks of the current group, each after
+ *           room for its header
+ * @repairs: Number of segments sent again
+ */
+struct onet_pub {
+    struct onet_link *link;
+    struct onet_port *rxq;
+    mac_addr_t group;
+    uint8_t port;
+    uint16_t mss;
+    uint32_t seg_size;
+    char *arena;
+    struct mcast_seg *segs;
+    uint32_t session;
+    uint32_t seq;
+    uint32_t lo;
+    uint64_t hb_at;
+    uint32_t hb_ivl;
+    uint32_t fec_k;
+    uint32_t fec_r;
+    uint32_t fec_base;
+    uint32_t fec_n;
+    uint32_t fec_len;
+    uint8_t *fec_par;
+    uint64_t repairs;
+};
+
+/*
+ * Represents the receiving end of a reliable multicast
+ * stream. Gaps are asked for again after a short random
+ * delay, which is dropped if another subscriber asks for
+ * the same segments first. A subscriber may only be used
+ * by one thread at a time.
+ *
+ * @link: Link the stream is received on
+ * @rxq: Receive queue of the stream port
+ * @group: Address NACKs are sent to
+ * @pub: Address of the publisher followed
+ * @port: Port of the stream
+ * @mss: Max number of data bytes per segment
+ * @arena: Segment buffers
+ * @segs: State of each segment slot
+ * @session: Session of the publisher
+ * @synced: Heard from the publisher
+ * @rcv_nxt: First sequence number not yet had (or lost)
+ * @rx_read: Sequence number of the next segment to read
+ * @rx_off: Bytes of the `rx_read' segment already read
+ * @rx_top: One past the highest sequence number known
+ *          to exist
+ * @nack_at: When the next NACK is due (us, 0 for never)
+ * @rand: Random state for NACK delays
+ * @fec: Repair blocks of recent FEC groups
+ * @fec_tmp: Source blocks of a group being decoded
+ * @fec_seen: The publisher sends FEC, NACKs wait for it
+ * @lost: Number of segments given up on
+ * @recovered: Number of segments FEC got back
+ */
+struct onet_sub {
+    struct onet_link *link;
+    struct onet_port *rxq;
+    mac_addr_t group;
+    mac_addr_t pub;
+    uint8_t port;
+    uint16_t mss;
+    char *arena;
+    struct mcast_seg *segs;
+    uint32_t session;
+    bool synced;
+    uint32_t rcv_nxt;
+    uint32_t rx_read;
+    uint32_t rx_off;
+    uint32_t rx_top;
+    uint64_t nack_at;
+    uint32_t rand;
+    struct mcast_fec *fec;
+    uint8_t *fec_tmp;
+    bool fec_seen;
+    uint64_t lost;
+    uint64_t recovered;
+};
+
+/*
+ * Start publishing a stream. The port is bound on `link'
+ * (see dgram_bind()) to hear NACKs until the publisher is
+ * closed, and a multicast `group' is joined as well (see
+ * dgram_join()).
+ *
+ * @link: Link to send on
+ * @group: Address to send to (e.g. DGRAM_GROUP_ADDR(id), or
+ *         MAC_BROADCAST)
+ * @port: Port to use
+ * @res: Publisher to set up
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_pub_open(struct onet_link *link, mac_addr_t group,
+                  uint8_t port, struct onet_pub *res);
+
+/*
+ * Stop publishing a stream
+ *
+ * @pub: Publisher to close
+ */
+void onet_pub_close(struct onet_pub *pub);
+
+/*
+ * Publish data on a stream. This never waits on the
+ * subscribers; the data is copied and kept around for
+ * repairs until ONET_PUB_BUF newer segments were sent.
+ *
+ * @pub: Publisher to send with
+ * @buf: The buffer containing data to send
+ * @len: Length of buffer to send
+ *
+ * Returns `len' on success, otherwise a less than zero
+ * value on failure.
+ */
+tx_len_t onet_pub_send(struct onet_pub *pub, const void *buf, uint32_t len);
+
+/*
+ * Turn FEC on (or off) for a stream. From the next segment
+ * on, every `k' segments are followed by `r' repair blocks.
+ * Segments lose MCAST_FEC_PREFIX bytes while FEC is on, so
+ * that a repair block still fits in a single frame.
+ *
+ * @pub: Publisher to set up
+ * @k: Segments per group (up to FEC_K_MAX, 0 for off)
+ * @r: Repair blocks per group (up to FEC_R_MAX, 0 for off)
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_pub_fec(struct onet_pub *pub, uint32_t k, uint32_t r);
+
+/*
+ * Answer NACKs and send heartbeats, waiting for the
+ * first NACK (or heartbeat) that is due. A publisher needs
+ * this called whenever it is not sending, or losses at
+ * the end of a burst may go unnoticed.
+ *
+ * @pub: Publisher to drive
+ * @timeout: Max time to wait in ms (-1 to wait forever)
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on failure.
+ */
+int onet_pub_poll(struct onet_pub *pub, int timeout);
+
+/*
+ * Subscribe to a stream, joining `group' on `link' if
+ * it is a multicast group
+ *
+ * @link: Link to receive on
+ * @group: Address the stream is sent to (NACKs go there)
+ * @pub: Publisher to follow, MAC_BROADCAST for the first
+ *       one heard
+ * @port: Port of the stream
+ * @res: Subscriber to set up
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_sub_open(struct onet_link *link, mac_addr_t group,
+                  mac_addr_t pub, uint8_t port, struct onet_sub *res);
+
+/*
+ * Unsubscribe from a stream
+ *
+ * @sub: Subscriber to close
+ */
+void onet_sub_close(struct onet_sub *sub);
+
+/*
+ * Receive data from a stream in order. This returns once
+ * `buf' is full or the end of the data of a single
+ * onet_pub_send() is reached.
+ *
+ * @sub: Subscriber to receive with
+ * @buf: Buffer to receive into
+ * @len: Size of `buf'
+ * @timeout: Max time to wait in ms (-1 to wait forever)
+ *
+ * Returns the number of bytes received on success, -EAGAIN
+ * if nothing came in time, -ENODATA (once per segment) when
+ * a segment could not be repaired and was skipped, otherwise
+ * a less than zero value on failure.
+ */
+rx_len_t onet_sub_recv(struct onet_sub *sub, void *buf, uint32_t len,
+                       int timeout);
+
+#endif  /* !MCAST_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NEIGH_H
+#define NEIGH_H
+
+#include <stdint.h>
+#include "if_ether.h"
+#include "link.h"
+
+/*
+ * Number of neighbors a link keeps track of
+ * (a power of two)
+ */
+#define ONET_NEIGH_MAX 256
+
+/*
+ * Default time (in ms) a neighbor is kept for after
+ * it last squeaked
+ */
+#define ONET_NEIGH_TTL 60000
+
+/*
+ * Default number of squeaks a link answers per second,
+ * and how many it may answer at once
+ */
+#define ONET_SQUEAK_RATE  64
+#define ONET_SQUEAK_BURST 16
+
+/*
+ * Represents a machine heard squeaking on a link
+ *
+ * @addr: Hardware address of the machine
+ * @first_seen: When it was first heard (monotonic, ms)
+ * @last_seen: When it was last heard (monotonic, ms)
+ * @expire: When it is forgotten unless heard again
+ * @squeaks: Number of squeaks heard from it
+ */
+struct onet_neigh {
+    mac_addr_t addr;
+    int64_t first_seen;
+    int64_t last_seen;
+    int64_t expire;
+    uint32_t squeaks;
+};
+
+/*
+ * Look up a neighbor of a link
+ *
+ * @link: Link to look on
+ * @addr: Hardware address of the neighbor
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise -ENOENT if it
+ * is not known (or expired).
+ */
+int onet_neigh_lookup(struct onet_link *link, mac_addr_t addr,
+                      struct onet_neigh *res);
+
+/*
+ * List the neighbors of a link
+ *
+ * @link: Link to list the neighbors of
+ * @res: Neighbors are written here
+ * @max: Number of entries `res' has room for
+ *
+ * Returns the number of entries written on success,
+ * otherwise a less than zero value on error.
+ */
+int onet_neigh_list(struct onet_link *link, struct onet_neigh *res,
+                    uint32_t max);
+
+/*
+ * Set how long neighbors are kept for after they
+ * last squeaked
+ *
+ * @link: Link to set the TTL of
+ * @ttl: TTL in ms
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_neigh_ttl(struct onet_link *link, uint32_t ttl);
+
+/*
+ * Set how fast a link answers squeaks. Squeaks over the
+ * limit are still recorded, they are just not answered.
+ *
+ * @link: Link to set the limit of
+ * @rate: Squeaks answered per second (0 to never answer)
+ * @burst: Squeaks that may be answered at once
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error.
+ */
+int onet_squeak_limit(struct onet_link *link, uint32_t rate, uint32_t burst);
+
+#endif  /* NEIGH_H */
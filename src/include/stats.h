@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "if_ether.h"
+#include "link.h"
+
+/*
+ * Link counters
+ *
+ * @ONET_STAT_RX_PACKETS: Frames taken in
+ * @ONET_STAT_RX_BYTES: Bytes of frames taken in
+ * @ONET_STAT_TX_PACKETS: Frames sent
+ * @ONET_STAT_TX_BYTES: Bytes of frames sent
+ * @ONET_STAT_RX_SQUEAKS: Squeaks heard
+ * @ONET_STAT_DROP_PROTO: Frames dropped for not being ONET,
+ *                       or being too short to be
+ * @ONET_STAT_DROP_CRC: Frames dropped on a CRC mismatch
+ * @ONET_STAT_DROP_NOTUS: Frames dropped for being sent to
+ *                       another host, or a group we are
+ *                       not in
+ * @ONET_STAT_DROP_ALLOC: Frame buffers that could not be had
+ * @ONET_STAT_DROP_SEND: Frames the transport did not send
+ *                      in full
+ */
+#define ONET_STAT_RX_PACKETS    0
+#define ONET_STAT_RX_BYTES      1
+#define ONET_STAT_TX_PACKETS    2
+#define ONET_STAT_TX_BYTES      3
+#define ONET_STAT_RX_SQUEAKS    4
+#define ONET_STAT_DROP_PROTO    5
+#define ONET_STAT_DROP_CRC      6
+#define ONET_STAT_DROP_NOTUS    7
+#define ONET_STAT_DROP_ALLOC    8
+#define ONET_STAT_DROP_SEND     9
+#define ONET_STAT_MAX           10
+
+/*
+ * Number of counter sets kept per link. Threads are
+ * spread over them so they do not fight over cache
+ * lines, and a snapshot adds them up.
+ */
+#define ONET_STATS_SLOTS 16
+
+/*
+ * Longest name a stats page may be published under
+ */
+#define ONET_STATS_NAME_MAX 32
+
+/*
+ * Directory stats pages are published in
+ */
+#define ONET_STATS_DIR "/dev/shm"
+
+#define ONET_STATS_MAGIC 0x4F535441U  /* 'OSTA' */
+#define ONET_STATS_VERSION 1
+
+/*
+ * One set of counters, on cache lines of its own
+ */
+struct onet_stats_slot {
+    uint64_t v[ONET_STAT_MAX];
+} __attribute__((aligned(64)));
+
+/*
+ * Counters of a link, as laid out in memory and in a
+ * published stats page (see onet_stats_publish())
+ *
+ * @magic: ONET_STATS_MAGIC
+ * @version: ONET_STATS_VERSION
+ * @nstats: ONET_STAT_MAX of the writer
+ * @nslots: ONET_STATS_SLOTS of the writer
+ * @hwaddr: Hardware address of the link
+ * @pid: Process that owns the link
+ * @name: Name the page was published under
+ * @slot: Counter sets
+ */
+struct onet_stats_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nstats;
+    uint32_t nslots;
+    mac_addr_t hwaddr;
+    uint64_t pid;
+    char name[ONET_STATS_NAME_MAX];
+    struct onet_stats_slot slot[ONET_STATS_SLOTS];
+};
+
+/*
+ * A snapshot of the counters of a link
+ *
+ * @hwaddr: Hardware address of the link
+ * @pid: Process that owns the link
+ * @v: Counters, indexed by ONET_STAT_*
+ */
+struct onet_stats {
+    mac_addr_t hwaddr;
+    uint64_t pid;
+    uint64_t v[ONET_STAT_MAX];
+};
+
+/*
+ * Get the name of a counter
+ *
+ * @stat: Counter (ONET_STAT_*)
+ *
+ * Returns NULL if there is no such counter.
+ */
+const char *onet_stat_name(uint32_t stat);
+
+/*
+ * Take a snapshot of the counters of a link. Counters
+ * are only ever added to, a snapshot taken while the
+ * link is busy is a little behind but never torn.
+ *
+ * @link: Link to get the counters of
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error.
+ */
+int onet_stats_get(struct onet_link *link, struct onet_stats *res);
+
+/*
+ * Move the counters of a link to a page under
+ * ONET_STATS_DIR named "onet.<name>", where onetstat and
+ * onet_stats_read() can see them from other processes.
+ * The page goes away when the link is closed. A few
+ * counts made while the page is being set up may be lost.
+ * A page left behind by a process that is gone is taken
+ * over.
+ *
+ * @link: Link to publish the counters of
+ * @name: Name to publish under (no '/')
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error (-EBUSY if a live process already
+ * publishes under `name').
+ */
+int onet_stats_publish(struct onet_link *link, const char *name);
+
+/*
+ * Take a snapshot of the counters in a published page,
+ * without touching the link it belongs to
+ *
+ * @name: Name the page was published under
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error (-ENOENT if there is no such page).
+ */
+int onet_stats_read(const char *name, struct onet_stats *res);
+
+#endif  /* STATS_H */
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TSTAMP_H
+#define TSTAMP_H
+
+#include <stdint.h>
+#include <time.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "link.h"
+
+/*
+ * Timestamp sources
+ *
+ * @ONET_TS_SOFTWARE: Stamped by the kernel as frames come
+ *                    in off the driver and go out to it
+ * @ONET_TS_HARDWARE: Stamped by the NIC, if it can
+ */
+#define ONET_TS_SOFTWARE (1 << 0)
+#define ONET_TS_HARDWARE (1 << 1)
+
+/*
+ * Histogram directions
+ *
+ * @ONET_TS_RX: From the kernel stamp of a received frame
+ *              until dgram_recv_ts() handed it over
+ * @ONET_TS_TX: From dgram_send_ts() being called until the
+ *              kernel stamp of the frame going out
+ */
+#define ONET_TS_RX 0
+#define ONET_TS_TX 1
+
+/*
+ * Number of histogram buckets, bucket `i' counts
+ * latencies of [2^i, 2^(i + 1)) ns
+ */
+#define ONET_TS_BUCKETS 32
+
+/*
+ * How long dgram_send_ts() waits for the stamp of a
+ * frame it sent, in ms
+ */
+#define ONET_TS_TX_WAIT 10
+
+/*
+ * Timestamps of a frame, a stamp that was not taken is
+ * all zeroes
+ *
+ * @sw: Kernel stamp (CLOCK_REALTIME)
+ * @hw: NIC stamp (NIC clock)
+ */
+struct onet_tstamp {
+    struct timespec sw;
+    struct timespec hw;
+};
+
+/*
+ * Latency histogram of a port
+ *
+ * @count: Number of latencies recorded
+ * @sum_ns: Sum of the latencies in ns
+ * @max_ns: Largest latency in ns
+ * @bucket: Latencies by power of two (see ONET_TS_BUCKETS)
+ */
+struct onet_ts_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t bucket[ONET_TS_BUCKETS];
+};
+
+/*
+ * Turn on timestamping for a link. NIC stamps fall back
+ * to kernel ones if the NIC or driver (e.g., veth) does
+ * not do them. Only links on a packet socket without an
+ * RX ring, AF_XDP or local delivery can be stamped.
+ *
+ * @link: Link to stamp frames of
+ * @flags: Sources wanted (ONET_TS_*)
+ *
+ * Returns the sources turned on on success, otherwise a
+ * less than zero value on error.
+ */
+int onet_tstamp_enable(struct onet_link *link, uint32_t flags);
+
+/*
+ * Get a datagram along with the stamps of its frame (of
+ * its last fragment), and record how long it took to get
+ * from the kernel to here in the histogram of its port.
+ * Ports may not be bound on the link.
+ *
+ * @link: Link to receive on
+ * @buf: Buffer to receive into
+ * @len: Length of `buf'
+ * @timeout: Timeout in ms (0 to poll, -1 to wait forever)
+ * @ts: Stamps are written here
+ *
+ * Returns the same as dgram_recv_timed().
+ */
+rx_len_t dgram_recv_ts(
+    struct onet_link *link, void *buf,
+    uint32_t len, int timeout,
+    struct onet_tstamp *ts
+);
+
+/*
+ * Send a datagram that fits in one frame and wait up to
+ * ONET_TS_TX_WAIT ms for its stamps, recording how long
+ * it took to get out in the histogram of its port.
+ *
+ * @link: Link to send through
+ * @dst: Destination address
+ * @port: Destination port
+ * @buf: Data to send
+ * @len: Length of the data
+ * @ts: Stamps are written here
+ *
+ * Returns the number of bytes sent on success, otherwise
+ * a less than zero value on error. Sends whose stamps do
+ * not show up in time still succeed, with zeroed stamps.
+ */
+tx_len_t dgram_send_ts(
+    struct onet_link *link, mac_addr_t dst,
+    uint8_t port, const void *buf,
+    uint32_t len, struct onet_tstamp *ts
+);
+
+/*
+ * Get the latency histogram of a port
+ *
+ * @link: Link with timestamping on
+ * @port: Port to get the histogram of
+ * @dir: Direction (ONET_TS_RX or ONET_TS_TX)
+ * @res: Result is written here
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error.
+ */
+int onet_ts_hist(
+    struct onet_link *link, uint8_t port,
+    int dir, struct onet_ts_hist *res
+);
+
+#endif  /* TSTAMP_H */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "link.h"
+#include "dgram.h"
+
+struct onet_uring;
+
+/*
+ * Called once a send queued with onet_uring_send() is done
+ *
+ * @ur: Ring the send was queued on
+ * @status: Bytes of data sent, or a less than zero value
+ *          on failure
+ * @arg: Argument given to onet_uring_send()
+ */
+typedef void (*onet_uring_tx_fn)(
+    struct onet_uring *ur, int status,
+    void *arg
+);
+
+/*
+ * Called for every datagram received on a ring
+ *
+ * @ur: Ring the datagram came in on
+ * @src: Address of the sender
+ * @port: Port the datagram was sent to
+ * @buf: Datagram data, only valid until this returns
+ * @len: Length of the datagram data
+ * @arg: Argument given to onet_uring_recv()
+ */
+typedef void (*onet_uring_rx_fn)(
+    struct onet_uring *ur, mac_addr_t src,
+    uint8_t port, void *buf, uint32_t len,
+    void *arg
+);
+
+/*
+ * Represents an io_uring instance driving a link. Sends
+ * are copied into registered buffers and completed out
+ * of line, receives use a provided buffer ring and a
+ * multishot receive (or a re-armed one on older kernels).
+ * A ring may only be used by one thread at a time.
+ *
+ * @fd: io_uring file descriptor
+ * @link: Link the ring drives
+ * @sq_*: Submission queue (mapped from the kernel)
+ * @cq_*: Completion queue (mapped from the kernel)
+ * @sqes: Submission queue entries
+ * @sq_map, @cq_map: Ring mappings (may be the same)
+ * @sq_map_len, @cq_map_len, @sqes_len: Mapping lengths
+ * @tx_arena: Send buffers (one frame each)
+ * @tx_fn, @tx_arg: Completion callback of each send buffer
+ * @tx_free: Free send buffers (by index)
+ * @tx_nfree: Number of free send buffers
+ * @tx_nr: Number of send buffers
+ * @rx_arena: Receive buffers (one frame each)
+ * @rx_bufs: Provided buffer ring
+ * @rx_nr: Number of receive buffers
+ * @rx_fn, @rx_arg: Receive callback
+ * @frame_size: Size of each send and receive buffer
+ * @fixed: Send buffers are registered with the kernel
+ * @multishot: Multishot receive is supported
+ * @rx_armed: A receive is queued
+ */
+struct onet_uring {
+    int fd;
+    struct onet_link *link;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t sq_queued;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    void *cqes;
+    void *sqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_len;
+    size_t cq_map_len;
+    size_t sqes_len;
+    char *tx_arena;
+    onet_uring_tx_fn *tx_fn;
+    void **tx_arg;
+    uint32_t *tx_free;
+    uint32_t tx_nfree;
+    uint32_t tx_nr;
+    char *rx_arena;
+    void *rx_bufs;
+    uint32_t rx_nr;
+    onet_uring_rx_fn rx_fn;
+    void *rx_arg;
+    uint32_t frame_size;
+    bool fixed;
+    bool multishot;
+    bool rx_armed;
+};
+
+/*
+ * Set up an io_uring instance for a link
+ *
+ * @ur: Ring to set up
+ * @link: Link to drive
+ * @depth: Max number of sends in flight (0 for the default)
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on error (-ENOSYS without io_uring).
+ */
+int onet_uring_init(struct onet_uring *ur, struct onet_link *link,
+                    uint32_t depth);
+
+/*
+ * Tear down an io_uring instance, sends still in
+ * flight are not completed.
+ *
+ * @ur: Ring to tear down
+ */
+void onet_uring_free(struct onet_uring *ur);
+
+/*
+ * Queue a datagram to be sent. The data is copied, so
+ * `buf' may be reused as soon as this returns. Queued
+ * sends go to the kernel on the next onet_uring_poll()
+ * (or once the submission queue fills up).
+ *
+ * @ur: Ring to send through
+ * @dst: Destination address to send to
+ * @port: Destination port
+ * @buf: The buffer containing data to send
+ * @len: Length of buffer to send
+ * @fn: Called once the send is done (may be NULL)
+ * @arg: Argument passed to `fn'
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on failure.
+ */
+int onet_uring_send(
+    struct onet_uring *ur, mac_addr_t dst,
+    uint8_t port, void *buf, uint16_t len,
+    onet_uring_tx_fn fn, void *arg
+);
+
+/*
+ * Start receiving datagrams on a ring, each one is passed
+ * to `fn' from onet_uring_poll().
+ *
+ * @ur: Ring to receive on
+ * @fn: Callback to run for each datagram
+ * @arg: Argument passed to `fn'
+ *
+ * Returns zero on success, otherwise a less than
+ * zero value on failure.
+ */
+int onet_uring_recv(struct onet_uring *ur, onet_uring_rx_fn fn, void *arg);
+
+/*
+ * Submit whatever is queued and run the callbacks of
+ * every completion that is ready, all with a single
+ * syscall.
+ *
+ * @ur: Ring to poll
+ * @min: Number of completions to wait for (0 to not wait)
+ *
+ * Returns the number of completions handled on success,
+ * otherwise a less than zero value on failure.
+ */
+int onet_uring_poll(struct onet_uring *ur, uint32_t min);
+
+#endif  /* !URING_H */
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "if_ether.h"
+#include "link.h"
+
+/*
+ * Max number of destination addresses the
+ * filter may accept.
+ */
+#define FILTER_ADDR_MAX 32
+
+/* Instructions needed to match a single address */
+#define FILTER_ADDR_INSNS 5
+
+#define FILTER_LEN(naddr) (3 + (naddr) * FILTER_ADDR_INSNS)
+
+/*
+ * Append instructions accepting frames sent to `addr'
+ *
+ * The destination is the first six bytes of the frame
+ * and is compared as a 16-bit high half followed by a
+ * 32-bit low half.
+ */
+static struct sock_filter *
+filter_match_addr(struct sock_filter *insn, mac_addr_t addr)
+{
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2);
+    *insn++ = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K,
+        addr & 0xFFFFFFFF, 0, 3
+    );
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0);
+    *insn++ = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K,
+        (addr >> 32) & 0xFFFF, 0, 1
+    );
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, UINT32_MAX);
+    return insn;
+}
+
+int
+onet_filter_attach(struct onet_link *link)
+{
+    struct sock_filter prog[FILTER_LEN(FILTER_ADDR_MAX)];
+    struct sock_filter *insn = prog;
+    struct sock_fprog fprog;
+    mac_addr_t addrs[FILTER_ADDR_MAX];
+    size_t i, naddr = 0;
+
+    if (link == NULL) {
+        return -EINVAL;
+    }
+
+    /* Nothing to attach to */
+    if (!ONET_LINK_PACKET(link)) {
+        return 0;
+    }
+
+    addrs[naddr++] = link->hwaddr;
+    addrs[naddr++] = MAC_BROADCAST;
+    for (i = 0; i < link->ngroups && naddr < FILTER_ADDR_MAX; ++i) {
+        addrs[naddr++] = link->groups[i];
+    }
+
+    /* Drop anything that is not ONET */
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+    *insn++ = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K, PROTO_ID,
+        0, naddr * FILTER_ADDR_INSNS
+    );
+
+    for (i = 0; i < naddr; ++i) {
+        insn = filter_match_addr(insn, addrs[i]);
+    }
+
+    /* Not addressed to us, drop it */
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    fprog.len = insn - prog;
+    fprog.filter = prog;
+    if (setsockopt(link->sockfd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &fprog, sizeof(fprog)) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "link.h"
+#include "lo.h"
+
+#define LO_MTU 1500
+#define LO_MASK (ONET_LO_DEPTH - 1)
+
+/*
+ * Represents a frame slot of a link ring. Slots go
+ * around with a sequence number telling producers and
+ * consumers whose turn it is (a bounded MPMC queue).
+ *
+ * @seq: Position the slot is ready for
+ * @len: Length of the frame
+ * @frame: The frame itself
+ */
+struct lo_slot {
+    uint32_t seq;
+    uint32_t len;
+    char frame[];
+};
+
+/*
+ * Represents a link of a loopback wire
+ *
+ * @lo: Wire the link is on
+ * @open: A link is open on it
+ * @hwaddr: Hardware address of the link
+ * @slots: Receive ring of the link
+ * @head: Next position to consume
+ * @tail: Next position to produce
+ * @wake: Bumped to wake up waiting consumers (futex)
+ * @waiters: Number of consumers waiting
+ */
+struct lo_port {
+    struct onet_lo *lo;
+    uint32_t open;
+    mac_addr_t hwaddr;
+    char *slots;
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t wake __attribute__((aligned(64)));
+    uint32_t waiters;
+};
+
+/*
+ * Represents a loopback wire
+ *
+ * @mtu: MTU of every link
+ * @slot_size: Size of each ring slot
+ * @id: Wire number, part of the hardware addresses
+ * @lock: Held while links are opened
+ * @drops: Frames dropped on full rings
+ * @port: Links of the wire
+ */
+struct onet_lo {
+    uint32_t mtu;
+    size_t slot_size;
+    uint32_t id;
+    pthread_mutex_t lock;
+    uint64_t drops;
+    struct lo_port port[ONET_LO_LINKS];
+};
+
+static uint32_t lo_ids;
+
+static inline struct lo_slot *
+lo_slot(struct lo_port *port, uint32_t pos)
+{
+    return (void *)(port->slots + (size_t)(pos & LO_MASK) *
+                    port->lo->slot_size);
+}
+
+static int64_t
+lo_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Queue a copy of a frame on a link ring
+ *
+ * Returns false if the ring is full.
+ */
+static bool
+lo_push(struct lo_port *port, const void *p, size_t len)
+{
+    struct lo_slot *slot;
+    uint32_t pos, seq;
+
+    pos = __atomic_load_n(&port->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = lo_slot(port, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((int32_t)(seq - pos) < 0) {
+            return false;
+        }
+
+        if (seq == pos &&
+            __atomic_compare_exchange_n(&port->tail, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if (seq != pos) {
+            pos = __atomic_load_n(&port->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->frame, p, len);
+    slot->len = len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the consumer adding itself to `waiters' */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&port->waiters, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&port->wake, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &port->wake, FUTEX_WAKE_PRIVATE, INT_MAX,
+                NULL, NULL, 0);
+    }
+
+    return true;
+}
+
+/*
+ * Take the next frame off a link ring, it is cut
+ * short if `len' is too small
+ *
+ * Returns the frame length, -EAGAIN if the ring is
+ * empty.
+ */
+static ssize_t
+lo_pop(struct lo_port *port, void *p, size_t len)
+{
+    struct lo_slot *slot;
+    uint32_t pos, seq, n;
+
+    pos = __atomic_load_n(&port->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = lo_slot(port, pos);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((int32_t)(seq - (pos + 1)) < 0) {
+            return -EAGAIN;
+        }
+
+        if (seq == pos + 1 &&
+            __atomic_compare_exchange_n(&port->head, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if (seq != pos + 1) {
+            pos = __atomic_load_n(&port->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    n = slot->len;
+    if (p != NULL) {
+        memcpy(p, slot->frame, (n < len) ? n : len);
+    }
+
+    __atomic_store_n(&slot->seq, pos + ONET_LO_DEPTH, __ATOMIC_RELEASE);
+    return n;
+}
+
+static ssize_t
+lo_send(struct onet_link *link, const void *p, size_t len)
+{
+    struct lo_port *self = link->tp_priv, *port;
+    struct onet_lo *lo = self->lo;
+    mac_addr_t dst;
+    size_t i;
+
+    if (len < sizeof(struct ether_hdr) ||
+        len > sizeof(struct ether_hdr) + lo->mtu) {
+        return -EMSGSIZE;
+    }
+
+    dst = mac_swap((uint8_t *)p);
+    for (i = 0; i < ONET_LO_LINKS; ++i) {
+        port = &lo->port[i];
+        if (port == self || !__atomic_load_n(&port->open, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        if (!MAC_IS_MULTICAST(dst) && dst != port->hwaddr) {
+            continue;
+        }
+
+        if (!lo_push(port, p, len)) {
+            __atomic_add_fetch(&lo->drops, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return len;
+}
+
+static ssize_t
+lo_recv(struct onet_link *link, void *p, size_t len, int timeout)
+{
+    struct lo_port *port = link->tp_priv;
+    struct timespec ts, *tsp = NULL;
+    int64_t deadline = lo_now() + timeout, left;
+    uint32_t wake;
+    ssize_t ret;
+
+    for (;;) {
+        if ((ret = lo_pop(port, p, len)) != -EAGAIN || timeout == 0) {
+            return ret;
+        }
+
+        if (timeout > 0) {
+            if ((left = deadline - lo_now()) <= 0) {
+                return -EAGAIN;
+            }
+            ts.tv_sec = left / 1000;
+            ts.tv_nsec = (left % 1000) * 1000000;
+            tsp = &ts;
+        }
+
+        /* Check once more after saying we are about to sleep */
+        wake = __atomic_load_n(&port->wake, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&port->waiters, 1, __ATOMIC_SEQ_CST);
+        if ((ret = lo_pop(port, p, len)) == -EAGAIN) {
+            syscall(SYS_futex, &port->wake, FUTEX_WAIT_PRIVATE, wake,
+                    tsp, NULL, 0);
+        }
+
+        __atomic_sub_fetch(&port->waiters, 1, __ATOMIC_RELAXED);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+    }
+}
+
+static void
+lo_close(struct onet_link *link)
+{
+    struct lo_port *port = link->tp_priv;
+
+    __atomic_store_n(&port->open, 0, __ATOMIC_RELEASE);
+}
+
+static const struct onet_transport lo_transport = {
+    .name = "lo",
+    .send = lo_send,
+    .recv = lo_recv,
+    .close = lo_close
+};
+
+int
+onet_lo_create(uint32_t mtu, struct onet_lo **res)
+{
+    struct onet_lo *lo;
+
+    if (res == NULL) {
+        return -EINVAL;
+    }
+
+    if (mtu == 0) {
+        mtu = LO_MTU;
+    }
+
+    if ((lo = calloc(1, sizeof(*lo))) == NULL) {
+        return -ENOMEM;
+    }
+
+    lo->mtu = mtu;
+    lo->slot_size = sizeof(struct lo_slot) + sizeof(struct ether_hdr) + mtu;
+    lo->slot_size = (lo->slot_size + 63) & ~(size_t)63;
+    lo->id = __atomic_fetch_add(&lo_ids, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&lo->lock, NULL);
+    *res = lo;
+    return 0;
+}
+
+int
+onet_lo_open(struct onet_lo *lo, struct onet_link *res)
+{
+    struct lo_port *port = NULL;
+    mac_addr_t hwaddr;
+    uint32_t i;
+
+    if (lo == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&lo->lock);
+    for (i = 0; i < ONET_LO_LINKS; ++i) {
+        if (!__atomic_load_n(&lo->port[i].open, __ATOMIC_ACQUIRE)) {
+            port = &lo->port[i];
+            break;
+        }
+    }
+
+    if (port == NULL) {
+        pthread_mutex_unlock(&lo->lock);
+        return -ENOSPC;
+    }
+
+    /* Rings stay around until the wire goes, reuse them */
+    if (port->slots == NULL) {
+        port->slots = calloc(ONET_LO_DEPTH, lo->slot_size);
+        if (port->slots == NULL) {
+            pthread_mutex_unlock(&lo->lock);
+            return -ENOMEM;
+        }
+
+        port->lo = lo;
+        for (i = 0; i < ONET_LO_DEPTH; ++i) {
+            lo_slot(port, i)->seq = i;
+        }
+    }
+
+    /* Frames left over from the last link are not ours */
+    while (lo_pop(port, NULL, 0) != -EAGAIN) {
+        continue;
+    }
+
+    /* 02:4F:4E (locally administered), the wire, then the link */
+    hwaddr = 0x024F4E000000ULL | (lo->id & 0xFFFF) << 8 |
+        (port - lo->port);
+    port->hwaddr = hwaddr;
+    __atomic_store_n(&port->open, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lo->lock);
+
+    return onet_open_tp(&lo_transport, port, hwaddr, lo->mtu, res);
+}
+
+uint64_t
+onet_lo_drops(struct onet_lo *lo)
+{
+    if (lo == NULL) {
+        return 0;
+    }
+
+    return __atomic_load_n(&lo->drops, __ATOMIC_RELAXED);
+}
+
+void
+onet_lo_destroy(struct onet_lo *lo)
+{
+    size_t i;
+
+    if (lo == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ONET_LO_LINKS; ++i) {
+        free(lo->port[i].slots);
+    }
+
+    pthread_mutex_destroy(&lo->lock);
+    free(lo);
+}
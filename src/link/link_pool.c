@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "link.h"
+
+#define POOL_ALIGN  64
+#define POOL_NIL    UINT32_MAX
+
+/*
+ * The freelist head packs the index of the top frame
+ * in the low 32 bits and a tag that is bumped on every
+ * update in the high 32 bits, so a frame popped and
+ * pushed back between our load and our CAS is noticed.
+ */
+#define POOL_TOP(tag, idx) (((uint64_t)(tag) << 32) | (idx))
+#define POOL_TOP_IDX(top)  ((uint32_t)((top) & 0xFFFFFFFF))
+#define POOL_TOP_TAG(top)  ((uint32_t)((top) >> 32))
+
+int
+onet_pool_init(struct onet_pool *pool, uint32_t frame_size, uint32_t frame_nr)
+{
+    size_t arena_len;
+    uint32_t i;
+
+    if (pool == NULL || frame_size == 0 || frame_nr == 0) {
+        return -EINVAL;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    frame_size = (frame_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    arena_len = (size_t)frame_size * frame_nr;
+
+    pool->arena = aligned_alloc(POOL_ALIGN, arena_len);
+    if (pool->arena == NULL) {
+        return -ENOMEM;
+    }
+
+    pool->next = malloc(frame_nr * sizeof(*pool->next));
+    if (pool->next == NULL) {
+        free(pool->arena);
+        pool->arena = NULL;
+        return -ENOMEM;
+    }
+
+    /* Chain every frame onto the freelist */
+    for (i = 0; i < frame_nr; ++i) {
+        pool->next[i] = (i + 1 < frame_nr) ? i + 1 : POOL_NIL;
+    }
+
+    pool->frame_size = frame_size;
+    pool->frame_nr = frame_nr;
+    pool->top = POOL_TOP(0, 0);
+    return 0;
+}
+
+void
+onet_pool_free(struct onet_pool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    free(pool->arena);
+    free(pool->next);
+    memset(pool, 0, sizeof(*pool));
+}
+
+char *
+onet_pool_get(struct onet_pool *pool)
+{
+    uint64_t top, new_top;
+    uint32_t idx, next;
+
+    if (pool->arena == NULL) {
+        return NULL;
+    }
+
+    top = __atomic_load_n(&pool->top, __ATOMIC_ACQUIRE);
+    do {
+        idx = POOL_TOP_IDX(top);
+        if (idx == POOL_NIL) {
+            return NULL;
+        }
+
+        next = __atomic_load_n(&pool->next[idx], __ATOMIC_RELAXED);
+        new_top = POOL_TOP(POOL_TOP_TAG(top) + 1, next);
+    } while (!__atomic_compare_exchange_n(&pool->top, &top, new_top, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return pool->arena + (size_t)idx * pool->frame_size;
+}
+
+void
+onet_pool_put(struct onet_pool *pool, char *p)
+{
+    uint64_t top, new_top;
+    uint32_t idx;
+
+    idx = (p - pool->arena) / pool->frame_size;
+    top = __atomic_load_n(&pool->top, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&pool->next[idx], POOL_TOP_IDX(top), __ATOMIC_RELAXED);
+        new_top = POOL_TOP(POOL_TOP_TAG(top) + 1, idx);
+    } while (!__atomic_compare_exchange_n(&pool->top, &top, new_top, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+bool
+onet_pool_owns(const struct onet_pool *pool, const char *p)
+{
+    if (pool->arena == NULL) {
+        return false;
+    }
+
+    return p >= pool->arena &&
+        p < pool->arena + (size_t)pool->frame_size * pool->frame_nr;
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <stdint.h>
+#include <string.h>
+#include "if_ether.h"
+#include "link.h"
+
+#define TXRING_FRAME_NR     256
+#define RXRING_BLOCK_NR     64
+#define RING_BLOCK_SIZE     (1 << 16)
+#define RXRING_BLOCK_SIZE   (1 << 18)
+#define RXRING_BLOCK_TMO    4       /* in ms */
+
+/*
+ * Get the size of a ring frame slot large enough to hold
+ * a TPACKET_V3 header followed by an MTU sized frame.
+ *
+ * @link: Link to size frames for
+ */
+static uint32_t
+ring_frame_size(struct onet_link *link)
+{
+    uint32_t need, size = 2048;
+
+    need = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+    need += sizeof(struct ether_hdr) + link->mtu;
+    while (size < need) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+/*
+ * Select TPACKET_V3 on a link socket. The version may
+ * only be changed while no ring is set up.
+ *
+ * @link: Link to configure
+ */
+static int
+ring_set_version(struct onet_link *link)
+{
+    int version = TPACKET_V3;
+
+    if (link->rx_ring.size != 0 || link->tx_ring.size != 0) {
+        return 0;
+    }
+
+    return setsockopt(
+        link->sockfd, SOL_PACKET, PACKET_VERSION,
+        &version, sizeof(version)
+    );
+}
+
+/*
+ * Unmap the rings of a link socket. The kernel refuses
+ * to set up a ring while the socket is mapped.
+ *
+ * @link: Link to unmap rings for
+ */
+static void
+ring_unmap(struct onet_link *link)
+{
+    if (link->map == NULL) {
+        return;
+    }
+
+    munmap(link->map, link->map_len);
+    link->map = NULL;
+    link->map_len = 0;
+    link->rx_ring.base = NULL;
+    link->tx_ring.base = NULL;
+}
+
+/*
+ * Map every ring set up on a link socket. The kernel
+ * exposes all rings through a single mapping with the
+ * RX ring first, so this must be redone whenever a ring
+ * is added.
+ *
+ * @link: Link to map rings for
+ */
+static int
+ring_map(struct onet_link *link)
+{
+    char *p;
+    size_t len;
+
+    len = link->rx_ring.size + link->tx_ring.size;
+    if (len == 0) {
+        return 0;
+    }
+
+    p = mmap(
+        NULL, len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, link->sockfd, 0
+    );
+
+    if (p == MAP_FAILED) {
+        return -errno;
+    }
+
+    link->map = p;
+    link->map_len = len;
+    if (link->rx_ring.size != 0) {
+        link->rx_ring.base = p;
+    }
+    if (link->tx_ring.size != 0) {
+        link->tx_ring.base = p + link->rx_ring.size;
+    }
+
+    return 0;
+}
+
+/*
+ * Set up a ring on a link socket and (re)map every ring
+ *
+ * @link: Link to set up the ring on
+ * @opt: PACKET_RX_RING or PACKET_TX_RING
+ * @req: Ring request to pass to the kernel
+ * @ring: Ring state to fill in
+ */
+static int
+ring_setup(struct onet_link *link, int opt, struct tpacket_req3 *req,
+           struct onet_ring *ring)
+{
+    int error;
+
+    ring_unmap(link);
+    if (ring_set_version(link) < 0) {
+        error = -errno;
+        ring_map(link);
+        return error;
+    }
+
+    error = setsockopt(link->sockfd, SOL_PACKET, opt, req, sizeof(*req));
+    if (error < 0) {
+        error = -errno;
+        memset(ring, 0, sizeof(*ring));
+        ring_map(link);
+        return error;
+    }
+
+    ring->size = (size_t)req->tp_block_nr * req->tp_block_size;
+    ring->head = 0;
+    ring->cur = NULL;
+    ring->cur_left = 0;
+    if ((error = ring_map(link)) < 0) {
+        /* Give the ring back, the link keeps using the socket */
+        memset(ring, 0, sizeof(*ring));
+        memset(req, 0, sizeof(*req));
+        setsockopt(link->sockfd, SOL_PACKET, opt, req, sizeof(*req));
+        ring_map(link);
+    }
+
+    return error;
+}
+
+int
+onet_txring_init(struct onet_link *link, uint32_t frame_nr)
+{
+    struct tpacket_req3 req;
+    uint32_t block_size, frame_size;
+
+    if (link == NULL || link->tx_ring.size != 0) {
+        return -EINVAL;
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    if (frame_nr == 0) {
+        frame_nr = TXRING_FRAME_NR;
+    }
+
+    frame_size = ring_frame_size(link);
+    block_size = RING_BLOCK_SIZE;
+    if (block_size < frame_size) {
+        block_size = frame_size;
+    }
+
+    /* Frames never straddle blocks, round up to whole blocks */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_frame_size = frame_size;
+    req.tp_block_nr = (frame_nr * frame_size + block_size - 1) / block_size;
+    req.tp_frame_nr = req.tp_block_nr * (block_size / frame_size);
+
+    link->tx_ring.frame_size = frame_size;
+    link->tx_ring.frame_nr = req.tp_frame_nr;
+    link->tx_ring.block_size = block_size;
+    link->tx_ring.block_nr = req.tp_block_nr;
+    return ring_setup(link, PACKET_TX_RING, &req, &link->tx_ring);
+}
+
+int
+onet_rxring_init(struct onet_link *link, uint32_t block_nr)
+{
+    struct tpacket_req3 req;
+    uint32_t block_size, frame_size;
+
+    if (link == NULL || link->rx_ring.size != 0) {
+        return -EINVAL;
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /* Local delivery waits on the socket itself */
+    if (link->shm != NULL) {
+        return -EBUSY;
+    }
+
+    if (block_nr == 0) {
+        block_nr = RXRING_BLOCK_NR;
+    }
+
+    frame_size = ring_frame_size(link);
+    block_size = RXRING_BLOCK_SIZE;
+    while (block_size < frame_size) {
+        block_size <<= 1;
+    }
+
+    /*
+     * Frames are packed back to back within a block, the
+     * frame size only bounds how large a single one may be.
+     */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_nr;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = block_nr * (block_size / frame_size);
+    req.tp_retire_blk_tov = RXRING_BLOCK_TMO;
+
+    link->rx_ring.frame_size = frame_size;
+    link->rx_ring.frame_nr = req.tp_frame_nr;
+    link->rx_ring.block_size = block_size;
+    link->rx_ring.block_nr = block_nr;
+    return ring_setup(link, PACKET_RX_RING, &req, &link->rx_ring);
+}
+
+void
+onet_ring_free(struct onet_link *link)
+{
+    if (link == NULL) {
+        return;
+    }
+
+    ring_unmap(link);
+    memset(&link->rx_ring, 0, sizeof(link->rx_ring));
+    memset(&link->tx_ring, 0, sizeof(link->tx_ring));
+}
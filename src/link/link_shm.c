@@ -0,0 +1,819 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "link.h"
+
+#define SHM_MAGIC 0x4F53484DU   /* 'OSHM' */
+#define SHM_MASK (ONET_SHM_DEPTH - 1)
+#define SHM_RETRY 1000          /* Negative cache lifetime (ms) */
+#define SHM_BURST 64            /* Ring frames between socket checks */
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+/* Messages on the discovery socket */
+#define SHM_MSG_RING 0          /* Ring handed over (memfd attached) */
+#define SHM_MSG_WAKE 1          /* Ring has frames, receiver sleeps */
+#define SHM_MSG_PROBE 2         /* Anyone there? (ignored) */
+
+/* Peer states */
+#define SHM_PEER_FREE   0
+#define SHM_PEER_LOCAL  1
+#define SHM_PEER_REMOTE 2
+
+/*
+ * Head of a ring in shared memory, slots follow it.
+ * Each ring has one producer (the sending process) and
+ * one consumer (the receiving process).
+ *
+ * @magic: SHM_MAGIC
+ * @slot_size: Size of each slot
+ * @depth: Number of slots (ONET_SHM_DEPTH)
+ * @sleeping: Set by the consumer before it blocks
+ * @src: Hardware address of the producer
+ * @head: Next position to produce
+ * @tail: Next position to consume
+ */
+struct shm_ring {
+    uint32_t magic;
+    uint32_t slot_size;
+    uint32_t depth;
+    uint32_t sleeping;
+    mac_addr_t src;
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+};
+
+/*
+ * Represents a slot of a ring
+ *
+ * @len: Length of the frame
+ * @frame: The frame itself
+ */
+struct shm_slot {
+    uint32_t len;
+    uint32_t pad[3];
+    char frame[];
+};
+
+/*
+ * Message sent over the discovery socket
+ *
+ * @type: SHM_MSG_*
+ * @src: Hardware address of the sender
+ */
+struct shm_msg {
+    uint32_t type;
+    mac_addr_t src;
+};
+
+/*
+ * Represents a peer we send to
+ *
+ * @dst: Hardware address of the peer
+ * @state: SHM_PEER_*
+ * @retry_at: When to try a remote peer again (ms)
+ * @lock: Held while a slot is reserved, or while the
+ *        entry changes
+ * @ring: Ring we produce into
+ * @size: Size of the ring mapping
+ * @memfd: File backing the ring
+ * @shm: Owning state
+ */
+struct onet_shm_peer {
+    mac_addr_t dst;
+    uint32_t state;
+    int64_t retry_at;
+    uint8_t lock;
+    struct shm_ring *ring;
+    size_t size;
+    int memfd;
+    struct onet_shm *shm;
+};
+
+/*
+ * Represents a ring we consume from. The producer may
+ * write to the ring head at any time, so its geometry is
+ * copied here once it was checked.
+ *
+ * @ring: The ring, NULL if the entry is unused
+ * @size: Size of the ring mapping
+ * @slot_size: Size of each slot
+ */
+struct shm_in {
+    struct shm_ring *ring;
+    size_t size;
+    uint32_t slot_size;
+};
+
+/*
+ * Local delivery state of a link
+ *
+ * @fd: Discovery socket
+ * @hwaddr: Hardware address of the link
+ * @slot_size: Size of the slots of rings we create
+ * @lock: Held while consuming from `in'
+ * @next: Next ring to consume from (round robin)
+ * @burst: Ring frames since the socket was checked
+ * @in: Rings we consume from
+ * @peer_lock: Held while picking an entry of the peer
+ *             table (taken before the lock of an entry)
+ * @peer: Peers we send to
+ */
+struct onet_shm {
+    int fd;
+    mac_addr_t hwaddr;
+    uint32_t slot_size;
+    pthread_mutex_t lock;
+    uint32_t next;
+    uint32_t burst;
+    struct shm_in in[ONET_SHM_PEERS];
+    uint8_t peer_lock;
+    struct onet_shm_peer peer[ONET_SHM_PEERS];
+};
+
+static int64_t
+shm_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static inline void
+shm_spin_lock(uint8_t *lock)
+{
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        continue;
+    }
+}
+
+static inline void
+shm_spin_unlock(uint8_t *lock)
+{
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static inline struct shm_slot *
+shm_slot(struct shm_ring *ring, uint32_t slot_size, uint64_t pos)
+{
+    return (void *)((char *)ring + sizeof(*ring) +
+                    (size_t)(pos & SHM_MASK) * slot_size);
+}
+
+/*
+ * Get the abstract socket address of a hardware address
+ *
+ * Returns the length of the address.
+ */
+static socklen_t
+shm_sun(mac_addr_t hwaddr, struct sockaddr_un *sun)
+{
+    int len;
+
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    len = snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1,
+                   "onet.%012llx", (unsigned long long)hwaddr);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/*
+ * Send a message to a peer, along with the ring file
+ * if `memfd' is not negative
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error.
+ */
+static int
+shm_msg_send(struct onet_shm *shm, mac_addr_t dst, uint32_t type, int memfd)
+{
+    struct sockaddr_un sun;
+    struct shm_msg msg;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct cmsghdr *cm;
+
+    msg.type = type;
+    msg.src = shm->hwaddr;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &sun;
+    mh.msg_namelen = shm_sun(dst, &sun);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (memfd >= 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+    }
+
+    if (sendmsg(shm->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Unmap the ring of a peer and remember it as remote
+ * for a while, the lock of the peer must be held
+ */
+static void
+shm_peer_drop(struct onet_shm_peer *peer)
+{
+    if (peer->ring != NULL) {
+        munmap(peer->ring, peer->size);
+        close(peer->memfd);
+        peer->ring = NULL;
+        peer->memfd = -1;
+    }
+
+    peer->retry_at = shm_now() + SHM_RETRY;
+    __atomic_store_n(&peer->state, SHM_PEER_REMOTE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Create a ring for a peer and hand it over
+ *
+ * Returns zero on success, otherwise a less than zero
+ * value on error (-ECONNREFUSED if nobody is behind the
+ * hardware address on this machine).
+ */
+static int
+shm_peer_connect(struct onet_shm *shm, struct onet_shm_peer *peer)
+{
+    struct shm_ring *ring;
+    size_t size;
+    int fd, error;
+
+    /*
+     * Most destinations are on other machines, find out
+     * before setting up a ring nobody will map.
+     */
+    if ((error = shm_msg_send(shm, peer->dst, SHM_MSG_PROBE, -1)) < 0) {
+        return (error == -ENOENT) ? -ECONNREFUSED : error;
+    }
+
+    size = sizeof(*ring) + (size_t)ONET_SHM_DEPTH * shm->slot_size;
+    fd = memfd_create("onet-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    /* The peer only maps rings that cannot change size */
+    if (ftruncate(fd, size) < 0 || fcntl(fd, F_ADD_SEALS, SHM_SEALS) < 0) {
+        error = -errno;
+        close(fd);
+        return error;
+    }
+
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        error = -errno;
+        close(fd);
+        return error;
+    }
+
+    ring->magic = SHM_MAGIC;
+    ring->slot_size = shm->slot_size;
+    ring->depth = ONET_SHM_DEPTH;
+    ring->src = shm->hwaddr;
+    if ((error = shm_msg_send(shm, peer->dst, SHM_MSG_RING, fd)) < 0) {
+        munmap(ring, size);
+        close(fd);
+        return error;
+    }
+
+    peer->ring = ring;
+    peer->size = size;
+    peer->memfd = fd;
+    return 0;
+}
+
+/*
+ * Take a ring handed over by a peer, replacing the one
+ * we had from it if any
+ */
+static void
+shm_adopt(struct onet_shm *shm, int fd)
+{
+    struct shm_ring *ring;
+    struct shm_in *in, *slot = NULL;
+    struct stat st;
+    uint32_t slot_size;
+    size_t size;
+    int seals;
+
+    /* A file that may shrink could SIGBUS us later on */
+    seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & SHM_SEALS) != SHM_SEALS ||
+        fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*ring)) {
+        close(fd);
+        return;
+    }
+
+    size = st.st_size;
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        return;
+    }
+
+    /* Do not trust what we were given */
+    slot_size = __atomic_load_n(&ring->slot_size, __ATOMIC_RELAXED);
+    if (ring->magic != SHM_MAGIC || ring->depth != ONET_SHM_DEPTH ||
+        slot_size <= sizeof(struct shm_slot) || slot_size > (1U << 20) ||
+        size < sizeof(*ring) + (size_t)ONET_SHM_DEPTH * slot_size) {
+        munmap(ring, size);
+        return;
+    }
+
+    pthread_mutex_lock(&shm->lock);
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        in = &shm->in[i];
+        if (in->ring == NULL) {
+            if (slot == NULL) {
+                slot = in;
+            }
+            continue;
+        }
+
+        if (in->ring == ring || in->ring->src == ring->src) {
+            munmap(in->ring, in->size);
+            in->ring = NULL;
+            slot = in;
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        pthread_mutex_unlock(&shm->lock);
+        munmap(ring, size);
+        return;
+    }
+
+    slot->ring = ring;
+    slot->size = size;
+    slot->slot_size = slot_size;
+    pthread_mutex_unlock(&shm->lock);
+}
+
+/*
+ * Handle every message waiting on the discovery socket
+ */
+static void
+shm_drain(struct onet_shm *shm)
+{
+    struct shm_msg msg;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct cmsghdr *cm;
+    ssize_t len;
+    int fd;
+
+    for (;;) {
+        iov.iov_base = &msg;
+        iov.iov_len = sizeof(msg);
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+
+        len = recvmsg(shm->fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        fd = -1;
+        cm = CMSG_FIRSTHDR(&mh);
+        if (cm != NULL && cm->cmsg_level == SOL_SOCKET &&
+            cm->cmsg_type == SCM_RIGHTS &&
+            cm->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+        }
+
+        if (len == sizeof(msg) && msg.type == SHM_MSG_RING && fd >= 0) {
+            shm_adopt(shm, fd);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+/*
+ * Pop a frame off the next ring that has one
+ *
+ * Returns the length of the frame, otherwise -EAGAIN
+ * if every ring is empty.
+ */
+static ssize_t
+shm_pop(struct onet_shm *shm, void *p, size_t len)
+{
+    struct shm_ring *ring;
+    struct shm_slot *slot;
+    uint64_t tail;
+    uint32_t idx, frame_len, max_len;
+
+    pthread_mutex_lock(&shm->lock);
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        idx = (shm->next + i) % ONET_SHM_PEERS;
+        if ((ring = shm->in[idx].ring) == NULL) {
+            continue;
+        }
+
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+            continue;
+        }
+
+        slot = shm_slot(ring, shm->in[idx].slot_size, tail);
+        max_len = shm->in[idx].slot_size - sizeof(*slot);
+        frame_len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+        if (frame_len > max_len) {
+            frame_len = max_len;
+        }
+        if (frame_len > len) {
+            frame_len = len;
+        }
+
+        memcpy(p, slot->frame, frame_len);
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        shm->next = idx + 1;
+        pthread_mutex_unlock(&shm->lock);
+        return frame_len;
+    }
+
+    pthread_mutex_unlock(&shm->lock);
+    return -EAGAIN;
+}
+
+/*
+ * Tell every producer we are about to block, or that we
+ * are not anymore
+ *
+ * Returns true if a ring got a frame in the meantime.
+ */
+static bool
+shm_sleep(struct onet_shm *shm, uint32_t sleeping)
+{
+    struct shm_ring *ring;
+    bool ready = false;
+
+    pthread_mutex_lock(&shm->lock);
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        if ((ring = shm->in[i].ring) != NULL) {
+            __atomic_store_n(&ring->sleeping, sleeping, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    /* Pairs with the fence in onet_shm_push() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < ONET_SHM_PEERS && sleeping; ++i) {
+        ring = shm->in[i].ring;
+        if (ring != NULL && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) !=
+            __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)) {
+            ready = true;
+        }
+    }
+
+    pthread_mutex_unlock(&shm->lock);
+    return ready;
+}
+
+int
+onet_shm_attach(struct onet_link *link)
+{
+    struct onet_shm *shm;
+    struct sockaddr_un sun;
+    socklen_t sun_len;
+    int error;
+
+    if (link == NULL || link->shm != NULL) {
+        return -EINVAL;
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    /* Frames would bypass the ring and the UMEM */
+    if (link->rx_ring.base != NULL || link->xsk != NULL) {
+        return -EBUSY;
+    }
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL) {
+        return -ENOMEM;
+    }
+
+    shm->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (shm->fd < 0) {
+        error = -errno;
+        free(shm);
+        return error;
+    }
+
+    sun_len = shm_sun(link->hwaddr, &sun);
+    if (bind(shm->fd, (struct sockaddr *)&sun, sun_len) < 0) {
+        error = -errno;
+        close(shm->fd);
+        free(shm);
+        return error;
+    }
+
+    shm->hwaddr = link->hwaddr;
+    shm->slot_size = (sizeof(struct shm_slot) + sizeof(struct ether_hdr) +
+                      link->mtu + 63) & ~63U;
+    pthread_mutex_init(&shm->lock, NULL);
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        shm->peer[i].memfd = -1;
+        shm->peer[i].shm = shm;
+    }
+
+    link->shm = shm;
+    return 0;
+}
+
+void
+onet_shm_close(struct onet_link *link)
+{
+    struct onet_shm *shm;
+
+    if (link == NULL || (shm = link->shm) == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        if (shm->peer[i].ring != NULL) {
+            munmap(shm->peer[i].ring, shm->peer[i].size);
+            close(shm->peer[i].memfd);
+        }
+        if (shm->in[i].ring != NULL) {
+            munmap(shm->in[i].ring, shm->in[i].size);
+        }
+    }
+
+    close(shm->fd);
+    pthread_mutex_destroy(&shm->lock);
+    free(shm);
+    link->shm = NULL;
+}
+
+struct onet_shm_peer *
+onet_shm_peer(struct onet_link *link, mac_addr_t dst)
+{
+    struct onet_shm *shm = link->shm;
+    struct onet_shm_peer *peer, *slot = NULL;
+    int64_t now;
+    int error;
+
+    if (shm == NULL || dst == shm->hwaddr || MAC_IS_MULTICAST(dst)) {
+        return NULL;
+    }
+
+    /* Most sends go to a peer we already know about */
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        peer = &shm->peer[i];
+        if (__atomic_load_n(&peer->state, __ATOMIC_ACQUIRE) ==
+            SHM_PEER_LOCAL && peer->dst == dst) {
+            return peer;
+        }
+    }
+
+    shm_spin_lock(&shm->peer_lock);
+    now = shm_now();
+    for (int i = 0; i < ONET_SHM_PEERS; ++i) {
+        peer = &shm->peer[i];
+        switch (peer->state) {
+        case SHM_PEER_FREE:
+            if (slot == NULL) {
+                slot = peer;
+            }
+            continue;
+        case SHM_PEER_REMOTE:
+            if (peer->dst != dst) {
+                if (slot == NULL || slot->state != SHM_PEER_FREE) {
+                    slot = peer;
+                }
+                continue;
+            }
+            if (now < peer->retry_at) {
+                shm_spin_unlock(&shm->peer_lock);
+                return NULL;
+            }
+            slot = peer;
+            break;
+        case SHM_PEER_LOCAL:
+            if (peer->dst == dst) {
+                shm_spin_unlock(&shm->peer_lock);
+                return peer;
+            }
+            continue;
+        }
+        break;
+    }
+
+    /* Every entry is a local peer, go through the NIC */
+    if (slot == NULL) {
+        shm_spin_unlock(&shm->peer_lock);
+        return NULL;
+    }
+
+    shm_spin_lock(&slot->lock);
+    slot->dst = dst;
+    if ((error = shm_peer_connect(shm, slot)) < 0) {
+        shm_peer_drop(slot);
+    } else {
+        __atomic_store_n(&slot->state, SHM_PEER_LOCAL, __ATOMIC_RELEASE);
+    }
+
+    shm_spin_unlock(&slot->lock);
+    shm_spin_unlock(&shm->peer_lock);
+    return (error < 0) ? NULL : slot;
+}
+
+char *
+onet_shm_slot(struct onet_shm_peer *peer, mac_addr_t dst, size_t len)
+{
+    struct onet_shm *shm = peer->shm;
+    struct shm_ring *ring;
+    uint64_t head;
+    int error;
+
+    if (len > shm->slot_size - sizeof(struct shm_slot)) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    shm_spin_lock(&peer->lock);
+    if ((ring = peer->ring) == NULL || peer->dst != dst) {
+        shm_spin_unlock(&peer->lock);
+        errno = ENOTCONN;
+        return NULL;
+    }
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) <
+        ONET_SHM_DEPTH) {
+        shm_slot(ring, shm->slot_size, head)->len = len;
+        return shm_slot(ring, shm->slot_size, head)->frame;
+    }
+
+    /*
+     * The ring is full. Hand it over again, that finds out
+     * whether the peer is still around and lets a peer that
+     * came back up pick it up.
+     */
+    error = shm_msg_send(shm, peer->dst, SHM_MSG_RING, peer->memfd);
+    if (error == -ECONNREFUSED || error == -ENOENT) {
+        shm_peer_drop(peer);
+        shm_spin_unlock(&peer->lock);
+        errno = ENOTCONN;
+        return NULL;
+    }
+
+    shm_spin_unlock(&peer->lock);
+    errno = ENOBUFS;
+    return NULL;
+}
+
+void
+onet_shm_push(struct onet_shm_peer *peer)
+{
+    struct shm_ring *ring = peer->ring;
+
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in shm_sleep() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_RELAXED)) {
+        if (shm_msg_send(peer->shm, peer->dst, SHM_MSG_WAKE, -1) ==
+            -ECONNREFUSED) {
+            shm_peer_drop(peer);
+        }
+    }
+
+    shm_spin_unlock(&peer->lock);
+}
+
+ssize_t
+onet_shm_recv(struct onet_link *link, void *p, size_t len, int timeout)
+{
+    struct onet_shm *shm = link->shm;
+    struct pollfd pfd[2];
+    int64_t deadline = 0;
+    ssize_t ret;
+    int wait;
+
+    if (timeout > 0) {
+        deadline = shm_now() + timeout;
+    }
+
+    for (;;) {
+        /* Do not let a busy peer starve the NIC */
+        if (shm->burst < SHM_BURST) {
+            if ((ret = shm_pop(shm, p, len)) >= 0) {
+                ++shm->burst;
+                return ret;
+            }
+        }
+
+        shm->burst = 0;
+        ret = recv(link->sockfd, p, len, MSG_DONTWAIT);
+        if (ret >= 0) {
+            return ret;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -errno;
+        }
+        if ((ret = shm_pop(shm, p, len)) >= 0) {
+            return ret;
+        }
+
+        wait = timeout;
+        if (timeout > 0 && (wait = deadline - shm_now()) < 0) {
+            wait = 0;
+        }
+
+        if (wait == 0) {
+            shm_drain(shm);
+            return shm_pop(shm, p, len);
+        }
+
+        if (!shm_sleep(shm, 1)) {
+            pfd[0].fd = link->sockfd;
+            pfd[0].events = POLLIN;
+            pfd[0].revents = 0;
+            pfd[1].fd = shm->fd;
+            pfd[1].events = POLLIN;
+            pfd[1].revents = 0;
+            poll(pfd, 2, wait);
+        }
+
+        shm_sleep(shm, 0);
+        shm_drain(shm);
+    }
+}
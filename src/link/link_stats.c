@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "link.h"
+#include "stats.h"
+
+static const char *stat_names[ONET_STAT_MAX] = {
+    [ONET_STAT_RX_PACKETS] = "rx_packets",
+    [ONET_STAT_RX_BYTES] = "rx_bytes",
+    [ONET_STAT_TX_PACKETS] = "tx_packets",
+    [ONET_STAT_TX_BYTES] = "tx_bytes",
+    [ONET_STAT_RX_SQUEAKS] = "rx_squeaks",
+    [ONET_STAT_DROP_PROTO] = "drop_proto",
+    [ONET_STAT_DROP_CRC] = "drop_crc",
+    [ONET_STAT_DROP_NOTUS] = "drop_notus",
+    [ONET_STAT_DROP_ALLOC] = "drop_alloc",
+    [ONET_STAT_DROP_SEND] = "drop_send"
+};
+
+static uint32_t stats_next;
+__thread uint32_t onet_stats_idx;
+
+/*
+ * Get the path of a stats page
+ *
+ * Returns -EINVAL if `name' may not be used.
+ */
+static int
+stats_path(const char *name, char *buf, size_t len)
+{
+    if (name == NULL || *name == '\0' || strchr(name, '/') != NULL ||
+        strlen(name) >= ONET_STATS_NAME_MAX) {
+        return -EINVAL;
+    }
+
+    snprintf(buf, len, "%s/onet.%s", ONET_STATS_DIR, name);
+    return 0;
+}
+
+static void
+stats_head(struct onet_stats_page *page, mac_addr_t hwaddr)
+{
+    page->magic = ONET_STATS_MAGIC;
+    page->version = ONET_STATS_VERSION;
+    page->nstats = ONET_STAT_MAX;
+    page->nslots = ONET_STATS_SLOTS;
+    page->hwaddr = hwaddr;
+    page->pid = getpid();
+}
+
+/*
+ * Returns true if the process that published the page
+ * at `path' is gone. A page we cannot make sense of is
+ * taken to be in use, its owner may still be setting
+ * it up.
+ */
+static bool
+stats_orphan(const char *path)
+{
+    uint64_t pid;
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+
+    len = pread(fd, &pid, sizeof(pid),
+                offsetof(struct onet_stats_page, pid));
+    close(fd);
+    if (len != sizeof(pid) || pid == 0 || pid > INT_MAX) {
+        return false;
+    }
+
+    return kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+}
+
+/*
+ * Add up every counter set of a page
+ */
+static void
+stats_sum(const struct onet_stats_page *page, struct onet_stats *res)
+{
+    memset(res, 0, sizeof(*res));
+    res->hwaddr = page->hwaddr;
+    res->pid = page->pid;
+    for (uint32_t i = 0; i < ONET_STATS_SLOTS; ++i) {
+        for (uint32_t j = 0; j < ONET_STAT_MAX; ++j) {
+            res->v[j] += __atomic_load_n(&page->slot[i].v[j],
+                                         __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void
+onet_stats_init(struct onet_link *link)
+{
+    struct onet_stats_page *page;
+
+    page = aligned_alloc(64, sizeof(*page));
+    if (page == NULL) {
+        return;
+    }
+
+    memset(page, 0, sizeof(*page));
+    stats_head(page, link->hwaddr);
+    link->stats = page;
+}
+
+void
+onet_stats_free(struct onet_link *link)
+{
+    char path[PATH_MAX];
+
+    if (link->stats_pub != 0) {
+        if (stats_path(link->stats->name, path, sizeof(path)) == 0) {
+            unlink(path);
+        }
+        munmap(link->stats, link->stats_pub);
+        link->stats = link->stats_old;
+        link->stats_old = NULL;
+        link->stats_pub = 0;
+    }
+
+    free(link->stats);
+    link->stats = NULL;
+}
+
+uint32_t
+onet_stats_slot(void)
+{
+    return __atomic_fetch_add(&stats_next, 1, __ATOMIC_RELAXED) %
+        ONET_STATS_SLOTS;
+}
+
+const char *
+onet_stat_name(uint32_t stat)
+{
+    if (stat >= ONET_STAT_MAX) {
+        return NULL;
+    }
+
+    return stat_names[stat];
+}
+
+int
+onet_stats_get(struct onet_link *link, struct onet_stats *res)
+{
+    struct onet_stats_page *page;
+
+    if (link == NULL || res == NULL) {
+        return -EINVAL;
+    }
+
+    page = __atomic_load_n(&link->stats, __ATOMIC_ACQUIRE);
+    if (page == NULL) {
+        return -ENOMEM;
+    }
+
+    stats_sum(page, res);
+    return 0;
+}
+
+int
+onet_stats_publish(struct onet_link *link, const char *name)
+{
+    struct onet_stats_page *page;
+    char path[PATH_MAX];
+    int fd, error;
+
+    if (link == NULL || link->stats == NULL || link->stats_pub != 0) {
+        return -EINVAL;
+    }
+
+    if ((error = stats_path(name, path, sizeof(path))) < 0) {
+        return error;
+    }
+
+    /* A page left behind by a process that died is replaced */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        if (!stats_orphan(path)) {
+            return -EBUSY;
+        }
+
+        unlink(path);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+
+    if (fd < 0) {
+        return (errno == EEXIST) ? -EBUSY : -errno;
+    }
+
+    if (ftruncate(fd, sizeof(*page)) < 0) {
+        error = -errno;
+        close(fd);
+        unlink(path);
+        return error;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        error = -errno;
+        unlink(path);
+        return error;
+    }
+
+    memcpy(page->slot, link->stats->slot, sizeof(page->slot));
+    snprintf(page->name, sizeof(page->name), "%s", name);
+    stats_head(page, link->hwaddr);
+
+    /*
+     * The old counters stay around until the link is closed,
+     * threads that still have them in hand may bump them.
+     */
+    link->stats_old = link->stats;
+    link->stats_pub = sizeof(*page);
+    __atomic_store_n(&link->stats, page, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+onet_stats_read(const char *name, struct onet_stats *res)
+{
+    const struct onet_stats_page *page;
+    char path[PATH_MAX];
+    struct stat st;
+    int fd, error;
+
+    if (res == NULL) {
+        return -EINVAL;
+    }
+
+    if ((error = stats_path(name, path, sizeof(path))) < 0) {
+        return error;
+    }
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -errno;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*page)) {
+        close(fd);
+        return -EPROTO;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return -errno;
+    }
+
+    /* Pages from another layout are not ours to read */
+    if (page->magic != ONET_STATS_MAGIC ||
+        page->version != ONET_STATS_VERSION ||
+        page->nstats != ONET_STAT_MAX || page->nslots != ONET_STATS_SLOTS) {
+        munmap((void *)page, sizeof(*page));
+        return -EPROTO;
+    }
+
+    stats_sum(page, res);
+    munmap((void *)page, sizeof(*page));
+    return 0;
+}
@@ -31,17 +31,87 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <netinet/in.h>
+#include <linux/if_packet.h>
 #include <net/if.h>
 #include <net/ethernet.h>
+#include <poll.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include "link.h"
 
+#define POOL_FRAME_NR 256
+
+static ssize_t
+packet_send(struct onet_link *link, const void *p, size_t len)
+{
+    struct sockaddr_ll saddr;
+
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sll_family = AF_PACKET;
+    saddr.sll_protocol = htons(PROTO_ID);
+    saddr.sll_ifindex = link->iface_idx;
+    saddr.sll_halen = HW_ADDR_LEN;
+    if (sendto(link->sockfd, p, len, 0, (struct sockaddr *)&saddr,
+               sizeof(saddr)) < 0) {
+        return -errno;
+    }
+
+    return len;
+}
+
+static ssize_t
+packet_recv(struct onet_link *link, void *p, size_t len, int timeout)
+{
+    struct pollfd pfd;
+    ssize_t recv_len;
+
+    if (link->shm != NULL) {
+        return onet_shm_recv(link, p, len, timeout);
+    }
+
+    if (timeout >= 0) {
+        pfd.fd = link->sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) <= 0) {
+            return -EAGAIN;
+        }
+    }
+
+    recv_len = recv(link->sockfd, p, len, (timeout >= 0) ? MSG_DONTWAIT : 0);
+    if (recv_len < 0) {
+        return (errno == EINTR) ? -EAGAIN : -errno;
+    }
+
+    return recv_len;
+}
+
+static void
+packet_close(struct onet_link *link)
+{
+    close(link->sockfd);
+}
+
+const struct onet_transport onet_packet_transport = {
+    .name = "packet",
+    .send = packet_send,
+    .recv = packet_recv,
+    .close = packet_close
+};
+
 int
 onet_open(const char *iface, struct onet_link *res)
 {
+    return onet_open_flags(iface, 0, res);
+}
+
+int
+onet_open_flags(const char *iface, uint32_t flags, struct onet_link *res)
+{
+    struct sockaddr_ll saddr;
     struct ifreq ifr;
     int error;
 
@@ -49,8 +119,15 @@ onet_open(const char *iface, struct onet_link *res)
         return -EINVAL;
     }
 
-    /* Open a raw socket */
-    res->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    memset(res, 0, sizeof(*res));
+    res->tp = &onet_packet_transport;
+    pthread_mutex_init(&res->tx_lock, NULL);
+
+    /*
+     * Open a raw socket. It does not receive anything until
+     * it is bound below, once the filter is in place.
+     */
+    res->sockfd = socket(AF_PACKET, SOCK_RAW, 0);
     if (res->sockfd < 0) {
         return res->sockfd;
     }
@@ -60,7 +137,7 @@ onet_open(const char *iface, struct onet_link *res)
     error = ioctl(res->sockfd, SIOGIFINDEX, &ifr);
     if (error < 0) {
         printf("ioctl[SIOGIFHWADDR]: could not read hwaddr \"%s\"\n", iface);
-        return error;
+        goto fail;
     }
 
     res->iface_idx = ifr.ifr_ifindex;
@@ -69,11 +146,68 @@ onet_open(const char *iface, struct onet_link *res)
     error = ioctl(res->sockfd, SIOCGIFHWADDR, &ifr);
     if (error < 0) {
         printf("ioctl[SIOGIFHWADDR]: could not read hwaddr \"%s\"\n", iface);
-        return error;
+        goto fail;
     }
 
     res->hwaddr = mac_swap((void *)ifr.ifr_hwaddr.sa_data);
+
+    /* Get the MTU so we know how large frames may be */
+    error = ioctl(res->sockfd, SIOCGIFMTU, &ifr);
+    if (error < 0) {
+        printf("ioctl[SIOCGIFMTU]: could not read mtu \"%s\"\n", iface);
+        goto fail;
+    }
+
+    res->mtu = ifr.ifr_mtu;
+
+    /* Only let ONET frames meant for us through */
+    if ((error = onet_filter_attach(res)) < 0) {
+        printf("setsockopt[SO_ATTACH_FILTER]: failed on \"%s\"\n", iface);
+        goto fail;
+    }
+
+    /* Only take our protocol from our interface */
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sll_family = AF_PACKET;
+    saddr.sll_protocol = htons(PROTO_ID);
+    saddr.sll_ifindex = res->iface_idx;
+    error = bind(res->sockfd, (struct sockaddr *)&saddr, sizeof(saddr));
+    if (error < 0) {
+        printf("bind: could not bind to \"%s\"\n", iface);
+        goto fail;
+    }
+
+    /*
+     * Frames for the send and receive paths. If this fails
+     * the link still works, it just falls back to malloc().
+     * The same goes for the counters, they are just not kept.
+     */
+    onet_pool_init(
+        &res->pool, sizeof(struct ether_hdr) + res->mtu,
+        POOL_FRAME_NR
+    );
+    onet_stats_init(res);
+
+    if ((error = onet_reasm_init(res)) < 0) {
+        onet_close(res);
+        return error;
+    }
+
+    if ((flags & ONET_O_XDP) != 0) {
+        if ((error = onet_xsk_open(res)) < 0) {
+            printf("xsk: could not set up AF_XDP on \"%s\"\n", iface);
+            onet_close(res);
+            return error;
+        }
+    }
+
     return 0;
+
+fail:
+    close(res->sockfd);
+    res->sockfd = -1;
+    pthread_mutex_destroy(&res->tx_lock);
+    return error;
 }
 
 int
@@ -83,5 +217,43 @@ onet_close(struct onet_link *olp)
         return -EINVAL;
     }
 
-    close(olp->sockfd);
+    onet_port_free(olp);
+    onet_reasm_free(olp);
+    onet_neigh_free(olp);
+    onet_tstamp_free(olp);
+    onet_shm_close(olp);
+    onet_xsk_close(olp);
+    onet_ring_free(olp);
+    onet_pool_free(&olp->pool);
+    onet_stats_free(olp);
+    olp->tp->close(olp);
+    pthread_mutex_destroy(&olp->tx_lock);
+    return 0;
+}
+
+int
+onet_open_tp(const struct onet_transport *tp, void *priv, mac_addr_t hwaddr,
+             uint32_t mtu, struct onet_link *res)
+{
+    if (tp == NULL || res == NULL || mtu < 64) {
+        return -EINVAL;
+    }
+
+    memset(res, 0, sizeof(*res));
+    if (onet_reasm_init(res) < 0) {
+        return -ENOMEM;
+    }
+
+    pthread_mutex_init(&res->tx_lock, NULL);
+    res->tp = tp;
+    res->tp_priv = priv;
+    res->sockfd = -1;
+    res->hwaddr = hwaddr;
+    res->mtu = mtu;
+    onet_pool_init(
+        &res->pool, sizeof(struct ether_hdr) + res->mtu,
+        POOL_FRAME_NR
+    );
+    onet_stats_init(res);
+    return 0;
 }
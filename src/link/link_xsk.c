@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "link.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Number of UMEM frames, half of them for each direction */
+#define XSK_FRAME_NR 4096
+
+/* Entries in each of the four rings */
+#define XSK_RING_NR 2048
+
+/*
+ * Build a single eBPF instruction
+ */
+#define XSK_INSN(CODE, DST, SRC, OFF, IMM)  \
+    ((struct bpf_insn) {                    \
+        .code = (CODE),                     \
+        .dst_reg = (DST),                   \
+        .src_reg = (SRC),                   \
+        .off = (OFF),                       \
+        .imm = (IMM)                        \
+    })
+
+static inline int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Load the XDP program. It redirects ONET frames to
+ * the socket bound to the queue they came in on and
+ * passes everything else (or anything arriving on a
+ * queue without a socket) on to the kernel:
+ *
+ *   r2 = ctx->data
+ *   r3 = ctx->data_end
+ *   r4 = r2 + 14
+ *   if r4 > r3 goto pass
+ *   r4 = *(u16 *)(r2 + 12)
+ *   if r4 != PROTO_ID goto pass
+ *   r2 = ctx->rx_queue_index
+ *   r1 = map
+ *   r3 = XDP_PASS
+ *   return bpf_redirect_map(r1, r2, r3)
+ * pass:
+ *   return XDP_PASS
+ */
+static int
+xsk_prog_load(int map_fd)
+{
+    struct bpf_insn prog[] = {
+        XSK_INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1,
+                 offsetof(struct xdp_md, data), 0),
+        XSK_INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1,
+                 offsetof(struct xdp_md, data_end), 0),
+        XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        XSK_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0,
+                 sizeof(struct ether_hdr)),
+        XSK_INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0),
+        XSK_INSN(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2,
+                 offsetof(struct ether_hdr, proto), 0),
+        XSK_INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6,
+                 htons(PROTO_ID)),
+        XSK_INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1,
+                 offsetof(struct xdp_md, rx_queue_index), 0),
+        XSK_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1,
+                 BPF_PSEUDO_MAP_FD, 0, map_fd),
+        XSK_INSN(0, 0, 0, 0, 0),
+        XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        XSK_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        XSK_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        XSK_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t)"Dual BSD/GPL";
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int
+xsk_map_create(void)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = 1;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+/*
+ * Set the size of one of the rings of an AF_XDP
+ * socket and map it.
+ *
+ * @fd: AF_XDP socket
+ * @opt: Socket option creating the ring
+ * @off: Offsets of the ring (from XDP_MMAP_OFFSETS)
+ * @pgoff: mmap() offset of the ring
+ * @entsize: Size of each ring entry
+ * @res: Result is written here
+ */
+static int
+xsk_ring_map(int fd, const struct xdp_ring_offset *off, uint64_t pgoff,
+             size_t entsize, struct onet_xring *res)
+{
+    char *map;
+
+    res->map_len = off->desc + XSK_RING_NR * entsize;
+    map = mmap(
+        NULL, res->map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, pgoff
+    );
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+
+    res->map = map;
+    res->producer = (void *)(map + off->producer);
+    res->consumer = (void *)(map + off->consumer);
+    res->flags = (void *)(map + off->flags);
+    res->ring = map + off->desc;
+    res->mask = XSK_RING_NR - 1;
+    return 0;
+}
+
+static void
+xsk_ring_unmap(struct onet_xring *ring)
+{
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->map_len);
+    }
+}
+
+/*
+ * Create the UMEM and rings of an AF_XDP socket, then
+ * bind it to queue 0 of the link interface.
+ */
+static int
+xsk_socket(struct onet_link *link, struct onet_xsk *xsk)
+{
+    struct xdp_mmap_offsets off;
+    struct xdp_umem_reg reg;
+    struct sockaddr_xdp sxdp;
+    uint64_t *fill;
+    socklen_t optlen;
+    int ring_nr = XSK_RING_NR;
+    uint32_t i, half;
+    int error;
+
+    /* Frames are power of two sized chunks of the UMEM */
+    xsk->frame_size = 2048;
+    while (xsk->frame_size < sizeof(struct ether_hdr) + link->mtu) {
+        xsk->frame_size <<= 1;
+    }
+
+    xsk->frame_nr = XSK_FRAME_NR;
+    xsk->umem_len = (size_t)xsk->frame_nr * xsk->frame_size;
+    xsk->umem = mmap(
+        NULL, xsk->umem_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0
+    );
+    if (xsk->umem == MAP_FAILED) {
+        xsk->umem = NULL;
+        return -ENOMEM;
+    }
+
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0) {
+        return -errno;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)xsk->umem;
+    reg.len = xsk->umem_len;
+    reg.chunk_size = xsk->frame_size;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        return -errno;
+    }
+
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+                   &ring_nr, sizeof(ring_nr)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                   &ring_nr, sizeof(ring_nr)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING,
+                   &ring_nr, sizeof(ring_nr)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING,
+                   &ring_nr, sizeof(ring_nr)) < 0) {
+        return -errno;
+    }
+
+    optlen = sizeof(off);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        return -errno;
+    }
+
+    error = xsk_ring_map(
+        xsk->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+        sizeof(uint64_t), &xsk->fill
+    );
+    if (error == 0) {
+        error = xsk_ring_map(
+            xsk->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING,
+            sizeof(uint64_t), &xsk->comp
+        );
+    }
+    if (error == 0) {
+        error = xsk_ring_map(
+            xsk->fd, &off.rx, XDP_PGOFF_RX_RING,
+            sizeof(struct xdp_desc), &xsk->rx
+        );
+    }
+    if (error == 0) {
+        error = xsk_ring_map(
+            xsk->fd, &off.tx, XDP_PGOFF_TX_RING,
+            sizeof(struct xdp_desc), &xsk->tx
+        );
+    }
+    if (error < 0) {
+        return error;
+    }
+
+    /* First half of the UMEM to receive into, second half to send from */
+    half = xsk->frame_nr / 2;
+    if (half > XSK_RING_NR) {
+        half = XSK_RING_NR;
+    }
+
+    fill = xsk->fill.ring;
+    for (i = 0; i < half; ++i) {
+        fill[i] = (uint64_t)i * xsk->frame_size;
+    }
+    __atomic_store_n(xsk->fill.producer, half, __ATOMIC_RELEASE);
+
+    xsk->tx_free = calloc(xsk->frame_nr - half, sizeof(*xsk->tx_free));
+    if (xsk->tx_free == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = half; i < xsk->frame_nr; ++i) {
+        xsk->tx_free[xsk->tx_nfree++] = (uint64_t)i * xsk->frame_size;
+    }
+
+    /* Generic mode has no zero-copy, ask for copy mode up front */
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = link->iface_idx;
+    sxdp.sxdp_queue_id = 0;
+    sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        return -errno;
+    }
+
+    xsk->rx_cur = UINT64_MAX;
+    return 0;
+}
+
+/*
+ * Load the XDP program, point queue 0 at our socket and
+ * attach the program to the interface in generic mode.
+ */
+static int
+xsk_attach(struct onet_link *link, struct onet_xsk *xsk)
+{
+    union bpf_attr attr;
+    uint32_t key = 0;
+
+    if ((xsk->map_fd = xsk_map_create()) < 0) {
+        return -errno;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xsk->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&xsk->fd;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        return -errno;
+    }
+
+    if ((xsk->prog_fd = xsk_prog_load(xsk->map_fd)) < 0) {
+        return -errno;
+    }
+
+    /* The program stays attached for as long as the BPF link is open */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xsk->prog_fd;
+    attr.link_create.target_ifindex = link->iface_idx;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    if ((xsk->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+int
+onet_xsk_open(struct onet_link *link)
+{
+    struct onet_xsk *xsk;
+    int error;
+
+    if (link == NULL || link->xsk != NULL) {
+        return -EINVAL;
+    }
+
+    if (!ONET_LINK_PACKET(link)) {
+        return -ENOTSUP;
+    }
+
+    if (link->shm != NULL) {
+        return -EBUSY;
+    }
+
+    xsk = calloc(1, sizeof(*xsk));
+    if (xsk == NULL) {
+        return -ENOMEM;
+    }
+
+    xsk->fd = -1;
+    xsk->map_fd = -1;
+    xsk->prog_fd = -1;
+    xsk->link_fd = -1;
+    link->xsk = xsk;
+
+    if ((error = xsk_socket(link, xsk)) < 0) {
+        onet_xsk_close(link);
+        return error;
+    }
+
+    if ((error = xsk_attach(link, xsk)) < 0) {
+        onet_xsk_close(link);
+        return error;
+    }
+
+    return 0;
+}
+
+void
+onet_xsk_close(struct onet_link *link)
+{
+    struct onet_xsk *xsk;
+
+    if (link == NULL || (xsk = link->xsk) == NULL) {
+        return;
+    }
+
+    if (xsk->link_fd >= 0) {
+        close(xsk->link_fd);
+    }
+    if (xsk->prog_fd >= 0) {
+        close(xsk->prog_fd);
+    }
+    if (xsk->map_fd >= 0) {
+        close(xsk->map_fd);
+    }
+
+    xsk_ring_unmap(&xsk->fill);
+    xsk_ring_unmap(&xsk->comp);
+    xsk_ring_unmap(&xsk->rx);
+    xsk_ring_unmap(&xsk->tx);
+    if (xsk->fd >= 0) {
+        close(xsk->fd);
+    }
+    if (xsk->umem != NULL) {
+        munmap(xsk->umem, xsk->umem_len);
+    }
+
+    free(xsk->tx_free);
+    free(xsk);
+    link->xsk = NULL;
+}
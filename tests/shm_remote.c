@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Send off-box with shared memory delivery attached, the
+ * destination has nobody behind it on this machine so the
+ * frame has to go out through the link.
+ *
+ * Needs CAP_NET_RAW, run as "shm_remote [iface]".
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "if_ether.h"
+#include "dgram.h"
+#include "link.h"
+
+#define REMOTE_ADDR 0x02DEADBEEF01ULL
+#define SEND_COUNT  (ONET_SHM_PEERS * 4)
+
+int
+main(int argc, char **argv)
+{
+    const char *iface = (argc > 1) ? argv[1] : "lo";
+    struct onet_link link;
+    char buf[64];
+    tx_len_t ret;
+    int error;
+
+    if ((error = onet_open(iface, &link)) < 0) {
+        printf("shm_remote: could not open \"%s\" (%d)\n", iface, error);
+        return 1;
+    }
+
+    if ((error = onet_shm_attach(&link)) < 0) {
+        printf("shm_remote: onet_shm_attach failed (%d)\n", error);
+        onet_close(&link);
+        return 1;
+    }
+
+    /* More destinations than entries, so they get recycled */
+    memset(buf, 0xA5, sizeof(buf));
+    for (int i = 0; i < SEND_COUNT; ++i) {
+        ret = dgram_send(&link, REMOTE_ADDR + i, buf, sizeof(buf));
+        if (ret != sizeof(buf)) {
+            printf("shm_remote: send %d returned %d\n", i, ret);
+            onet_close(&link);
+            return 1;
+        }
+    }
+
+    onet_close(&link);
+    printf("shm_remote: ok\n");
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2023-2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "if_ether.h"
+#include "stats.h"
+
+#define MAX_PAGES 64
+
+/*
+ * Represents a stats page being watched
+ *
+ * @name: Name the page was published under
+ * @last: Counters as of the last report
+ */
+struct page {
+    char name[ONET_STATS_NAME_MAX];
+    struct onet_stats last;
+};
+
+static struct page pages[MAX_PAGES];
+static size_t npages = 0;
+
+static void
+help(char **argv)
+{
+    printf(
+        "usage: %s [-h] [-i <secs>] [name ...]\n"
+        "[-h]   Show this message\n"
+        "[-i]   Report rates every <secs> seconds instead of totals\n"
+        "Every published link is shown if no name is given.\n",
+        argv[0]
+    );
+}
+
+static void
+add_page(const char *name)
+{
+    if (npages < MAX_PAGES) {
+        snprintf(pages[npages++].name, ONET_STATS_NAME_MAX, "%s", name);
+    }
+}
+
+/*
+ * Find every page under ONET_STATS_DIR
+ */
+static void
+scan_pages(void)
+{
+    struct dirent *ent;
+    DIR *dir;
+
+    if ((dir = opendir(ONET_STATS_DIR)) == NULL) {
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "onet.", 5) == 0 &&
+            strlen(ent->d_name + 5) < ONET_STATS_NAME_MAX) {
+            add_page(ent->d_name + 5);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void
+print_head(bool rates)
+{
+    printf("%-16s %-17s %8s", "name", "hwaddr", "pid");
+    for (uint32_t i = 0; i < ONET_STAT_MAX; ++i) {
+        printf(" %12s", onet_stat_name(i));
+    }
+    printf("%s\n", rates ? "  (per second)" : "");
+}
+
+/*
+ * Print one page, totals or what changed since the
+ * last report
+ *
+ * @pg: Page to print
+ * @secs: Seconds since the last report, zero for totals
+ */
+static void
+print_page(struct page *pg, unsigned int secs)
+{
+    struct onet_stats st;
+    const char *state = "";
+    char pid[16];
+    uint64_t v;
+    int error;
+
+    if ((error = onet_stats_read(pg->name, &st)) < 0) {
+        printf("%-16s error %d\n", pg->name, error);
+        return;
+    }
+
+    /* Pages of processes that died without closing stay */
+    if (kill(st.pid, 0) < 0 && errno == ESRCH) {
+        state = "*";
+    }
+
+    snprintf(pid, sizeof(pid), "%lu%s", (unsigned long)st.pid, state);
+    printf("%-16s %02x:%02x:%02x:%02x:%02x:%02x %8s", pg->name,
+           (unsigned)(st.hwaddr >> 40) & 0xFF,
+           (unsigned)(st.hwaddr >> 32) & 0xFF,
+           (unsigned)(st.hwaddr >> 24) & 0xFF,
+           (unsigned)(st.hwaddr >> 16) & 0xFF,
+           (unsigned)(st.hwaddr >> 8) & 0xFF,
+           (unsigned)st.hwaddr & 0xFF, pid);
+
+    for (uint32_t i = 0; i < ONET_STAT_MAX; ++i) {
+        v = st.v[i];
+        if (secs != 0) {
+            v = (v - pg->last.v[i]) / secs;
+        }
+        printf(" %12lu", (unsigned long)v);
+    }
+
+    printf("\n");
+    pg->last = st;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int interval = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hi:")) != -1) {
+        switch (opt) {
+        case 'h':
+            help(argv);
+            return -1;
+        case 'i':
+            interval = strtoul(optarg, NULL, 10);
+            break;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        add_page(argv[i]);
+    }
+
+    if (optind == argc) {
+        scan_pages();
+    }
+
+    if (npages == 0) {
+        printf("no published links under %s\n", ONET_STATS_DIR);
+        return -1;
+    }
+
+    print_head(false);
+    for (size_t i = 0; i < npages; ++i) {
+        print_page(&pages[i], 0);
+    }
+
+    while (interval != 0) {
+        sleep(interval);
+        printf("\n");
+        print_head(true);
+        for (size_t i = 0; i < npages; ++i) {
+            print_page(&pages[i], interval);
+        }
+    }
+
+    return 0;
+}